@@ -0,0 +1,33 @@
+// Set 0 is the bindless table, see BindlessTable. Indices of this draw come
+// from push constants.
+layout(set = 0, binding = 0)uniform texture2D textures[];
+layout(set = 0, binding = 1)uniform sampler samplers[];
+layout(std430, set = 0, binding = 2)readonly buffer SceneData {
+  mat4 view;
+  mat4 proj;
+  mat4 model;
+} scene_data[];
+
+// Per-draw data, the same binding read as another block. Draws pick their
+// entry with their first instance.
+struct DrawInstance {
+  // World transform of the node drawn.
+  mat4 world;
+  // Box the positions of the draw are quantized to, xyz.
+  vec4 center;
+  vec4 half_extent;
+  // Range of the submesh in the geometry arena.
+  uint first_index;
+  int vertex_offset;
+  uint padding[2];
+};
+layout(std430, set = 0, binding = 2)readonly buffer DrawInstances {
+  DrawInstance instances[];
+} draw_instances[];
+
+layout(push_constant)uniform constants {
+  uint scene_data_index;
+  uint texture_index;
+  uint sampler_index;
+  uint instance_buffer_index;
+} draw;
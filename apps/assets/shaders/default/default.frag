@@ -1,6 +1,9 @@
 #version 450
 
-layout(binding = 1)uniform sampler2D tex_sampler;
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "bindless.glsl"
 
 layout(location = 0)in vec3 in_color;
 layout(location = 1)in vec2 in_frag_tex_coord;
@@ -10,5 +13,7 @@ layout(location = 0)out vec4 out_final_color;
 void main()
 {
   // out_final_color = vec4(in_frag_tex_coord, 0.0, 1.0);
-  out_final_color = texture(tex_sampler, in_frag_tex_coord);
+  out_final_color = texture(sampler2D(textures[draw.texture_index],
+                                      samplers[draw.sampler_index]),
+                            in_frag_tex_coord);
 }
\ No newline at end of file
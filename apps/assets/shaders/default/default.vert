@@ -1,10 +1,9 @@
 #version 450
 
-layout(binding = 0)uniform SceneData {
-  mat4 view;
-  mat4 proj;
-  mat4 model;
-} scene_data;
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "bindless.glsl"
 
 layout(location = 0)in vec3 in_pos;
 layout(location = 1)in vec3 in_color;
@@ -14,7 +13,13 @@ layout(location = 0)out vec3 out_frag_color;
 layout(location = 1)out vec2 out_frag_tex_coord;
 
 void main() {
-  gl_Position = scene_data.proj * scene_data.view * scene_data.model * vec4(in_pos, 1.0);
+  mat4 view = scene_data[draw.scene_data_index].view;
+  mat4 proj = scene_data[draw.scene_data_index].proj;
+  mat4 model = scene_data[draw.scene_data_index].model;
+  DrawInstance instance = draw_instances[draw.instance_buffer_index]
+                              .instances[gl_InstanceIndex];
+  vec3 position = instance.center.xyz + in_pos * instance.half_extent.xyz;
+  gl_Position = proj * view * model * instance.world * vec4(position, 1.0);
   out_frag_color = in_color;
   out_frag_tex_coord = in_tex_coord;
 }
\ No newline at end of file
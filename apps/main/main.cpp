@@ -1,9 +1,15 @@
 #include "Application.hpp"
 #include "utils/json.hpp"
+#include <string>
 
-int main(int, char *[]) {
+int main(int argc, char *argv[]) {
   Json config = nlohmann::json::parse(
       R"({"name": "vrtr", "window": {"width": 1920, "height": 1080}, "engine": {}})");
+  // Off-screen run for machines without display.
+  if (argc > 1 && std::string(argv[1]) == "--headless") {
+    config["engine"]["headless"] = true;
+    config["max_frames"] = 1000;
+  }
   vrtr::Application app;
   app.init(config);
   app.run();
@@ -11,8 +11,14 @@ class Application {
 public:
   void init(const Json &config) {
     LOGI("Application init.");
-    m_window.init(fetchRequired<Json>(config, "window"));
-    m_engine.init(fetchRequired<Json>(config, "engine"), &m_window);
+    Json engine_config = fetchRequired<Json>(config, "engine");
+    m_app_status.headless =
+        fetchOptional<bool>(engine_config, "headless", false);
+    // No window and no event to poll without a display.
+    if (!m_app_status.headless)
+      m_window.init(fetchRequired<Json>(config, "window"));
+    m_app_status.max_frames = fetchOptional<size_t>(config, "max_frames", 0);
+    m_engine.init(engine_config, &m_window);
   }
   void deinit() {
     LOGI("Application deinit.");
@@ -21,9 +27,12 @@ public:
   }
   void run() {
     LOGI("Application run.");
+    auto begin = std::chrono::steady_clock::now();
+    size_t n_frames = 0;
     /// Main loop here.
     while (!m_app_status.should_quit) {
-      pollSDLEvent();
+      if (!m_app_status.headless)
+        pollSDLEvent();
       if (m_app_status.stop_rendering) {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
         continue;
@@ -31,13 +40,24 @@ public:
 
       m_engine.tick(1000.f / 60);
       m_engine.draw();
+      n_frames++;
+      if (m_app_status.max_frames > 0 && n_frames >= m_app_status.max_frames)
+        m_app_status.should_quit = true;
     }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - begin;
+    LOGI("{} frames in {:.3f}s, {:.2f} fps.", n_frames, elapsed.count(),
+         n_frames / elapsed.count());
   }
+  Engine &getEngine() { return m_engine; }
 
 private:
   struct AppStatus {
     bool should_quit = false;
     bool stop_rendering = false;
+    bool headless = false;
+    /// Quit after this many frames, 0 for no limit.
+    size_t max_frames = 0;
   } m_app_status;
 
   void pollSDLEvent() {
@@ -51,6 +71,9 @@ private:
           m_app_status.stop_rendering = true;
         if (event.window.type == SDL_EVENT_WINDOW_RESTORED)
           m_app_status.stop_rendering = false;
+        // Also sent when moved to a monitor of another scale.
+        if (event.window.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED)
+          m_engine.onWindowResized();
       }
     }
   }
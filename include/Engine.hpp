@@ -10,19 +10,52 @@ class Engine {
 public:
   void init(const Json &config, const Window *window) {
     m_window = window;
-    m_gpu.init(m_window->getSDLHandle());
+    m_trace_path = fetchOptional<std::string>(config, "profile_trace", "");
+    m_gpu.init(m_window->getSDLHandle(), config);
+    if (fetchOptional<bool>(config, "cull_benchmark", false))
+      benchmarkCulling();
+    m_transform_pool.init(fetchOptional<uint32_t>(
+        config, "transform_threads", ThreadPool::kHardwareThreads));
+    // The built-in quads stay if there is no scene file or it fails.
+    std::string scene_path = fetchOptional<std::string>(config, "scene", "");
+    if (!scene_path.empty()) {
+      SceneImportOptions options;
+      options.optimize = fetchOptional<bool>(config, "optimize_meshes", true);
+      options.generate_lods =
+          fetchOptional<bool>(config, "generate_lods", true);
+      m_scene.loadGltf(scene_path, options);
+    }
     m_gpu.uploadScene(m_scene);
   }
-  void deinit() { m_gpu.deinit(); }
-  void tick(float delta) { m_scene.tick(delta); }
+  void deinit() {
+    m_transform_pool.deinit();
+    m_gpu.deinit();
+    if (!m_trace_path.empty())
+      m_gpu.getProfiler().dumpChromeTrace(m_trace_path);
+  }
+  /// A frame starts from here.
+  void tick(float delta) {
+    m_gpu.getProfiler().beginFrame();
+    ProfileScope profile_scope(m_gpu.getProfiler(), "Engine::tick");
+    m_scene.tick(delta, &m_transform_pool);
+  }
   void draw() {
+    ProfileScope profile_scope(m_gpu.getProfiler(), "Engine::draw");
     m_gpu.updateScene(m_scene);
     m_gpu.draw();
   }
+  void onWindowResized() { m_gpu.requestSwapchainResize(); }
+  bool readback(std::vector<uint8_t> &out, VkExtent2D &extent) {
+    return m_gpu.readback(out, extent);
+  }
 
 private:
   GPU m_gpu;
   Scene m_scene;
+  /// Workers of the scene transform update, see Scene::tick().
+  ThreadPool m_transform_pool;
   const Window *m_window;
+  /// Chrome trace of recent frames is written here on deinit if not empty.
+  std::string m_trace_path;
 };
 } // namespace vrtr
\ No newline at end of file
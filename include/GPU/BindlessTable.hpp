@@ -0,0 +1,73 @@
+#pragma once
+#include "utils/vk/common.hpp"
+#include "utils/vk/pipelines.hpp"
+#include <vector>
+
+namespace vrtr {
+/**
+ * @brief One descriptor set holding every sampled image, sampler and storage
+ *        buffer in large arrays, bound once for all draws. Resources are
+ *        written once on register and keep their index, which shaders read
+ *        from push constants or per-draw data.
+ *
+ *        Bindings are update-after-bind and partially bound, so new entries
+ *        can be written while the set is in use by pending frames.
+ */
+class BindlessTable {
+public:
+  static constexpr uint32_t kImageBinding = 0;
+  static constexpr uint32_t kSamplerBinding = 1;
+  static constexpr uint32_t kBufferBinding = 2;
+  static constexpr uint32_t kInvalidIndex = UINT32_MAX;
+
+  /// Capacities are clamped to the update-after-bind limits of the device.
+  /// The layout is made and owned by layout_cache, so pipeline layouts
+  /// reflected from shaders can use it for set 0.
+  void init(VkDevice device, VkPhysicalDevice physical_device,
+            LayoutCache &layout_cache, uint32_t max_images,
+            uint32_t max_samplers, uint32_t max_buffers);
+  void destroy();
+
+  /// @return Stable index, or kInvalidIndex once the array is full.
+  uint32_t registerImage(VkImageView view,
+                         VkImageLayout layout =
+                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  uint32_t registerSampler(VkSampler sampler);
+  uint32_t registerBuffer(VkBuffer buffer, VkDeviceSize offset = 0,
+                          VkDeviceSize range = VK_WHOLE_SIZE);
+  /// The index is reused by the next register, release it only once frames
+  /// that may read it are done. Releasing an index that is not registered
+  /// is logged and ignored.
+  void releaseImage(uint32_t index);
+  void releaseSampler(uint32_t index);
+  void releaseBuffer(uint32_t index);
+
+  VkDescriptorSetLayout getLayout() const { return m_layout; }
+  VkDescriptorSet getSet() const { return m_set; }
+
+private:
+  /// Indices of one binding, released ones first.
+  struct Slots {
+    uint32_t capacity = 0;
+    uint32_t n_used = 0;
+    std::vector<uint32_t> free;
+    /// Whether each index below n_used is registered, so a double release
+    /// does not hand one index to two resources.
+    std::vector<bool> live;
+    uint32_t acquire();
+    /// @return False if the index is not registered.
+    bool release(uint32_t index);
+  };
+  void write(uint32_t binding, uint32_t index, VkDescriptorType type,
+             const VkDescriptorImageInfo *image_info,
+             const VkDescriptorBufferInfo *buffer_info);
+
+  VkDevice m_device;
+  VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
+  VkDescriptorPool m_pool = VK_NULL_HANDLE;
+  VkDescriptorSet m_set = VK_NULL_HANDLE;
+  Slots m_images;
+  Slots m_samplers;
+  Slots m_buffers;
+};
+} // namespace vrtr
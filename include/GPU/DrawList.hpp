@@ -0,0 +1,68 @@
+#pragma once
+#include "Scene/renderable.hpp"
+#include "pipelines/GltfPbrPipeline.hpp"
+#include "utils/vk/common.hpp"
+#include <unordered_map>
+#include <vector>
+
+namespace vrtr {
+/**
+ * @brief Draws of a frame ordered by 64-bit sort keys, then recorded with a
+ *        bind only where the state changes.
+ *
+ *        Opaque keys, from high bits: pass 2, pipeline 10, descriptor set
+ *        16, index buffer 12, depth 24. Draws sharing state end up together
+ *        and go front to back. Transparent keys put depth, back to front,
+ *        right after the pass, as blending requires.
+ */
+class DrawList {
+public:
+  struct Stats {
+    uint32_t n_draws = 0;
+    uint32_t pipeline_binds = 0;
+    uint32_t descriptor_binds = 0;
+    uint32_t index_buffer_binds = 0;
+    Stats &operator+=(const Stats &other);
+  };
+
+  void clear();
+  /// @param depth Distance along the view direction.
+  void add(const GPUMaterialInstance &material, VkBuffer index_buffer,
+           float depth, const RenderObject &draw);
+  size_t size() const { return m_items.size(); }
+  /// LSD radix sort, 8 bits a pass. Bytes equal in every key are skipped.
+  void sort();
+  /**
+   * @brief Record sorted draws [begin, end). The first one binds all its
+   *        state, as a new secondary cmd buffer inherits none.
+   *
+   * @param material_set Set index of material descriptor sets.
+   */
+  Stats record(VkCommandBuffer cmd, size_t begin, size_t end,
+               uint32_t material_set) const;
+
+private:
+  struct Item {
+    MaterialPipeline pipeline;
+    VkDescriptorSet descriptor_set;
+    VkBuffer index_buffer;
+    RenderObject draw;
+  };
+  /// Small id of a handle for a key field. Ids past the field width wrap,
+  /// which costs binds but never draws with the wrong state.
+  template <typename Handle>
+  static uint64_t getId(std::unordered_map<Handle, uint32_t> &ids,
+                        Handle handle);
+
+  std::vector<Item> m_items;
+  std::vector<uint64_t> m_keys;
+  /// Item of each sorted key.
+  std::vector<uint32_t> m_order;
+  std::vector<uint64_t> m_scratch_keys;
+  std::vector<uint32_t> m_scratch_order;
+  // Reset with the list, handles of a frame only.
+  std::unordered_map<VkPipeline, uint32_t> m_pipeline_ids;
+  std::unordered_map<VkDescriptorSet, uint32_t> m_set_ids;
+  std::unordered_map<VkBuffer, uint32_t> m_buffer_ids;
+};
+} // namespace vrtr
@@ -0,0 +1,40 @@
+#pragma once
+#include "utils/json.hpp"
+#include <vulkan/vulkan.h>
+
+namespace vrtr {
+/**
+ * @brief Picks the render scale from measured GPU frame time.
+ *        Render targets keep their full size, only the drawn area inside
+ *        them shrinks, and the final blit upscales it.
+ */
+class DynamicResolution {
+public:
+  /**
+   * @param config Engine config. "dynamic_resolution" enables it,
+   *               "target_frame_ms" is the GPU budget of a frame and
+   *               "min_render_scale" the lowest scale per axis.
+   */
+  void init(const Json &config);
+  bool isEnabled() const { return m_enabled; }
+  /// Feed the GPU time of a finished frame.
+  void addFrameTime(double gpu_ms);
+  float getScale() const { return m_scale; }
+  /// Drawn area inside targets of max_extent.
+  VkExtent2D scaleExtent(VkExtent2D max_extent) const;
+
+private:
+  /// Weight of the newest sample in the moving average.
+  static constexpr double kSmoothing = 0.1;
+  /// Scale moves at most this much per frame, hides single spikes.
+  static constexpr float kMaxStep = 0.02f;
+  /// Grow only under this share of the budget, so it does not oscillate.
+  static constexpr double kHeadroom = 0.85;
+
+  bool m_enabled = false;
+  double m_target_ms = 16.0;
+  float m_min_scale = 0.5f;
+  float m_scale = 1.f;
+  double m_average_ms = 0.0;
+};
+} // namespace vrtr
@@ -1,43 +1,149 @@
 #pragma once
+#include "GPU/BindlessTable.hpp"
+#include "GPU/DrawList.hpp"
+#include "GPU/DynamicResolution.hpp"
+#include "GPU/GeometryArena.hpp"
+#include "GPU/Uploader.hpp"
 #include "utils/DeletionQueue.hpp"
+#include "utils/Profiler.hpp"
+#include "utils/ThreadPool.hpp"
 #include "utils/vk/allocation.hpp"
 #include "utils/vk/FrameData.hpp"
+#include "utils/vk/pipelines.hpp"
+#include "Scene/FrustumCulling.hpp"
 #include "Scene/Scene.hpp"
+#include "Scene/renderable.hpp"
+#include "Scene/VertexLayout.hpp"
+#include "utils/json.hpp"
 #include <SDL3/SDL.h>
+#include <deque>
+#include <functional>
 #include <vulkan/vulkan.h>
 
 namespace vrtr {
 constexpr bool kUseValidation = true;
-constexpr int kFrameOverlap = 2;
+/// Bounds of frames in flight, set by "frames_in_flight" in engine config.
+constexpr uint32_t kMinFrameOverlap = 1;
+constexpr uint32_t kMaxFrameOverlap = 4;
+/// Upper bound of threads recording secondary cmd buffers of a frame.
+constexpr uint32_t kMaxRecordWorkers = 16;
+/// Fewer draws than this per worker are not worth another thread.
+constexpr uint32_t kMinDrawsPerRecordWorker = 64;
+/// The geometry arena is packed once frees leave more of its free space
+/// outside the largest free range.
+constexpr float kMaxGeometryFragmentation = 0.5f;
 
 class GPU {
 public:
-  void init(SDL_Window *window);
+  /**
+   * @param window Target window, ignored in headless mode.
+   * @param config Engine config. "headless": true renders off-screen only,
+   *               with "headless_width" and "headless_height" as extent.
+   *               "frames_in_flight" in [1, 4], "present_mode" in fifo,
+   *               fifo_relaxed, mailbox and immediate.
+   *               "record_threads" is the number of threads recording draws,
+   *               0 for one per hardware thread. "lod_error_pixels" is the
+   *               projected LOD error allowed, 0 for full detail only.
+   *               "cluster_culling" culls meshlets in a compute pass, off
+   *               by default.
+   *               "frustum_culling" skips draws outside the view on CPU.
+   *               "gpu_driven" culls and writes draws in a compute pass,
+   *               instead of both.
+   *               "geometry_vertex_mb" and "geometry_index_mb" are the
+   *               initial sizes of the geometry arena, grown on demand.
+   *               See DynamicResolution for
+   *               "dynamic_resolution" and its budget.
+   */
+  void init(SDL_Window *window, const Json &config);
   void deinit();
-  /// All-time persistent data upload.
-  void uploadScene(const Scene &scene);
+  /// All-time persistent data upload, done asynchronously.
+  UploadHandle uploadScene(const Scene &scene);
   /// Frame-dedicated update.
   void updateScene(const Scene &scene);
+  /// The image is usable by frames drawn after this call.
   AllocatedImage uploadImage(void *data, VkExtent3D size, VkFormat format,
-                                   VkImageUsageFlags usage, bool mipmap = false);
+                             VkImageUsageFlags usage, bool mipmap = false,
+                             UploadHandle *handle = nullptr);
+  bool isUploadDone(UploadHandle handle) const {
+    return m_uploader.isDone(handle);
+  }
+  void waitUpload(UploadHandle handle) { m_uploader.wait(handle); }
+  /// Pack the geometry arena, between frames. Blocks until copied. Done
+  /// by draw() too, once freed meshes fragment it.
+  void defragmentGeometry();
   void draw();
+  /// Swapchain and render targets are rebuilt at the start of next frame.
+  void requestSwapchainResize() { m_swapchain_dirty = true; }
+  bool isHeadless() const { return m_headless; }
+  /**
+   * @brief Copy the last finished frame back to host.
+   *        Only available in headless mode. Blocks until the frame is done.
+   *
+   * @param out Raw texels of the color image, RGBA16F, tightly packed.
+   * @param extent Size of the frame in texels.
+   */
+  bool readback(std::vector<uint8_t> &out, VkExtent2D &extent);
+  Profiler &getProfiler() { return m_profiler; }
+  Uploader::Stats getUploadStats() const { return m_uploader.getStats(); }
+  /// Draws and binds recorded in the last frame.
+  DrawList::Stats getDrawStats() const { return m_draw_stats; }
+  const DescriptorSetCache::Stats &getDescriptorCacheStats() const {
+    return m_descriptor_cache.getStats();
+  }
+  /// Pools and sets behind the descriptor cache, the only set allocator.
+  DescriptorAllocator::Stats getDescriptorAllocatorStats() const {
+    return m_descriptor_cache.getAllocator().getStats();
+  }
+  /**
+   * @brief Compile pipelines in the background against the pipeline cache.
+   *        Draw with PipelineHandle::getOr() and a simpler pipeline until
+   *        they are ready. Pipelines are owned by the caller.
+   */
+  std::vector<PipelineHandle>
+  compilePipelines(const std::vector<PipelineBuilder> &builders) {
+    return PipelineBuilder::buildPipelines(m_device, builders,
+                                           m_pipeline_cache.get(),
+                                           m_compile_pool);
+  }
+  PipelineHandle compileComputePipeline(VkShaderModule module,
+                                        VkPipelineLayout layout) {
+    return PipelineBuilder::buildComputePipeline(
+        m_device, module, layout, m_pipeline_cache.get(), m_compile_pool);
+  }
 
 private:
   SDL_Window *m_window;
   VkExtent2D m_window_extent;
+  bool m_headless = false;
   void initVulkan();
   VkInstance m_instance;
-  VkSurfaceKHR m_surface;
+  VkSurfaceKHR m_surface = VK_NULL_HANDLE;
   VkDevice m_device;
   VkPhysicalDevice m_chosen_GPU;
   VkDebugUtilsMessengerEXT m_debug_messenger;
   VkQueue m_graphic_queue;
   int m_graphic_queue_family;
+  /// Same as the graphic queue if no dedicated transfer family.
+  VkQueue m_transfer_queue;
+  int m_transfer_queue_family;
   VmaAllocator m_mem_allocator;
 
   void initSwapchain();
-  void createSwapchain(int w, int h);
+  void createSwapchain(int w, int h,
+                       VkSwapchainKHR old_swapchain = VK_NULL_HANDLE);
   void destroySwapchain();
+  /**
+   * @brief Rebuild swapchain from the old one, without waiting for device.
+   *        Old objects are retired, destroyed once every frame in flight
+   *        is done with them.
+   *
+   * @return False if the window has no area, e.g. minimized.
+   */
+  bool recreateSwapchain();
+  bool m_swapchain_dirty = false;
+  /// Requested mode if the surface supports it, FIFO otherwise.
+  VkPresentModeKHR choosePresentMode(VkPresentModeKHR desired);
+  VkPresentModeKHR m_present_mode = VK_PRESENT_MODE_FIFO_KHR;
   VkFormat m_swapchain_format;
   VkExtent2D m_swapchain_extent;
   VkSwapchainKHR m_swapchain;
@@ -45,44 +151,262 @@ private:
   std::vector<VkImageView> m_swapchain_image_views;
 
   void initOffScreenImages();
+  /// Color and depth targets of m_target_extent.
+  void createRenderTargets();
+  /// Extent of off-screen targets. Follows swapchain if there is one.
+  VkExtent2D m_target_extent;
+  /// Area drawn inside targets, smaller with dynamic resolution.
+  VkExtent2D m_render_extent;
+  DynamicResolution m_dynamic_resolution;
   AllocatedImage m_color_image;
   AllocatedImage m_depth_image;
 
   void initCommands();
   void initSyncStructures();
   FrameData &getCurrentFrame() {
-    return m_frames[m_frame_number % kFrameOverlap];
+    return m_frames[m_frame_number % m_frames.size()];
   }
-  FrameData m_frames[kFrameOverlap];
+  /// Objects frames in flight may still use, with the frame number they
+  /// were retired at.
+  struct Retired {
+    size_t frame_number;
+    std::function<void()> destroy;
+  };
+  std::deque<Retired> m_retired;
+  /// Destroy once every frame submitted so far is done. Unlike the
+  /// deletion queue of a frame slot, not tied to a single fence.
+  void retire(std::function<void()> &&destroy);
+  /// Destroy what no frame in flight uses, after waiting the frame fence.
+  void collectRetired();
+  /// Sized once in init(), never resized after.
+  std::vector<FrameData> m_frames;
+  /// Recording workers, including the thread calling draw().
+  uint32_t m_n_record_workers;
+  ThreadPool m_record_pool;
   size_t m_frame_number = 0;
   VkFence m_imm_fence;
   VkCommandBuffer m_imm_cmd;
   VkCommandPool m_imm_cmd_pool;
-  void immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&func);
+  /// Blocking submit, timed as a GPU scope called name.
+  void immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&func,
+                       const char *name = "immediateSubmit");
+
+  void initUploader();
+  Uploader m_uploader;
+  VkDeviceSize m_staging_capacity;
+
+  void initProfiler();
+  /// Timestamp query pairs for a frame, and the immediate submit.
+  static constexpr uint32_t kMaxGpuScopes = 32;
+  Profiler m_profiler;
+  bool m_gpu_timestamps = false;
+  float m_timestamp_period;
+  VkQueryPool m_imm_timestamp_pool;
+  uint32_t beginGpuScope(VkCommandBuffer cmd, const char *name);
+  void endGpuScope(VkCommandBuffer cmd, uint32_t scope);
+  /// Read back timestamps of a finished frame and reset its pool.
+  void collectGpuScopes(FrameData &frame);
+  int64_t timestampToNs(uint64_t ticks) const {
+    return int64_t(double(ticks) * m_timestamp_period);
+  }
 
   void initDescriptors();
-  DescriptorAllocator m_descriptor_allocator;
+  /// Sets of the cull passes, written once per frame slot and resources.
+  DescriptorSetCache m_descriptor_cache;
+  /// Textures, samplers and scene buffers of every draw, bound once.
+  BindlessTable m_bindless;
+  /// Layouts reflected from shaders, shared by identical declarations.
+  LayoutCache m_layout_cache;
+  /// Owned by m_layout_cache.
   struct DescriptorSetLayouts {
-    VkDescriptorSetLayout scene_data;
+    VkDescriptorSetLayout cluster_cull;
+    VkDescriptorSetLayout draw_cull;
   } m_desc_set_layouts;
+  /// Cull sets are written on cache misses through these.
+  struct DescriptorUpdateTemplates {
+    DescriptorUpdateTemplate cluster_cull;
+    DescriptorUpdateTemplate draw_cull;
+  } m_desc_templates;
+  /// Cull sets of the current frame, VK_NULL_HANDLE when out of descriptors.
+  struct CullSets {
+    VkDescriptorSet cluster_cull = VK_NULL_HANDLE;
+    VkDescriptorSet draw_cull = VK_NULL_HANDLE;
+  } m_cull_sets;
+  /// Look up the cull sets of the frame and flush their writes at once,
+  /// before recording binds them.
+  void prepareCullSets();
 
   void initRenderPass();
   VkRenderPass m_render_pass;
   VkPipelineLayout m_pipeline_layout;
-  VkPipeline m_pipeline;
+  /// Stages reading DrawConstants, as reflected from the default shaders.
+  VkShaderStageFlags m_draw_push_stages = 0;
+  PipelineHandle m_pipeline;
+  /// m_pipeline if compiled when the frame was recorded, null otherwise.
+  VkPipeline m_frame_pipeline = VK_NULL_HANDLE;
   VkFramebuffer m_framebuffer;
+  void createFramebuffer();
 
   void initPipelines();
+  /// Shared by every pipeline created, persisted at "pipeline_cache".
+  PipelineCache m_pipeline_cache;
+  std::string m_pipeline_cache_path;
+  /// Background pipeline compilation, apart from the recording workers.
+  ThreadPool m_compile_pool;
   void initGraphicPipeline();
-  AllocatedBuffer m_vertex_buffer;
-  // VkDeviceAddress m_vertex_buffer_address;
-  AllocatedBuffer m_index_buffer;
-  uint32_t m_num_indices;
+  /// Vertices and indices of every mesh, bound once for all draws.
+  GeometryArena m_geometry;
+  VkDeviceSize m_geometry_vertex_capacity;
+  VkDeviceSize m_geometry_index_capacity;
+  /// Arena range of each scene submesh, freed with the scene.
+  std::vector<GeometryArena::Handle> m_submesh_geometry;
+  /// Last upload into the arena, waited for before relocation.
+  UploadHandle m_geometry_upload;
+  /// Set when retired meshes are freed, fragmentation is checked next.
+  bool m_geometry_freed = false;
+  void initGeometry();
+  /// Defragment, then grow the arena if the mesh still does not fit.
+  GeometryArena::Handle allocateGeometry(VkDeviceSize vertex_size,
+                                         uint32_t vertex_stride,
+                                         uint32_t index_count);
+  void relocateGeometry(VkDeviceSize vertex_capacity,
+                        VkDeviceSize index_capacity);
+  /// Per-draw data, std430 as in bindless.glsl, indexed by the first
+  /// instance of each draw.
+  struct DrawInstance {
+    /// World transform of the node drawn.
+    glm::mat4 world;
+    /// Box the positions of the submesh are quantized to, xyz.
+    glm::vec4 center;
+    glm::vec4 half_extent;
+    /// Arena range of the submesh, it moves on relocation.
+    uint32_t first_index;
+    int32_t vertex_offset;
+    uint32_t padding[2];
+  };
+  static_assert(sizeof(DrawInstance) == 112);
+  /// Copied into the buffer of the frame when it is recorded.
+  std::vector<DrawInstance> m_draw_instances;
+  /// Draws of the scene, one per mesh instance, split across recording
+  /// workers.
+  std::vector<RenderObject> m_draws;
+  /// Submesh of each draw, for its LOD chain. Levels are local to the
+  /// arena range of the submesh.
+  std::vector<Submesh> m_draw_submeshes;
+  std::vector<GeometryArena::Handle> m_draw_geometry;
+  /// Arena offsets of every draw and instance, after upload or relocation.
+  void updateDrawGeometry();
+  /// Node of each draw, whose world transform it follows.
+  std::vector<uint32_t> m_draw_nodes;
+  /// World space sphere of each draw, and the largest scale of its node.
+  std::vector<glm::vec4> m_draw_spheres;
+  std::vector<float> m_draw_scales;
+  /// Scene transform version the draws were last moved to.
+  uint64_t m_draw_transform_version = UINT64_MAX;
+  /// Move world transforms and bounds of every draw to their node.
+  void updateDrawTransforms(const TransformHierarchy &transforms);
+  /// Level drawn by each draw this frame.
+  std::vector<uint32_t> m_draw_lods;
+  float m_lod_error_pixels = 1.f;
+  /// Point visible draws at the coarsest level within m_lod_error_pixels.
+  void selectLods();
+
+  /// Camera frustum of this frame in world space, as draw bounds.
+  Frustum m_frustum;
+  /// Draws outside m_frustum are skipped before LODs and recording.
+  bool m_frustum_culling = true;
+  CullKernel m_cull_kernel = CullKernel::Scalar;
+  /// World space bounds of each draw, moved with its node.
+  CullBounds m_draw_bounds;
+  /// Indices in m_draws recorded this frame, in increasing order.
+  std::vector<uint32_t> m_visible_draws;
+  uint32_t m_n_visible_draws = 0;
+  void cullDraws();
+  /// View depth of each draw, set with its LOD.
+  std::vector<float> m_draw_depths;
+  /// Visible draws sorted by state then depth, rebuilt every frame.
+  DrawList m_draw_list;
+  void buildDrawList();
+  std::array<DrawList::Stats, kMaxRecordWorkers> m_worker_draw_stats;
+  DrawList::Stats m_draw_stats;
+  DrawList::Stats m_draw_stats_total;
+  uint64_t m_n_draw_stats_frames = 0;
+
+  /// Push constants of the cull shader, in world space. The shader takes
+  /// them to the mesh space of each draw.
+  struct ClusterCullConstants {
+    glm::vec4 planes[6];
+    glm::vec4 camera;
+  } m_cluster_cull_constants;
+  /// Draws go through meshlet culling, then one indirect draw each.
+  bool m_cluster_culling = false;
+  VkPipelineLayout m_cluster_cull_layout;
+  PipelineHandle m_cluster_cull_pipeline;
+  AllocatedBuffer m_meshlet_buffer;
+  void initClusterCull();
+  /// Per-frame range, index and indirect buffers sized for the scene, one
+  /// command per draw.
+  void createClusterBuffers();
+  void updateClusterCullConstants();
+  /// Cull the meshlets of every draw at its level, before the render pass.
+  void recordClusterCull(VkCommandBuffer cmd);
+
+  /// Per-object data of the GPU-driven path, std430 as in draw_cull.comp.
+  struct DrawObject {
+    glm::vec4 sphere;
+    uint32_t lod_count;
+    uint32_t padding[3];
+    struct {
+      uint32_t first_index;
+      uint32_t index_count;
+      float error;
+      uint32_t padding;
+    } lods[kMaxLods];
+  };
+  static_assert(sizeof(DrawObject) == 160);
+  /// Push constants of the draw cull shader, 128 bytes at most, in world
+  /// space as the cluster ones.
+  struct DrawCullConstants {
+    glm::vec4 planes[6];
+    /// w is pixels per unit at distance 1.
+    glm::vec4 camera;
+    uint32_t n_objects;
+    float lod_error_pixels;
+  } m_draw_cull_constants;
+  static_assert(sizeof(DrawCullConstants) <= 128);
+  /// Objects are culled and their draws written by a compute pass, then
+  /// drawn by one indirect count draw. CPU work no longer grows with the
+  /// object count. Takes over CPU and cluster culling.
+  bool m_gpu_driven = false;
+  uint32_t m_n_draw_objects = 0;
+  VkPipelineLayout m_draw_cull_layout;
+  PipelineHandle m_draw_cull_pipeline;
+  AllocatedBuffer m_draw_object_buffer;
+  void initDrawCull();
+  /// Per-frame command and count buffers for n_objects.
+  void createDrawCullBuffers(uint32_t n_objects);
+  void updateDrawCullConstants();
+  /// Cull objects and write their draws, before the render pass.
+  void recordDrawCull(VkCommandBuffer cmd);
   SceneData m_scene_data;
+  /// Bindless indices read by the mesh shaders, pushed once per worker.
+  struct DrawConstants {
+    uint32_t scene_data_index;
+    uint32_t texture_index;
+    uint32_t sampler_index;
+    uint32_t instance_buffer_index;
+  };
+  uint32_t m_texture_index = 0;
+  uint32_t m_sampler_linear_index = 0;
+  uint32_t m_sampler_nearest_index = 0;
 
   void initFrameBuffers();
 
   void recordCmdBuffer(VkCommandBuffer cmd);
+  /// Record sorted draws [begin, end) into a secondary cmd buffer of the
+  /// pass.
+  DrawList::Stats recordDraws(VkCommandBuffer cmd, size_t begin, size_t end);
+  void drawHeadless();
 
   void initTextures();
   AllocatedImage m_texture;
@@ -0,0 +1,94 @@
+#pragma once
+#include "utils/RangeAllocator.hpp"
+#include "utils/vk/allocation.hpp"
+#include "utils/vk/common.hpp"
+#include <utility>
+#include <vector>
+
+namespace vrtr {
+/**
+ * @brief One device-local vertex buffer and one index buffer shared by every
+ *        mesh. Meshes get ranges of both from RangeAllocators and are freed
+ *        in any order, so all of them draw with a single bind.
+ */
+class GeometryArena {
+public:
+  /// Meshes keep the handle, their offsets may change with relocate().
+  struct Handle {
+    uint32_t id = UINT32_MAX;
+    bool isValid() const { return id != UINT32_MAX; }
+  };
+  struct Range {
+    VkDeviceSize vertex_offset = 0;
+    VkDeviceSize vertex_size = 0;
+    uint32_t vertex_stride = 0;
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+  };
+  struct Stats {
+    RangeAllocator::Stats vertices;
+    RangeAllocator::Stats indices;
+    uint32_t n_meshes = 0;
+    uint32_t n_relocations = 0;
+  };
+  /// Index ranges start at this many indices, 256 bytes, so a mesh can be
+  /// bound alone as a storage buffer.
+  static constexpr uint32_t kIndexAlignment = 64;
+
+  void init(VmaAllocator allocator, VkDeviceSize vertex_capacity,
+            VkDeviceSize index_capacity);
+  void destroy();
+
+  /// @return Invalid handle if a buffer has no free range that fits.
+  Handle allocate(VkDeviceSize vertex_size, uint32_t vertex_stride,
+                  uint32_t index_count);
+  void free(Handle handle);
+  const Range &get(Handle handle) const { return m_ranges[handle.id]; }
+  /// vertexOffset of a draw whose indices are local to the mesh.
+  int32_t getVertexOffset(Handle handle) const {
+    const Range &range = get(handle);
+    return int32_t(range.vertex_offset / range.vertex_stride);
+  }
+  VkBuffer getVertexBuffer() const { return m_vertex_buffer.buffer; }
+  VkBuffer getIndexBuffer() const { return m_index_buffer.buffer; }
+  VkDeviceSize getVertexCapacity() const {
+    return m_vertex_ranges.getCapacity();
+  }
+  VkDeviceSize getIndexCapacity() const {
+    return m_index_ranges.getCapacity() * sizeof(uint32_t);
+  }
+  /// Bytes live meshes take at most once packed by relocate().
+  VkDeviceSize getPackedVertexSize() const;
+  VkDeviceSize getPackedIndexSize() const;
+  /// Worst of both buffers, see RangeAllocator::getFragmentation().
+  float getFragmentation() const;
+  Stats getStats() const;
+
+  /**
+   * @brief Copy live meshes packed to the start of new buffers, to
+   *        defragment or to grow. Pending writes to the arena must be done.
+   *
+   * @param cmd Graphic cmd buffer the copies are recorded to.
+   * @return The former vertex and index buffers, to destroy after cmd.
+   */
+  std::pair<AllocatedBuffer, AllocatedBuffer>
+  relocate(VkCommandBuffer cmd, VkDeviceSize vertex_capacity,
+           VkDeviceSize index_capacity);
+
+private:
+  void createBuffers(VkDeviceSize vertex_capacity,
+                     VkDeviceSize index_capacity);
+
+  VmaAllocator m_allocator;
+  AllocatedBuffer m_vertex_buffer;
+  AllocatedBuffer m_index_buffer;
+  RangeAllocator m_vertex_ranges;
+  /// In indices, not bytes.
+  RangeAllocator m_index_ranges;
+  /// Indexed by handle id, freed ids are reused.
+  std::vector<Range> m_ranges;
+  std::vector<bool> m_live;
+  std::vector<uint32_t> m_free_ids;
+  uint32_t m_n_relocations = 0;
+};
+} // namespace vrtr
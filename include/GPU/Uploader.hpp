@@ -0,0 +1,112 @@
+#pragma once
+#include "utils/vk/common.hpp"
+#include "utils/vk/allocation.hpp"
+#include "utils/vk/staging.hpp"
+#include <deque>
+#include <vector>
+
+namespace vrtr {
+/// Timeline value signaled when the upload is done.
+struct UploadHandle {
+  uint64_t value = 0;
+};
+
+/**
+ * @brief Batched CPU-to-GPU copies on a transfer queue.
+ *        Uploads are recorded into the open batch, which flush() submits
+ *        without blocking. Each batch signals a timeline semaphore when done.
+ *        With a dedicated transfer family, resources are released to the
+ *        graphic family and acquired by recordAcquires() in the next frame.
+ */
+class Uploader {
+public:
+  struct Stats {
+    uint64_t n_uploads = 0;
+    uint64_t n_bytes = 0;
+    uint64_t n_batches = 0;
+    /// Batches finished on GPU and recycled.
+    uint64_t n_retired_batches = 0;
+    /// Uploads that did not fit in the ring and got their own buffer.
+    uint64_t n_fallbacks = 0;
+    StagingRing::Stats ring;
+  };
+  /// Staging regions are aligned to this, enough for any texel block.
+  static constexpr VkDeviceSize kStagingAlignment = 16;
+
+  /**
+   * @param staging_capacity Bytes of the staging ring. Larger uploads go
+   *                         through a dedicated buffer.
+   */
+  void init(VkDevice device, VmaAllocator allocator, VkQueue queue,
+            uint32_t queue_family, uint32_t graphic_queue_family,
+            VkDeviceSize staging_capacity);
+  void deinit();
+
+  UploadHandle uploadBuffer(const void *data, size_t size, VkBuffer dst,
+                            VkDeviceSize dst_offset = 0);
+  /// Image ends in SHADER_READ_ONLY_OPTIMAL, with mipmaps if asked.
+  UploadHandle uploadImage(const void *data, size_t size,
+                           const AllocatedImage &dst, bool mipmap);
+  /// Submit the open batch, if any.
+  void flush();
+  bool isDone(UploadHandle handle) const;
+  /// Block until done, flushing first if needed.
+  void wait(UploadHandle handle);
+  /// Recycle finished batches and free their staging memory.
+  void collect();
+
+  /**
+   * @brief Make submitted uploads visible to graphic work recorded in cmd.
+   *
+   * @return Timeline value the submit of cmd must wait for, 0 for none.
+   */
+  uint64_t recordAcquires(VkCommandBuffer cmd);
+  VkSemaphore getTimeline() const { return m_timeline; }
+  Stats getStats() const;
+
+private:
+  struct Batch {
+    VkCommandPool cmd_pool;
+    VkCommandBuffer cmd;
+    uint64_t value;
+    /// Dedicated buffers of oversized uploads.
+    std::vector<AllocatedBuffer> staging;
+  };
+  struct ImageAcquire {
+    VkImageMemoryBarrier2 barrier;
+    VkExtent3D extent;
+    /// Blit is not available on transfer queue, done after acquire.
+    bool mipmap;
+  };
+  Batch &getOpenBatch();
+  /// Copy data to staging memory read by the open batch.
+  StagingRing::Region stage(const void *data, size_t size);
+
+  VkDevice m_device;
+  VmaAllocator m_allocator;
+  VkQueue m_queue;
+  uint32_t m_queue_family;
+  uint32_t m_graphic_queue_family;
+  /// Upload queue is in another family, ownership transfer needed.
+  bool m_dedicated;
+  VkSemaphore m_timeline;
+  StagingRing m_staging;
+  Stats m_stats;
+  uint64_t m_next_value = 1;
+  /// Latest submitted value the graphic queue has not waited for.
+  uint64_t m_unwaited_value = 0;
+
+  bool m_has_open_batch = false;
+  Batch m_open_batch;
+  std::deque<Batch> m_submitted;
+  std::vector<Batch> m_free;
+
+  // Releases go with the open batch. Acquires wait until it is submitted.
+  std::vector<VkBufferMemoryBarrier2> m_buffer_releases;
+  std::vector<VkImageMemoryBarrier2> m_image_releases;
+  std::vector<VkBufferMemoryBarrier2> m_open_buffer_acquires;
+  std::vector<ImageAcquire> m_open_image_acquires;
+  std::vector<VkBufferMemoryBarrier2> m_buffer_acquires;
+  std::vector<ImageAcquire> m_image_acquires;
+};
+} // namespace vrtr
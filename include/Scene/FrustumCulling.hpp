@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace vrtr {
+/// Planes facing inwards with unit xyz normals, p is inside all of them if
+/// dot(plane.xyz, p) + plane.w >= 0.
+struct Frustum {
+  glm::vec4 planes[6];
+
+  /// Gribb and Hartmann, for clip space with [0, 1] depth. Planes are in
+  /// the space matrix transforms from.
+  static Frustum fromMatrix(const glm::mat4 &matrix);
+};
+
+enum class CullKernel { Scalar, Sse, Avx2 };
+/// Widest kernel the CPU runs, SSE is the baseline on x86-64.
+CullKernel getBestCullKernel();
+const char *getCullKernelName(CullKernel kernel);
+
+/**
+ * @brief Bounding spheres and boxes of many objects, one array per
+ *        component so kernels test 4 or 8 objects per instruction.
+ *        Arrays are padded to whole batches of 8.
+ */
+class CullBounds {
+public:
+  static constexpr uint32_t kBatch = 8;
+
+  void resize(uint32_t n_objects);
+  uint32_t size() const { return m_size; }
+  /// @param sphere xyz center and w radius.
+  void set(uint32_t object, const glm::vec4 &sphere, const glm::vec3 &aabb_min,
+           const glm::vec3 &aabb_max);
+
+  /**
+   * @brief Objects whose sphere and box both touch the frustum. Either
+   *        alone is conservative, together they reject more.
+   *
+   * @param visible Visible objects in increasing order, room for size().
+   * @return Number of visible objects.
+   */
+  uint32_t cull(const Frustum &frustum, uint32_t *visible,
+                CullKernel kernel) const;
+
+private:
+  uint32_t m_size = 0;
+  std::vector<float> m_center_x;
+  std::vector<float> m_center_y;
+  std::vector<float> m_center_z;
+  std::vector<float> m_radius;
+  std::vector<float> m_min_x;
+  std::vector<float> m_min_y;
+  std::vector<float> m_min_z;
+  std::vector<float> m_max_x;
+  std::vector<float> m_max_y;
+  std::vector<float> m_max_z;
+};
+
+/// Log objects per nanosecond of every kernel the CPU runs, culling random
+/// bounds of which about half are visible.
+void benchmarkCulling(uint32_t n_objects = 1 << 20);
+} // namespace vrtr
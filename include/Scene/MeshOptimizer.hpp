@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vrtr {
+/// Entries of the post-transform vertex cache assumed by the passes.
+constexpr uint32_t kVertexCacheSize = 16;
+/// Meshlet limits, the common mesh shader output sizes.
+constexpr uint32_t kMeshletMaxVertices = 64;
+constexpr uint32_t kMeshletMaxTriangles = 124;
+
+/// A cluster of triangles, laid out as std430 for the cull shader.
+struct Meshlet {
+  /// Bounding sphere.
+  float center[3];
+  float radius;
+  /// Normal cone, never culled with cutoff 1.
+  float cone_axis[3];
+  float cone_cutoff;
+  /// Range of the index buffer, triangles are not copied.
+  uint32_t first_index;
+  uint32_t index_count;
+  uint32_t vertex_count;
+  uint32_t padding = 0;
+};
+
+struct VertexCacheStats {
+  /// Average cache miss ratio, transformed vertices per triangle.
+  float acmr = 0.f;
+  /// Average transform to vertex ratio, 1 is the best possible.
+  float atvr = 0.f;
+};
+
+/**
+ * @brief Simulate a FIFO post-transform cache over a triangle list.
+ */
+VertexCacheStats analyzeVertexCache(const uint32_t *indices, size_t n_indices,
+                                    size_t n_vertices,
+                                    uint32_t cache_size = kVertexCacheSize);
+
+/**
+ * @brief Reorder triangles for post-transform cache hits, Tipsify of
+ *        Sander et al. 2007. Indices are local to [0, n_vertices).
+ */
+void optimizeVertexCache(uint32_t *indices, size_t n_indices,
+                         size_t n_vertices,
+                         uint32_t cache_size = kVertexCacheSize);
+
+/**
+ * @brief Reorder clusters of a cache-optimized list so triangles facing out
+ *        of the mesh come first, cutting overdraw from any view.
+ *
+ * @param positions xyz floats of vertex i at positions + i * stride floats.
+ * @param threshold Allowed ACMR loss, clusters are split finer with more.
+ */
+void optimizeOverdraw(uint32_t *indices, size_t n_indices,
+                      const float *positions, size_t stride,
+                      size_t n_vertices, float threshold = 1.05f);
+
+/**
+ * @brief Renumber vertices in order of first use, so fetches stream
+ *        through the vertex buffer. Indices are rewritten in place.
+ *
+ * @return remap[old] is the new index of vertex old, unused vertices go last.
+ */
+std::vector<uint32_t> optimizeVertexFetchRemap(uint32_t *indices,
+                                               size_t n_indices,
+                                               size_t n_vertices);
+
+/**
+ * @brief Split a triangle list in submission order into meshlets of at most
+ *        kMeshletMaxVertices and kMeshletMaxTriangles. Run after
+ *        optimizeVertexCache, whose order keeps meshlets compact.
+ *
+ * @return Meshlets with first_index relative to indices.
+ */
+std::vector<Meshlet> buildMeshlets(const uint32_t *indices, size_t n_indices,
+                                   const float *positions, size_t stride,
+                                   size_t n_vertices);
+
+/**
+ * @brief Simplify a triangle list by quadric error half-edge collapses.
+ *        Vertices are never moved nor added, so every level shares the
+ *        vertex buffer. Topology is welded by position: vertices on an
+ *        open border are kept, vertices split by an attribute seam move
+ *        together along the seam, each onto the vertex of its own side.
+ *
+ * @param target_index_count Stop once the list is this small.
+ * @param target_error Largest deviation allowed, in position units.
+ * @param result_error Deviation reached, if not null.
+ * @return Indices of the simplified list, into the same vertices.
+ */
+std::vector<uint32_t> simplifyMesh(const uint32_t *indices, size_t n_indices,
+                                   const float *positions, size_t stride,
+                                   size_t n_vertices, size_t target_index_count,
+                                   float target_error,
+                                   float *result_error = nullptr);
+} // namespace vrtr
@@ -1,94 +1,165 @@
 #pragma once
+#include "Scene/MeshOptimizer.hpp"
+#include "Scene/TransformHierarchy.hpp"
 #include "utils/vk/common.hpp"
 #include <array>
+#include <cstddef>
+#include <filesystem>
+#include <vector>
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 
 namespace vrtr {
+class ThreadPool;
+
+/// Decoded vertex on CPU while importing, packed by a VertexLayout for GPU.
 struct Vertex {
   glm::vec3 position;
   glm::vec3 color;
   glm::vec2 tex_coord;
-  /// NOTE Vertex input binding and attribute descriptions are needed
-  /// to create graphic pipeline, irrelevant with scene content.
-  static VkVertexInputBindingDescription getVertexBindingDescription() {
-    VkVertexInputBindingDescription binding_description = {};
-    binding_description.binding = 0;
-    binding_description.stride = sizeof(Vertex);
-    // Goto next entry after each vertex.
-    binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    return binding_description;
-  }
-  static std::array<VkVertexInputAttributeDescription, 3>
-  getVertexAttributeDescriptions() {
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, position);
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(Vertex, tex_coord);
-
-    return attributeDescriptions;
-  }
+  glm::vec3 normal;
 };
 
 struct SceneData {
   alignas(16) glm::mat4 view;
   alignas(16) glm::mat4 proj;
+  /// Identity, each draw carries the world transform of its node.
   alignas(16) glm::mat4 model;
   // vec4 ambientColor;
   // vec4 sunlightDirection; //w for sun power
   // vec4 sunlightColor;
 };
 
+/// Detail levels of a submesh at most, full detail included.
+constexpr uint32_t kMaxLods = 8;
+
+/// A detail level, a range of the scene index buffer.
+struct MeshLod {
+  uint32_t first_index;
+  uint32_t index_count;
+  /// Object space deviation from full detail.
+  float error;
+  /// The same triangles as a range of the scene meshlets.
+  uint32_t first_meshlet;
+  uint32_t meshlet_count;
+};
+
+/// A range of the scene index buffer drawn at once.
+struct Submesh {
+  uint32_t first_index;
+  uint32_t index_count;
+  /// Vertices referenced by the range, owned by this submesh alone.
+  uint32_t first_vertex;
+  uint32_t vertex_count;
+  /// glTF mesh this comes from.
+  uint32_t mesh;
+  /// Object space sphere around the vertices, xyz center and w radius.
+  glm::vec4 bounds = glm::vec4(0.f);
+  /// Object space box around the vertices, their positions are quantized
+  /// to it, see getSubmeshQuantization().
+  glm::vec3 aabb_min = glm::vec3(0.f);
+  glm::vec3 aabb_max = glm::vec3(0.f);
+  /// lods[0] is the range above, coarser levels follow.
+  std::array<MeshLod, kMaxLods> lods = {};
+  uint32_t lod_count = 1;
+};
+
+/// A submesh drawn at a node, with the world transform of the node.
+struct MeshInstance {
+  uint32_t node;
+  uint32_t submesh;
+};
+
+/// What loadGltf does to primitives after decoding.
+struct SceneImportOptions {
+  /// Reorder for vertex cache, overdraw and fetch, see MeshOptimizer.hpp.
+  bool optimize = true;
+  /// Generate a LOD chain by simplification.
+  bool generate_lods = true;
+};
+
 class Scene {
 public:
-  Scene() {
-    m_vertices = {{{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
-                  {{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
-                  {{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
-                  {{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}},
-
-                  {{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
-                  {{0.5f, -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
-                  {{0.5f, 0.5f, -0.5f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
-                  {{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}}};
+  /// Parent of every glTF root node.
+  static constexpr uint32_t kRootNode = 0;
+  static constexpr uint32_t kNoMesh = UINT32_MAX;
 
-    m_indices = {0, 1, 2, 2, 3, 0, 4, 5, 6, 6, 7, 4};
+  /// Two quads, drawn when there is no scene file.
+  Scene();
+  /**
+   * @brief Replace the geometry with triangles of a .gltf or .glb file.
+   *        Buffers are memory-mapped and primitives are decoded in
+   *        parallel, each processed on its own then encoded straight into
+   *        the scene vertex data and index array, sized from accessor
+   *        counts. Nodes go to the transform hierarchy under kRootNode,
+   *        as node id + 1, vertices stay in mesh space.
+   *
+   *        The file is validated and every buffer view and accessor read
+   *        is bounds-checked first. Primitives with malformed attributes
+   *        are skipped.
+   *
+   *        LOD levels are appended after all full detail indices.
+   *
+   * @return False if the file can not be loaded, the scene is unchanged.
+   */
+  bool loadGltf(const std::filesystem::path &path,
+                const SceneImportOptions &options = {});
+  /// Vertices in SceneVertexLayout, ready for the vertex buffer.
+  const std::vector<std::byte> &getVertexData() const {
+    return m_vertex_data;
   }
-  const std::vector<Vertex> &getVertices() const { return m_vertices; }
+  uint32_t getVertexCount() const { return m_vertex_count; }
   const std::vector<uint32_t> &getIndices() const { return m_indices; }
+  /// Indices are absolute, submeshes draw with vertex offset 0.
+  const std::vector<Submesh> &getSubmeshes() const { return m_submeshes; }
+  /// Clusters of every level, indexing the scene index buffer.
+  const std::vector<Meshlet> &getMeshlets() const { return m_meshlets; }
+  const TransformHierarchy &getTransforms() const { return m_transforms; }
+  /// Mesh drawn at each node, kNoMesh for none.
+  const std::vector<uint32_t> &getNodeMeshes() const { return m_node_meshes; }
+  /// One per node and submesh of its mesh, in node order.
+  const std::vector<MeshInstance> &getMeshInstances() const {
+    return m_instances;
+  }
+  /// Changes whenever world transforms do.
+  uint64_t getTransformVersion() const { return m_transform_version; }
   SceneData getSceneData() const { return m_scene_data; }
 
-  void tick(float delta) {
+  /// @param pool Shares the transform update, see TransformHierarchy.
+  void tick(float delta, ThreadPool *pool = nullptr) {
     m_time += delta;
-    m_scene_data.model =
+    // Static nodes keep their world transform, only moved subtrees update.
+    if (m_transforms.update(pool) > 0)
+      m_transform_version++;
+    // The camera orbits the scene, nodes stay where they are.
+    glm::mat4 spin =
         glm::rotate(glm::mat4(1.f), m_time * 0.1f * glm::radians(1.f),
                     glm::vec3(0.f, 0.f, 1.f));
+    m_scene_data.model = glm::mat4(1.f);
     m_scene_data.view =
         glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f),
-                    glm::vec3(0.0f, 0.0f, 1.0f));
+                    glm::vec3(0.0f, 0.0f, 1.0f)) *
+        spin;
     m_scene_data.proj =
         glm::perspective(glm::radians(45.0f), 1920.f / 1080, 0.1f, 1000.0f);
     m_scene_data.proj[1][1] *= -1;
   }
 
 private:
+  void buildInstances();
+
   float m_time = 0;
-  std::vector<Vertex> m_vertices;
+  std::vector<std::byte> m_vertex_data;
+  uint32_t m_vertex_count = 0;
   std::vector<uint32_t> m_indices;
+  std::vector<Submesh> m_submeshes;
+  std::vector<Meshlet> m_meshlets;
+  TransformHierarchy m_transforms;
+  std::vector<uint32_t> m_node_meshes;
+  std::vector<MeshInstance> m_instances;
+  uint64_t m_transform_version = 0;
   SceneData m_scene_data;
 };
 } // namespace vrtr
\ No newline at end of file
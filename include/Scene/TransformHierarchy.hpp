@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace vrtr {
+class ThreadPool;
+
+/**
+ * @brief Local and world transforms of a node tree, one array per field.
+ *        Nodes are stored depth-first, so parents come before their
+ *        children and every subtree is a contiguous run of slots. Only
+ *        subtrees under a changed local transform are recomputed.
+ */
+class TransformHierarchy {
+public:
+  static constexpr uint32_t kNoParent = UINT32_MAX;
+
+  /**
+   * @brief Replace all nodes, given in any order. Node ids are indices in
+   *        these arrays, slots are their place in storage.
+   *
+   * @param parents Parent id of each node, kNoParent for roots.
+   * @return False if a parent is out of range or parents form a cycle, the
+   *         hierarchy is then empty.
+   */
+  bool build(const std::vector<uint32_t> &parents,
+             const std::vector<glm::mat4> &locals);
+  uint32_t size() const { return uint32_t(m_slots.size()); }
+  uint32_t getSlot(uint32_t node) const { return m_slots[node]; }
+
+  /// Mark the node dirty, its subtree is recomputed by the next update().
+  void setLocal(uint32_t node, const glm::mat4 &local);
+  const glm::mat4 &getLocal(uint32_t node) const {
+    return m_locals[m_slots[node]];
+  }
+  /// As of the last update().
+  const glm::mat4 &getWorld(uint32_t node) const {
+    return m_worlds[m_slots[node]];
+  }
+  /// World transforms by slot, ready for upload as is.
+  const std::vector<glm::mat4> &getWorlds() const { return m_worlds; }
+
+  /**
+   * @brief Recompute world transforms of dirty nodes and their descendants.
+   *        Disjoint dirty subtrees are independent and split between the
+   *        pool threads. Large ones are split at their children first.
+   *
+   * @param pool Runs everything on the caller if null.
+   * @return Number of world transforms recomputed.
+   */
+  uint32_t update(ThreadPool *pool = nullptr);
+
+private:
+  /// Slots [first, end) whose first parent world is up to date.
+  struct Span {
+    uint32_t first;
+    uint32_t end;
+  };
+  void splitSpan(Span span, uint32_t max_nodes);
+  void updateSpan(Span span);
+
+  // By slot.
+  std::vector<uint32_t> m_parents;
+  /// One past the last slot of the subtree.
+  std::vector<uint32_t> m_subtree_ends;
+  std::vector<glm::mat4> m_locals;
+  std::vector<glm::mat4> m_worlds;
+  std::vector<uint8_t> m_dirty;
+  std::vector<uint32_t> m_dirty_slots;
+  /// Slot of each node id.
+  std::vector<uint32_t> m_slots;
+  /// Work of the current update(), kept to not allocate every frame.
+  std::vector<Span> m_dirty_spans;
+  std::vector<Span> m_spans;
+  std::vector<uint32_t> m_task_firsts;
+};
+} // namespace vrtr
@@ -0,0 +1,169 @@
+#pragma once
+#include "Scene/Scene.hpp"
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace vrtr {
+/**
+ * @brief Box quantized positions are stored relative to, one per submesh.
+ *        Decoded positions are in [-1, 1], the vertex shader maps them
+ *        back with center + position * half_extent, given by each draw.
+ */
+struct VertexQuantization {
+  glm::vec3 center = glm::vec3(0.f);
+  glm::vec3 half_extent = glm::vec3(1.f);
+
+  static VertexQuantization fromBox(glm::vec3 min, glm::vec3 max);
+};
+
+/**
+ * @brief Encodings of vertex attributes on GPU.
+ *        Each has a fixed shader location, a format the input assembler
+ *        decodes, its size in bytes and an encoder from Vertex.
+ */
+namespace vertex_attr {
+struct PositionF32 {
+  static constexpr uint32_t kLocation = 0;
+  static constexpr VkFormat kFormat = VK_FORMAT_R32G32B32_SFLOAT;
+  static constexpr uint32_t kSize = 12;
+  static constexpr bool kQuantized = false;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+/// Half floats of the position normalized to the quantization box.
+struct PositionF16 {
+  static constexpr uint32_t kLocation = 0;
+  static constexpr VkFormat kFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+  static constexpr uint32_t kSize = 8;
+  static constexpr bool kQuantized = true;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+/// 16-bit fixed point over the quantization box, finer than half floats.
+struct PositionSnorm16 {
+  static constexpr uint32_t kLocation = 0;
+  static constexpr VkFormat kFormat = VK_FORMAT_R16G16B16A16_SNORM;
+  static constexpr uint32_t kSize = 8;
+  static constexpr bool kQuantized = true;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+struct ColorF32 {
+  static constexpr uint32_t kLocation = 1;
+  static constexpr VkFormat kFormat = VK_FORMAT_R32G32B32_SFLOAT;
+  static constexpr uint32_t kSize = 12;
+  static constexpr bool kQuantized = false;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+struct ColorRgba8 {
+  static constexpr uint32_t kLocation = 1;
+  static constexpr VkFormat kFormat = VK_FORMAT_R8G8B8A8_UNORM;
+  static constexpr uint32_t kSize = 4;
+  static constexpr bool kQuantized = false;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+struct UvF32 {
+  static constexpr uint32_t kLocation = 2;
+  static constexpr VkFormat kFormat = VK_FORMAT_R32G32_SFLOAT;
+  static constexpr uint32_t kSize = 8;
+  static constexpr bool kQuantized = false;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+/// Half floats, tiling coordinates out of [0, 1] are kept.
+struct UvF16 {
+  static constexpr uint32_t kLocation = 2;
+  static constexpr VkFormat kFormat = VK_FORMAT_R16G16_SFLOAT;
+  static constexpr uint32_t kSize = 4;
+  static constexpr bool kQuantized = false;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+/// UVs are clamped to [0, 1], not for tiling texture coordinates.
+struct UvUnorm16 {
+  static constexpr uint32_t kLocation = 2;
+  static constexpr VkFormat kFormat = VK_FORMAT_R16G16_UNORM;
+  static constexpr uint32_t kSize = 4;
+  static constexpr bool kQuantized = false;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+struct NormalF32 {
+  static constexpr uint32_t kLocation = 3;
+  static constexpr VkFormat kFormat = VK_FORMAT_R32G32B32_SFLOAT;
+  static constexpr uint32_t kSize = 12;
+  static constexpr bool kQuantized = false;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+/// Octahedral mapping, shaders unfold it back to a unit vector.
+struct NormalOct16 {
+  static constexpr uint32_t kLocation = 3;
+  static constexpr VkFormat kFormat = VK_FORMAT_R16G16_SNORM;
+  static constexpr uint32_t kSize = 4;
+  static constexpr bool kQuantized = false;
+  static void encode(const Vertex &v, const VertexQuantization &q,
+                     std::byte *out);
+};
+} // namespace vertex_attr
+
+namespace detail {
+template <typename... Attributes>
+constexpr std::array<VkVertexInputAttributeDescription, sizeof...(Attributes)>
+makeAttributeDescriptions() {
+  std::array<VkVertexInputAttributeDescription, sizeof...(Attributes)>
+      descriptions{};
+  uint32_t offset = 0;
+  size_t i = 0;
+  ((descriptions[i++] = {Attributes::kLocation, 0, Attributes::kFormat,
+                         offset},
+    offset += Attributes::kSize),
+   ...);
+  return descriptions;
+}
+} // namespace detail
+
+/**
+ * @brief Interleaved vertex format made of the given attribute encodings,
+ *        in order, tightly packed in binding 0.
+ */
+template <typename... Attributes> struct VertexLayout {
+  static constexpr uint32_t kStride = (Attributes::kSize + ...);
+  /// Positions need the VertexQuantization of each draw, the box of the
+  /// vertices it reads.
+  static constexpr bool kQuantized = (Attributes::kQuantized || ...);
+  static constexpr auto kAttributeDescriptions =
+      detail::makeAttributeDescriptions<Attributes...>();
+  static_assert(kStride % 4 == 0, "Vertex stride must be 4-byte aligned.");
+
+  static VkVertexInputBindingDescription getBindingDescription() {
+    VkVertexInputBindingDescription description = {};
+    description.binding = 0;
+    description.stride = kStride;
+    description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    return description;
+  }
+  /// Encode count vertices into count * kStride bytes at out, ready for
+  /// the vertex buffer.
+  static void pack(const Vertex *vertices, size_t count,
+                   const VertexQuantization &q, std::byte *out) {
+    for (size_t i = 0; i < count; i++) {
+      ((Attributes::encode(vertices[i], q, out), out += Attributes::kSize),
+       ...);
+    }
+  }
+};
+
+/// Vertex format of scene geometry on GPU, switch encodings here. Nothing
+/// is lit yet, normals are added once a shader reads them.
+using SceneVertexLayout =
+    VertexLayout<vertex_attr::PositionSnorm16, vertex_attr::ColorRgba8,
+                 vertex_attr::UvF16>;
+
+/// Box the vertices of a submesh are quantized to in SceneVertexLayout,
+/// identity if positions are not quantized.
+VertexQuantization getSubmeshQuantization(const Submesh &submesh);
+} // namespace vrtr
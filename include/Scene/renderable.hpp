@@ -1,12 +1,12 @@
 #pragma once
-#include "vulkan/vulkan.h"
-// #include "utils/vk/allocation.hpp"
+#include <cstdint>
 
+/// A draw of the geometry arena, whose buffers are bound once.
 struct RenderObject {
-// uint32_t
-
-VkBuffer index_buffer;
-uint32_t index_offset;
-uint32_t index_count;
-VkBuffer vertex_buffer;
-};
\ No newline at end of file
+  uint32_t index_offset;
+  uint32_t index_count;
+  /// Added to indices, they are local to the mesh.
+  int32_t vertex_offset;
+  /// Per-draw data read by shaders, as gl_InstanceIndex.
+  uint32_t first_instance;
+};
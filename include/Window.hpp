@@ -11,16 +11,18 @@ public:
 
     int w = fetchRequired<int>(config, "width");
     int h = fetchRequired<int>(config, "height");
-    SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
-    // (SDL_WindowFlags)(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+    SDL_WindowFlags window_flags =
+        (SDL_WindowFlags)(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
     m_window = SDL_CreateWindow("Vulkan Engine", w, h, window_flags);
   }
   void deinit() {
-    SDL_DestroyWindow(m_window);
+    if (m_window)
+      SDL_DestroyWindow(m_window);
   }
+  /// Null if the window is never inited, e.g. headless.
   SDL_Window *getSDLHandle() const { return m_window; }
 
 private:
-  SDL_Window *m_window;
+  SDL_Window *m_window = nullptr;
 };
 } // namespace vrtr
\ No newline at end of file
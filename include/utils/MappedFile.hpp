@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+
+namespace vrtr {
+/**
+ * @brief Read-only memory mapping of a whole file.
+ *        Pages are loaded on first touch, nothing is copied up front.
+ */
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile(MappedFile &&other) noexcept;
+  MappedFile &operator=(MappedFile &&other) noexcept;
+
+  bool open(const std::filesystem::path &path);
+  void close();
+  const std::byte *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  const std::byte *m_data = nullptr;
+  size_t m_size = 0;
+#ifdef _WIN32
+  void *m_file = nullptr;
+  void *m_mapping = nullptr;
+#endif
+};
+} // namespace vrtr
@@ -0,0 +1,87 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vrtr {
+/**
+ * @brief A named span on CPU or GPU timeline.
+ *        Times are in ns since the profiler is created.
+ */
+struct ProfileEvent {
+  const char *name;
+  int64_t begin_ns;
+  int64_t end_ns;
+};
+
+struct FrameProfile {
+  uint64_t frame = 0;
+  std::vector<ProfileEvent> cpu_events;
+  std::vector<ProfileEvent> gpu_events;
+};
+
+/**
+ * @brief Collects CPU scopes and GPU timestamps of recent frames.
+ *        GPU queries are written by GPU, which hands the resolved
+ *        events back here once the frame fence is signaled.
+ */
+class Profiler {
+public:
+  static constexpr size_t kMaxFrames = 256;
+
+  Profiler();
+  void setEnabled(bool enabled) { m_enabled = enabled; }
+  bool isEnabled() const { return m_enabled; }
+
+  /// Start recording a new frame, overwriting the oldest one in the ring.
+  void beginFrame();
+  uint64_t currentFrame() const { return m_frame; }
+  int64_t now() const;
+
+  void addCpuEvent(const char *name, int64_t begin_ns, int64_t end_ns);
+  /// GPU results come in a few frames late, matched by frame number.
+  void addGpuEvents(uint64_t frame, const std::vector<ProfileEvent> &events);
+  /**
+   * @brief Map GPU timestamps onto the CPU timeline.
+   *
+   * @param offset_ns CPU time minus GPU time, both in ns.
+   */
+  void setGpuClockOffset(int64_t offset_ns) { m_gpu_offset_ns = offset_ns; }
+  int64_t getGpuClockOffset() const { return m_gpu_offset_ns; }
+
+  /// Recorded frames, from oldest to newest.
+  std::vector<const FrameProfile *> getFrames() const;
+  /// Trace Event Format, opened by chrome://tracing or Perfetto.
+  bool dumpChromeTrace(const std::string &path) const;
+
+private:
+  bool m_enabled = false;
+  std::chrono::steady_clock::time_point m_epoch;
+  int64_t m_gpu_offset_ns = 0;
+  uint64_t m_frame = 0;
+  std::vector<FrameProfile> m_frames;
+  FrameProfile &getCurrentRecord() { return m_frames[m_frame % kMaxFrames]; }
+};
+
+/// RAII timer of a CPU scope.
+class ProfileScope {
+public:
+  ProfileScope(Profiler &profiler, const char *name)
+      : m_profiler(profiler), m_name(name) {
+    if (m_profiler.isEnabled())
+      m_begin_ns = m_profiler.now();
+  }
+  ~ProfileScope() {
+    if (m_profiler.isEnabled())
+      m_profiler.addCpuEvent(m_name, m_begin_ns, m_profiler.now());
+  }
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  Profiler &m_profiler;
+  const char *m_name;
+  int64_t m_begin_ns = 0;
+};
+} // namespace vrtr
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+
+namespace vrtr {
+/**
+ * @brief Offset allocator over [0, capacity), for suballocating GPU buffers.
+ *        Best fit over free ranges sorted by size, freed ranges are merged
+ *        with their free neighbours. Nothing is allocated on the device.
+ */
+class RangeAllocator {
+public:
+  static constexpr uint64_t kInvalidOffset = UINT64_MAX;
+  struct Stats {
+    uint64_t capacity = 0;
+    uint64_t used = 0;
+    uint64_t largest_free = 0;
+    uint32_t n_allocations = 0;
+    uint32_t n_free_ranges = 0;
+  };
+
+  void init(uint64_t capacity);
+  /**
+   * @param alignment Any positive value, not only powers of 2, so vertex
+   *                  ranges can be aligned to their stride.
+   * @return Offset of the range, kInvalidOffset if no free range fits.
+   */
+  uint64_t allocate(uint64_t size, uint64_t alignment = 1);
+  /// Offset must come from allocate().
+  void free(uint64_t offset);
+  uint64_t getCapacity() const { return m_capacity; }
+  /// Share of free space outside the largest free range, in [0, 1].
+  float getFragmentation() const;
+  Stats getStats() const;
+
+private:
+  void insertFree(uint64_t offset, uint64_t size);
+  void eraseFree(std::map<uint64_t, uint64_t>::iterator it);
+
+  uint64_t m_capacity = 0;
+  uint64_t m_used = 0;
+  /// Free ranges, offset to size and size to offset.
+  std::map<uint64_t, uint64_t> m_free_by_offset;
+  std::multimap<uint64_t, uint64_t> m_free_by_size;
+  /// Live ranges, offset to size.
+  std::unordered_map<uint64_t, uint64_t> m_allocations;
+};
+} // namespace vrtr
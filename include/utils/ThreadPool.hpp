@@ -0,0 +1,61 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vrtr {
+/**
+ * @brief Fixed set of worker threads draining a shared task queue.
+ */
+class ThreadPool {
+public:
+  /// Asks init() for one worker per hardware thread but the caller.
+  static constexpr uint32_t kHardwareThreads = UINT32_MAX;
+  /// @param n_threads 0 starts no worker and every task runs inline.
+  void init(uint32_t n_threads = kHardwareThreads);
+  /// Finish queued tasks and join workers.
+  void deinit();
+  uint32_t getThreadCount() const { return (uint32_t)m_threads.size(); }
+
+  template <typename F> auto submit(F &&func) -> std::future<decltype(func())> {
+    using R = decltype(func());
+    auto task =
+        std::make_shared<std::packaged_task<R()>>(std::forward<F>(func));
+    std::future<R> future = task->get_future();
+    if (m_threads.empty()) {
+      // No worker, run inline.
+      (*task)();
+      return future;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.emplace_back([task]() { (*task)(); });
+    }
+    m_cv.notify_one();
+    return future;
+  }
+  /**
+   * @brief Run func(i) for i in [0, count) and wait for all of them.
+   *        The calling thread runs index 0, so func(i) for distinct i never
+   *        share a thread at the same time. The first exception thrown by
+   *        func is rethrown once every index has finished.
+   */
+  void parallelFor(uint32_t count, const std::function<void(uint32_t)> &func);
+
+private:
+  void workerLoop();
+
+  std::vector<std::thread> m_threads;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stop = false;
+};
+} // namespace vrtr
@@ -7,6 +7,10 @@
 struct FrameData {
   VkCommandPool cmd_pool;
   VkCommandBuffer cmd_buffer_main;
+  /// One pool per recording worker, reset as a whole every frame.
+  std::vector<VkCommandPool> worker_cmd_pools;
+  /// Secondary cmd buffers executed inside the main render pass.
+  std::vector<VkCommandBuffer> worker_cmd_buffers;
 
   // https://github.com/KhronosGroup/Vulkan-Docs/wiki/Synchronization-Examples
   // Sync between GPU queues, one operation wait another to signal a semaphore.
@@ -15,7 +19,31 @@ struct FrameData {
   VkFence render_fence;
 
   DeletionQueue deletion_queue;
-  DescriptorAllocator descriptor_allocator;
+  /// Descriptor writes of this frame, cleared when the frame starts.
+  DescriptorWriter descriptor_writer;
 
   AllocatedBuffer scene_data_buffer;
+  /// Bindless index of scene_data_buffer.
+  uint32_t scene_data_index;
+  /// World transform and box of every draw, host-visible, one per draw.
+  AllocatedBuffer draw_instance_buffer;
+  /// Bindless index of draw_instance_buffer.
+  uint32_t draw_instance_index;
+  /// Host-visible copy of the color image, headless mode only.
+  AllocatedBuffer readback_buffer;
+  /// Meshlet ranges culled this frame, host-visible, one per draw.
+  AllocatedBuffer cluster_range_buffer;
+  /// Indices of meshlets passing the cull, and the indirect draw over them.
+  AllocatedBuffer cluster_index_buffer;
+  AllocatedBuffer cluster_draw_buffer;
+  /// Draws of visible objects and their count, written by the draw cull.
+  AllocatedBuffer draw_command_buffer;
+  AllocatedBuffer draw_count_buffer;
+  /// Host-visible copy of draw_count_buffer, for draw stats.
+  AllocatedBuffer draw_count_readback;
+
+  // GPU scopes recorded in this frame, two timestamps each.
+  VkQueryPool timestamp_pool;
+  std::vector<const char *> gpu_scope_names;
+  uint64_t profiled_frame;
 };
\ No newline at end of file
@@ -36,4 +36,27 @@ private:
   VkBufferCreateInfo m_ci_buffer = {};
   VmaAllocationCreateInfo m_ci_alloc = {};
 };
+
+/// Make writes of the whole buffer in src scope visible to dst scope.
+inline void barrier(VkCommandBuffer cmd, VkBuffer buffer,
+                    VkPipelineStageFlags2 src_stage,
+                    VkAccessFlags2 src_access,
+                    VkPipelineStageFlags2 dst_stage,
+                    VkAccessFlags2 dst_access) {
+  VkBufferMemoryBarrier2 buffer_barrier = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2};
+  buffer_barrier.srcStageMask = src_stage;
+  buffer_barrier.srcAccessMask = src_access;
+  buffer_barrier.dstStageMask = dst_stage;
+  buffer_barrier.dstAccessMask = dst_access;
+  buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  buffer_barrier.buffer = buffer;
+  buffer_barrier.offset = 0;
+  buffer_barrier.size = VK_WHOLE_SIZE;
+  VkDependencyInfo dep_info = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+  dep_info.bufferMemoryBarrierCount = 1;
+  dep_info.pBufferMemoryBarriers = &buffer_barrier;
+  vkCmdPipelineBarrier2(cmd, &dep_info);
+}
 } // namespace vkbuffer
\ No newline at end of file
@@ -1,7 +1,7 @@
 #pragma once
 #include "utils/vk/common.hpp"
 #include <span>
-#include <deque>
+#include <unordered_map>
 
 /**
  * @note  A descriptor set contains multiple
@@ -16,13 +16,20 @@ struct DescriptorLayoutBuilder {
 
   void addBinding(uint32_t binding, VkDescriptorType type);
   void clear();
+  /// Descriptor counts of the layout are recorded for DescriptorAllocator.
   VkDescriptorSetLayout build(VkDevice device, VkShaderStageFlags shader_stages,
                               void *p_next = nullptr,
                               VkDescriptorSetLayoutCreateFlags flags = 0);
+  /// Destroy a layout made by build() and drop its recorded counts.
+  static void destroy(VkDevice device, VkDescriptorSetLayout layout);
 };
 
 /**
  * @brief Scalable allocator, managing multiple pools.
+ *
+ *        New pools are sized by the layouts allocated so far, as recorded by
+ *        DescriptorLayoutBuilder. The ratios given to initPool() only size
+ *        pools until then, and still count for layouts built elsewhere.
  */
 class DescriptorAllocator {
 public:
@@ -30,6 +37,28 @@ public:
     VkDescriptorType type;
     float ratio; // Groups of the same type.
   };
+  struct PoolUsage {
+    VkDescriptorPool pool;
+    uint32_t max_sets;
+    /// Sets allocated since the last clear.
+    uint32_t n_sets;
+  };
+  struct Stats {
+    uint32_t n_pools = 0;
+    uint32_t n_full_pools = 0;
+    /// Most pools alive at once, the largest of summed allocators.
+    uint32_t peak_pools = 0;
+    uint64_t n_pools_created = 0;
+    /// Sets allocated since the last clear, and sets the pools can hold.
+    uint32_t n_sets = 0;
+    uint32_t set_capacity = 0;
+    uint64_t n_sets_total = 0;
+    /// Allocations a full pool turned down, then served by a new pool.
+    uint64_t n_retries = 0;
+    /// Allocations no pool could serve, returned as VK_NULL_HANDLE.
+    uint64_t n_failed = 0;
+    Stats &operator+=(const Stats &other);
+  };
   /**
    * @brief Create the first des pool.
    *
@@ -42,13 +71,30 @@ public:
   void clearPools(VkDevice device);
   void destroyPools(VkDevice device);
 
+  /// @return VK_NULL_HANDLE if neither the current pool nor a new one can
+  ///         hold the set.
   VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout,
                            void *p_next = nullptr);
 
+  Stats getStats() const;
+  std::span<const PoolUsage> getPoolUsage() const { return m_pools; }
+  /// Ratios the next pool is created with.
+  std::vector<PoolSizeRatio> getRatios() const;
+
 private:
-  VkDescriptorPool getPool(VkDevice device);
-  VkDescriptorPool createPool(VkDevice device, uint32_t n_max_set,
-                              std::span<PoolSizeRatio> pool_ratios);
+  /// Descriptors a set of each type needs, over the sets allocated.
+  struct Demand {
+    VkDescriptorType type;
+    uint64_t n_descriptors;
+    /// Most descriptors of the type in a single set.
+    uint32_t max_per_set;
+  };
+  static constexpr uint32_t kInvalidPool = UINT32_MAX;
+  /// Index in m_pools of a pool with room, created if none.
+  uint32_t getPool(VkDevice device);
+  uint32_t createPool(VkDevice device, uint32_t n_max_set);
+  /// Count the descriptors of a set of layout, false if layout is unknown.
+  bool addDemand(VkDescriptorSetLayout layout);
   uint32_t nextSetsPerPool(uint32_t last_n) {
     // A naive grow strategy.
     uint32_t n = last_n * 1.5;
@@ -56,12 +102,52 @@ private:
   }
 
   std::vector<PoolSizeRatio> m_ratios;
-  std::vector<VkDescriptorPool> m_full_pools;
-  std::vector<VkDescriptorPool> m_ready_pools;
+  std::vector<PoolUsage> m_pools;
+  /// Indices in m_pools.
+  std::vector<uint32_t> m_full_pools;
+  std::vector<uint32_t> m_ready_pools;
   uint32_t m_n_sets_per_pool;
   static constexpr uint32_t kMaxNSetsPerPool = 4096;
+
+  std::vector<Demand> m_demand;
+  uint64_t m_n_known_sets = 0;
+  uint64_t m_n_unknown_sets = 0;
+  Stats m_stats;
+};
+
+/**
+ * @brief Update template of a layout, one entry per binding of a single
+ *        descriptor. Cheaper than write structs for layouts updated often.
+ */
+class DescriptorUpdateTemplate {
+public:
+  /// Image or buffer info of an entry, as the template reads it.
+  union Info {
+    VkDescriptorImageInfo image;
+    VkDescriptorBufferInfo buffer;
+  };
+
+  void init(VkDevice device, VkDescriptorSetLayout layout,
+            std::span<const VkDescriptorSetLayoutBinding> bindings);
+  void destroy(VkDevice device);
+  VkDescriptorUpdateTemplate get() const { return m_template; }
+  uint32_t size() const { return (uint32_t)m_bindings.size(); }
+  /// Entry of a binding, UINT32_MAX if the layout has none.
+  uint32_t getEntry(uint32_t binding) const;
+
+private:
+  VkDescriptorUpdateTemplate m_template = VK_NULL_HANDLE;
+  std::vector<uint32_t> m_bindings;
 };
 
+/**
+ * @brief Writes of any number of sets, sent in one vkUpdateDescriptorSets.
+ *        Storage is kept across clear(), a writer living as long as a frame
+ *        stops allocating once it has seen its largest frame.
+ *
+ *        Writes are pending until queueUpdate() gives them a set, and
+ *        flush() sends every queued write.
+ */
 class DescriptorWriter {
 public:
   void writeImage(int binding, VkImageView image, VkSampler sampler,
@@ -69,11 +155,100 @@ public:
   void writeBuffer(int binding, VkBuffer buffer, size_t size, size_t offset,
                    VkDescriptorType d_type);
   void clear();
+  /// Queue pending writes for d_set, flushed with the other sets.
+  void queueUpdate(VkDescriptorSet d_set);
+  /// Drop pending writes, queued ones are kept.
+  void discardPending();
+  /// Send queued writes in a single call. Call before sets are bound.
+  void flush(VkDevice device);
+  /// Write pending writes to d_set now, queued ones go with them.
   void updateDescriptorSet(VkDevice device, VkDescriptorSet d_set);
+  /// Write pending writes to d_set through a template of its layout, which
+  /// they must cover entry for entry. Otherwise they are queued for d_set.
+  /// Queued writes stay queued either way.
+  void updateDescriptorSet(VkDevice device, VkDescriptorSet d_set,
+                           const DescriptorUpdateTemplate &update_template);
+  std::span<const VkWriteDescriptorSet> getPendingWrites() const {
+    return std::span(m_writes).subspan(m_n_queued);
+  }
 
 private:
-  std::deque<VkDescriptorImageInfo> m_image_infos;
-  std::deque<VkDescriptorBufferInfo> m_buffer_infos;
+  /// Point writes at infos again after a vector grew.
+  void rebaseInfos();
+
+  std::vector<VkDescriptorImageInfo> m_image_infos;
+  std::vector<VkDescriptorBufferInfo> m_buffer_infos;
   // Image and buffer writes all comes down here.
   std::vector<VkWriteDescriptorSet> m_writes;
+  /// Writes before this one have a set.
+  size_t m_n_queued = 0;
+  std::vector<DescriptorUpdateTemplate::Info> m_template_infos;
+  /// Entries of m_template_infos given by a write.
+  std::vector<uint8_t> m_template_written;
+};
+
+/**
+ * @brief Descriptor sets keyed by a hash of their layout and bound
+ *        resources. A set is allocated and written on the first request
+ *        only, then reused across frames while the same resources are bound.
+ */
+class DescriptorSetCache {
+public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint32_t n_sets = 0;
+  };
+
+  void init(VkDevice device, uint32_t n_max_set,
+            std::span<DescriptorAllocator::PoolSizeRatio> pool_ratios);
+  void destroy();
+
+  /**
+   * @brief Set of layout with the pending writes of writer. On a miss they
+   *        are queued for the set, or written through update_template if
+   *        given. Flush the writer before the set is bound.
+   */
+  VkDescriptorSet
+  get(VkDescriptorSetLayout layout, DescriptorWriter &writer,
+      const DescriptorUpdateTemplate *update_template = nullptr);
+  /// Drop the sets bound to a resource about to be destroyed. Their
+  /// descriptors are reused by later misses of the same layout, so call it
+  /// once no pending command buffer binds them.
+  void evict(VkBuffer buffer);
+  void evict(VkImageView view);
+  const Stats &getStats() const { return m_stats; }
+  const DescriptorAllocator &getAllocator() const { return m_allocator; }
+
+private:
+  /// One written descriptor, handles as integers.
+  struct Resource {
+    uint32_t binding;
+    uint32_t array_element;
+    VkDescriptorType type;
+    uint64_t handle;
+    uint64_t sampler;
+    VkDeviceSize offset;
+    VkDeviceSize range;
+    VkImageLayout image_layout;
+    bool operator==(const Resource &other) const = default;
+  };
+  struct Entry {
+    VkDescriptorSetLayout layout;
+    std::vector<Resource> resources;
+    VkDescriptorSet set;
+  };
+  void evictHandle(uint64_t handle);
+
+  VkDevice m_device;
+  DescriptorAllocator m_allocator;
+  /// By hash of layout and resources, collisions share a bucket.
+  std::unordered_multimap<size_t, Entry> m_entries;
+  /// Sets of evicted entries, by layout.
+  std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorSet>>
+      m_free_sets;
+  /// Key of the last lookup, kept for its capacity.
+  std::vector<Resource> m_key;
+  Stats m_stats;
 };
\ No newline at end of file
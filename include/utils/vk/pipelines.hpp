@@ -1,11 +1,140 @@
 #pragma once
 #include "utils/vk/common.hpp"
+#include "utils/vk/reflection.hpp"
+#include "utils/ThreadPool.hpp"
+#include <future>
+#include <map>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace vkutil {
+/// Reflect the module into reflection if given, a module failing
+/// reflection is not created.
 bool loadShaderModule(const char *file_path, VkDevice device,
-                      VkShaderModule *out_shader_module);
+                      VkShaderModule *out_shader_module,
+                      ShaderReflection *reflection = nullptr);
 }
 
+/**
+ * @brief Descriptor set and pipeline layouts by their create info. Identical
+ *        layouts of different shaders are created once, owned by the cache.
+ */
+class LayoutCache {
+public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint32_t n_set_layouts = 0;
+    uint32_t n_pipeline_layouts = 0;
+  };
+
+  void init(VkDevice device);
+  void destroy();
+
+  /// @param binding_flags Empty, or one per binding in the order given.
+  VkDescriptorSetLayout
+  getSetLayout(std::span<const VkDescriptorSetLayoutBinding> bindings,
+               VkDescriptorSetLayoutCreateFlags flags = 0,
+               std::span<const VkDescriptorBindingFlags> binding_flags = {});
+  VkPipelineLayout
+  getPipelineLayout(std::span<const VkDescriptorSetLayout> set_layouts,
+                    std::span<const VkPushConstantRange> push_ranges);
+  /**
+   * @brief Layout of every set and push constant the shaders declare.
+   *        Runtime arrays get runtime_array_count descriptors.
+   *
+   * @param set_layouts Layouts of this cache for the first sets, used as is.
+   *                    The shaders must fit their bindings, which may have
+   *                    flags reflection knows nothing of.
+   * @return VK_NULL_HANDLE if the shaders do not fit a given layout.
+   */
+  VkPipelineLayout
+  getPipelineLayout(const vkutil::ShaderReflection &reflection,
+                    std::span<const VkDescriptorSetLayout> set_layouts = {},
+                    uint32_t runtime_array_count = 1);
+  const Stats &getStats() const { return m_stats; }
+
+private:
+  VkDevice m_device;
+  /// Keyed by every field of the create info, handles as integers.
+  std::map<std::vector<uint64_t>, VkDescriptorSetLayout> m_set_layouts;
+  std::map<std::vector<uint64_t>, VkPipelineLayout> m_pipeline_layouts;
+  /// Bindings of every set layout above, to check shaders against.
+  std::unordered_map<VkDescriptorSetLayout,
+                     std::vector<VkDescriptorSetLayoutBinding>>
+      m_set_bindings;
+  Stats m_stats;
+};
+
+/**
+ * @brief Process-wide VkPipelineCache kept on disk between runs.
+ *        The file starts with a header of the device and driver it was
+ *        written for, a mismatch or a bad checksum starts a fresh cache.
+ */
+class PipelineCache {
+public:
+  void init(VkDevice device, VkPhysicalDevice physical_device,
+            const std::string &path);
+  /// Write the cache back to disk and destroy it.
+  void destroy();
+  VkPipelineCache get() const { return m_cache; }
+
+private:
+  struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t cache_uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+    uint64_t data_hash;
+  };
+  static constexpr uint32_t kMagic = 0x43505256; // "VRPC".
+  static constexpr uint32_t kVersion = 1;
+
+  /// Cache data of the file if it matches this device, empty otherwise.
+  std::vector<uint8_t> load() const;
+  bool save() const;
+  FileHeader makeHeader() const;
+  static uint64_t hash(const uint8_t *data, size_t size);
+
+  VkDevice m_device;
+  VkPhysicalDeviceProperties m_properties;
+  std::string m_path;
+  VkPipelineCache m_cache = VK_NULL_HANDLE;
+};
+
+/**
+ * @brief Pipeline being compiled in the background.
+ *        Null until compilation finishes, or if it fails.
+ */
+class PipelineHandle {
+public:
+  PipelineHandle() = default;
+  explicit PipelineHandle(std::shared_future<VkPipeline> future)
+      : m_future(std::move(future)) {}
+  bool isReady() const {
+    return m_future.valid() && m_future.wait_for(std::chrono::seconds(0)) ==
+                                   std::future_status::ready;
+  }
+  /// The pipeline if ready, fallback otherwise. Never blocks.
+  VkPipeline getOr(VkPipeline fallback) const {
+    if (!isReady() || m_future.get() == VK_NULL_HANDLE)
+      return fallback;
+    return m_future.get();
+  }
+  /// Block until compiled.
+  VkPipeline wait() const {
+    return m_future.valid() ? m_future.get() : VK_NULL_HANDLE;
+  }
+
+private:
+  std::shared_future<VkPipeline> m_future;
+};
+
 struct PipelineBuilder {
   std::vector<VkPipelineShaderStageCreateInfo> ci_shader_stages;
   VkPipelineInputAssemblyStateCreateInfo ci_input_asm;
@@ -16,11 +145,36 @@ struct PipelineBuilder {
   VkPipelineDepthStencilStateCreateInfo ci_depth_stencil;
   VkPipelineRenderingCreateInfo ci_render;
   VkFormat fmt_color_attach;
+  /// Empty when shaders fetch vertices themselves.
+  std::vector<VkVertexInputBindingDescription> vertex_bindings;
+  std::vector<VkVertexInputAttributeDescription> vertex_attributes;
+  /// Dynamic rendering with ci_render if null.
+  VkRenderPass render_pass;
+  uint32_t subpass;
 
   PipelineBuilder() { clear(); }
   void clear();
-  VkPipeline buildPipeline(VkDevice device);
+  VkPipeline buildPipeline(VkDevice device,
+                           VkPipelineCache cache = VK_NULL_HANDLE);
+  /**
+   * @brief Compile all builders concurrently against one cache.
+   *        Builders are copied, shader modules must outlive the handles.
+   *        Pipelines are owned by the caller.
+   */
+  static std::vector<PipelineHandle>
+  buildPipelines(VkDevice device, const std::vector<PipelineBuilder> &builders,
+                 VkPipelineCache cache, vrtr::ThreadPool &pool);
+  /// Compute counterpart of buildPipelines(), for a single shader.
+  static PipelineHandle buildComputePipeline(VkDevice device,
+                                             VkShaderModule module,
+                                             VkPipelineLayout layout,
+                                             VkPipelineCache cache,
+                                             vrtr::ThreadPool &pool);
   void setShaders(VkShaderModule vert, VkShaderModule frag);
+  void
+  setVertexInput(std::span<const VkVertexInputBindingDescription> bindings,
+                 std::span<const VkVertexInputAttributeDescription> attributes);
+  void setRenderPass(VkRenderPass pass, uint32_t subpass_index = 0);
   void setInputTopology(VkPrimitiveTopology topology);
   void setPolygonMode(VkPolygonMode mode);
   void setCullMode(VkCullModeFlags mode, VkFrontFace front);
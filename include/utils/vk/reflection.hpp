@@ -0,0 +1,45 @@
+#pragma once
+#include "utils/vk/common.hpp"
+#include <span>
+#include <vector>
+
+namespace vkutil {
+/**
+ * @brief Descriptors, push constants and vertex inputs a SPIR-V module
+ *        declares. Stages of a pipeline are merged into one.
+ */
+struct ShaderReflection {
+  struct Binding {
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType type;
+    /// 0 for a runtime array.
+    uint32_t count;
+    VkShaderStageFlags stages;
+  };
+  struct Input {
+    uint32_t location;
+    VkFormat format;
+  };
+
+  VkShaderStageFlags stages = 0;
+  /// Sorted by set, then binding.
+  std::vector<Binding> bindings;
+  /// A single range over every stage, size 0 without push constants.
+  VkPushConstantRange push_constants = {};
+  /// Inputs of the vertex stage, sorted by location.
+  std::vector<Input> inputs;
+
+  /// @return False if a binding is declared with different types.
+  bool merge(const ShaderReflection &other);
+  /// Highest set used plus one.
+  uint32_t getSetCount() const;
+  /// Layout bindings of a set. Runtime arrays get runtime_array_count.
+  std::vector<VkDescriptorSetLayoutBinding>
+  getSetBindings(uint32_t set, uint32_t runtime_array_count = 1) const;
+};
+
+/// @return False if code is not SPIR-V or declares resources with no
+///         Vulkan descriptor type.
+bool reflectShader(std::span<const uint32_t> code, ShaderReflection &out);
+} // namespace vkutil
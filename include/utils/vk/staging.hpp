@@ -0,0 +1,58 @@
+#pragma once
+#include "utils/vk/common.hpp"
+#include "utils/vk/allocation.hpp"
+#include <deque>
+
+/**
+ * @brief Persistently mapped ring of staging memory.
+ *        Regions are handed out in order and tagged with the timeline value
+ *        of the submit reading them. retire() reclaims them from the tail
+ *        once that value is reached.
+ */
+class StagingRing {
+public:
+  struct Region {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void *mapped;
+  };
+  struct Stats {
+    VkDeviceSize capacity = 0;
+    VkDeviceSize in_use = 0;
+    VkDeviceSize peak_in_use = 0;
+    uint64_t n_allocations = 0;
+    uint64_t n_retired = 0;
+    /// Times the head went back to the start of the ring.
+    uint64_t n_wraps = 0;
+  };
+
+  void init(VmaAllocator allocator, VkDeviceSize capacity);
+  void destroy();
+  /**
+   * @brief Take an aligned region without blocking.
+   *
+   * @param retire_value Timeline value after which the region is free.
+   * @return False if there is no room by now.
+   */
+  bool allocate(VkDeviceSize size, VkDeviceSize alignment,
+                uint64_t retire_value, Region &out);
+  /// Reclaim regions whose retire value is not greater than done_value.
+  void retire(uint64_t done_value);
+  VkDeviceSize getCapacity() const { return m_capacity; }
+  Stats getStats() const;
+
+private:
+  struct Allocated {
+    VkDeviceSize end;
+    uint64_t retire_value;
+  };
+  VkDeviceSize inUse() const;
+
+  AllocatedBuffer m_buffer;
+  VkDeviceSize m_capacity = 0;
+  /// Live memory is [tail, head), or wrapped [tail, capacity) + [0, head).
+  VkDeviceSize m_head = 0;
+  VkDeviceSize m_tail = 0;
+  std::deque<Allocated> m_allocated;
+  Stats m_stats;
+};
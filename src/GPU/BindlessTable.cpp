@@ -0,0 +1,163 @@
+#include "GPU/BindlessTable.hpp"
+#include "utils/log.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace vrtr {
+uint32_t BindlessTable::Slots::acquire() {
+  if (!free.empty()) {
+    uint32_t index = free.back();
+    free.pop_back();
+    live[index] = true;
+    return index;
+  }
+  if (n_used == capacity)
+    return kInvalidIndex;
+  live.push_back(true);
+  return n_used++;
+}
+
+bool BindlessTable::Slots::release(uint32_t index) {
+  if (index >= n_used || !live[index])
+    return false;
+  live[index] = false;
+  free.push_back(index);
+  return true;
+}
+
+void BindlessTable::init(VkDevice device, VkPhysicalDevice physical_device,
+                         LayoutCache &layout_cache, uint32_t max_images,
+                         uint32_t max_samplers, uint32_t max_buffers) {
+  m_device = device;
+  VkPhysicalDeviceVulkan12Properties properties12 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES};
+  VkPhysicalDeviceProperties2 properties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+  properties.pNext = &properties12;
+  vkGetPhysicalDeviceProperties2(physical_device, &properties);
+  m_images.capacity = std::min(
+      max_images,
+      properties12.maxDescriptorSetUpdateAfterBindSampledImages);
+  m_samplers.capacity = std::min(
+      max_samplers, properties12.maxDescriptorSetUpdateAfterBindSamplers);
+  m_buffers.capacity = std::min(
+      max_buffers,
+      properties12.maxDescriptorSetUpdateAfterBindStorageBuffers);
+
+  std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+  bindings[0] = {kImageBinding, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                 m_images.capacity, VK_SHADER_STAGE_ALL, nullptr};
+  bindings[1] = {kSamplerBinding, VK_DESCRIPTOR_TYPE_SAMPLER,
+                 m_samplers.capacity, VK_SHADER_STAGE_ALL, nullptr};
+  bindings[2] = {kBufferBinding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                 m_buffers.capacity, VK_SHADER_STAGE_ALL, nullptr};
+  // Unwritten entries are fine as long as shaders do not read them.
+  std::array<VkDescriptorBindingFlags, 3> binding_flags;
+  binding_flags.fill(VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                     VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT);
+  m_layout = layout_cache.getSetLayout(
+      bindings, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+      binding_flags);
+
+  std::array<VkDescriptorPoolSize, 3> pool_sizes = {{
+      {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, m_images.capacity},
+      {VK_DESCRIPTOR_TYPE_SAMPLER, m_samplers.capacity},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_buffers.capacity},
+  }};
+  VkDescriptorPoolCreateInfo ci_pool = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  ci_pool.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  ci_pool.maxSets = 1;
+  ci_pool.poolSizeCount = (uint32_t)pool_sizes.size();
+  ci_pool.pPoolSizes = pool_sizes.data();
+  VK_CHECK(vkCreateDescriptorPool(m_device, &ci_pool, nullptr, &m_pool));
+
+  VkDescriptorSetAllocateInfo alloc_info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  alloc_info.descriptorPool = m_pool;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &m_layout;
+  VK_CHECK(vkAllocateDescriptorSets(m_device, &alloc_info, &m_set));
+  LOGI("Bindless table of {} images, {} samplers, {} buffers.",
+       m_images.capacity, m_samplers.capacity, m_buffers.capacity);
+}
+
+void BindlessTable::destroy() {
+  LOGI("Bindless table: {} images, {} samplers, {} buffers registered.",
+       m_images.n_used - m_images.free.size(),
+       m_samplers.n_used - m_samplers.free.size(),
+       m_buffers.n_used - m_buffers.free.size());
+  // The set goes with its pool, the layout with the layout cache.
+  vkDestroyDescriptorPool(m_device, m_pool, nullptr);
+}
+
+void BindlessTable::write(uint32_t binding, uint32_t index,
+                          VkDescriptorType type,
+                          const VkDescriptorImageInfo *image_info,
+                          const VkDescriptorBufferInfo *buffer_info) {
+  VkWriteDescriptorSet write = {.sType =
+                                    VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+  write.dstSet = m_set;
+  write.dstBinding = binding;
+  write.dstArrayElement = index;
+  write.descriptorCount = 1;
+  write.descriptorType = type;
+  write.pImageInfo = image_info;
+  write.pBufferInfo = buffer_info;
+  vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+}
+
+uint32_t BindlessTable::registerImage(VkImageView view,
+                                      VkImageLayout layout) {
+  uint32_t index = m_images.acquire();
+  if (index == kInvalidIndex) {
+    LOGE("Bindless table is out of image slots.");
+    return index;
+  }
+  VkDescriptorImageInfo info = {.imageView = view, .imageLayout = layout};
+  write(kImageBinding, index, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, &info,
+        nullptr);
+  return index;
+}
+
+uint32_t BindlessTable::registerSampler(VkSampler sampler) {
+  uint32_t index = m_samplers.acquire();
+  if (index == kInvalidIndex) {
+    LOGE("Bindless table is out of sampler slots.");
+    return index;
+  }
+  VkDescriptorImageInfo info = {.sampler = sampler};
+  write(kSamplerBinding, index, VK_DESCRIPTOR_TYPE_SAMPLER, &info, nullptr);
+  return index;
+}
+
+uint32_t BindlessTable::registerBuffer(VkBuffer buffer, VkDeviceSize offset,
+                                       VkDeviceSize range) {
+  uint32_t index = m_buffers.acquire();
+  if (index == kInvalidIndex) {
+    LOGE("Bindless table is out of buffer slots.");
+    return index;
+  }
+  VkDescriptorBufferInfo info = {
+      .buffer = buffer, .offset = offset, .range = range};
+  write(kBufferBinding, index, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr,
+        &info);
+  return index;
+}
+
+void BindlessTable::releaseImage(uint32_t index) {
+  if (!m_images.release(index))
+    LOGE("Bindless image {} released but not registered.", index);
+}
+
+void BindlessTable::releaseSampler(uint32_t index) {
+  if (!m_samplers.release(index))
+    LOGE("Bindless sampler {} released but not registered.", index);
+}
+
+void BindlessTable::releaseBuffer(uint32_t index) {
+  if (!m_buffers.release(index))
+    LOGE("Bindless buffer {} released but not registered.", index);
+}
+} // namespace vrtr
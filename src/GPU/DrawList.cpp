@@ -0,0 +1,140 @@
+#include "GPU/DrawList.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+namespace vrtr {
+namespace {
+constexpr uint32_t kPipelineBits = 10;
+constexpr uint32_t kSetBits = 16;
+constexpr uint32_t kBufferBits = 12;
+constexpr uint32_t kDepthBits = 24;
+
+constexpr uint64_t mask(uint32_t bits) { return (uint64_t(1) << bits) - 1; }
+
+/// Positive floats order as their bits do, the top ones quantize depth
+/// without a range. Sign is dropped, negative depths are clamped.
+uint64_t quantizeDepth(float depth) {
+  uint32_t bits = std::bit_cast<uint32_t>(std::max(depth, 0.f));
+  return (bits >> (31 - kDepthBits)) & mask(kDepthBits);
+}
+} // namespace
+
+DrawList::Stats &DrawList::Stats::operator+=(const Stats &other) {
+  n_draws += other.n_draws;
+  pipeline_binds += other.pipeline_binds;
+  descriptor_binds += other.descriptor_binds;
+  index_buffer_binds += other.index_buffer_binds;
+  return *this;
+}
+
+void DrawList::clear() {
+  m_items.clear();
+  m_keys.clear();
+  m_pipeline_ids.clear();
+  m_set_ids.clear();
+  m_buffer_ids.clear();
+}
+
+template <typename Handle>
+uint64_t DrawList::getId(std::unordered_map<Handle, uint32_t> &ids,
+                         Handle handle) {
+  return ids.try_emplace(handle, uint32_t(ids.size())).first->second;
+}
+
+void DrawList::add(const GPUMaterialInstance &material, VkBuffer index_buffer,
+                   float depth, const RenderObject &draw) {
+  uint64_t pass = uint64_t(material.pass_type) & mask(2);
+  uint64_t state =
+      (getId(m_pipeline_ids, material.p_pipeline->pipeline) &
+       mask(kPipelineBits))
+          << (kSetBits + kBufferBits) |
+      (getId(m_set_ids, material.descriptor_set) & mask(kSetBits))
+          << kBufferBits |
+      (getId(m_buffer_ids, index_buffer) & mask(kBufferBits));
+  uint64_t key;
+  if (material.pass_type == MaterialPass::BaseTransparent) {
+    uint64_t back_to_front = ~quantizeDepth(depth) & mask(kDepthBits);
+    key = pass << 62 | back_to_front << 38 | state;
+  } else {
+    key = pass << 62 | state << kDepthBits | quantizeDepth(depth);
+  }
+  m_keys.push_back(key);
+  m_items.push_back({*material.p_pipeline, material.descriptor_set,
+                     index_buffer, draw});
+}
+
+void DrawList::sort() {
+  size_t n = m_keys.size();
+  m_order.resize(n);
+  for (size_t i = 0; i < n; i++)
+    m_order[i] = uint32_t(i);
+  if (n < 2)
+    return;
+  m_scratch_keys.resize(n);
+  m_scratch_order.resize(n);
+
+  // Histograms of all bytes in a single read of the keys.
+  std::array<std::array<uint32_t, 256>, 8> counts = {};
+  for (uint64_t key : m_keys) {
+    for (int b = 0; b < 8; b++)
+      counts[b][(key >> (8 * b)) & 0xff]++;
+  }
+  for (int b = 0; b < 8; b++) {
+    // A byte shared by every key would not move anything.
+    uint32_t shift = 8 * b;
+    if (counts[b][(m_keys[0] >> shift) & 0xff] == n)
+      continue;
+    std::array<uint32_t, 256> offsets;
+    uint32_t offset = 0;
+    for (int d = 0; d < 256; d++) {
+      offsets[d] = offset;
+      offset += counts[b][d];
+    }
+    for (size_t i = 0; i < n; i++) {
+      uint32_t slot = offsets[(m_keys[i] >> shift) & 0xff]++;
+      m_scratch_keys[slot] = m_keys[i];
+      m_scratch_order[slot] = m_order[i];
+    }
+    m_keys.swap(m_scratch_keys);
+    m_order.swap(m_scratch_order);
+  }
+}
+
+DrawList::Stats DrawList::record(VkCommandBuffer cmd, size_t begin,
+                                 size_t end, uint32_t material_set) const {
+  Stats stats;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+  VkBuffer index_buffer = VK_NULL_HANDLE;
+  for (size_t i = begin; i < end; i++) {
+    const Item &item = m_items[m_order[i]];
+    if (item.pipeline.pipeline != pipeline) {
+      pipeline = item.pipeline.pipeline;
+      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+      stats.pipeline_binds++;
+    }
+    // Sets are bound again if the layout changes, in case it is not
+    // compatible.
+    if (item.pipeline.layout != layout ||
+        item.descriptor_set != descriptor_set) {
+      layout = item.pipeline.layout;
+      descriptor_set = item.descriptor_set;
+      vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout,
+                              material_set, 1, &descriptor_set, 0, nullptr);
+      stats.descriptor_binds++;
+    }
+    if (item.index_buffer != index_buffer) {
+      index_buffer = item.index_buffer;
+      vkCmdBindIndexBuffer(cmd, index_buffer, 0, VK_INDEX_TYPE_UINT32);
+      stats.index_buffer_binds++;
+    }
+    vkCmdDrawIndexed(cmd, item.draw.index_count, 1, item.draw.index_offset,
+                     item.draw.vertex_offset, item.draw.first_instance);
+    stats.n_draws++;
+  }
+  return stats;
+}
+} // namespace vrtr
@@ -0,0 +1,49 @@
+#include "GPU/DynamicResolution.hpp"
+#include "utils/log.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace vrtr {
+void DynamicResolution::init(const Json &config) {
+  m_enabled = fetchOptional<bool>(config, "dynamic_resolution", false);
+  m_target_ms = fetchOptional<double>(config, "target_frame_ms", 16.0);
+  m_min_scale = fetchOptional<float>(config, "min_render_scale", 0.5f);
+  if (m_target_ms <= 0.0) {
+    LOGE("target_frame_ms {} is not positive, use 16.", m_target_ms);
+    m_target_ms = 16.0;
+  }
+  m_min_scale = std::clamp(m_min_scale, 0.1f, 1.f);
+  m_scale = 1.f;
+  m_average_ms = 0.0;
+  if (m_enabled)
+    LOGI("Dynamic resolution, {} ms budget, scale down to {}.", m_target_ms,
+         m_min_scale);
+}
+
+void DynamicResolution::addFrameTime(double gpu_ms) {
+  if (!m_enabled || gpu_ms <= 0.0)
+    return;
+  m_average_ms = m_average_ms == 0.0
+                     ? gpu_ms
+                     : m_average_ms + kSmoothing * (gpu_ms - m_average_ms);
+  if (m_average_ms < m_target_ms && m_average_ms > m_target_ms * kHeadroom)
+    return;
+  // Cost goes with the pixel count, the square of the scale.
+  float wanted = m_scale * float(std::sqrt(m_target_ms * kHeadroom /
+                                           m_average_ms));
+  wanted = std::clamp(wanted, m_scale - kMaxStep, m_scale + kMaxStep);
+  m_scale = std::clamp(wanted, m_min_scale, 1.f);
+}
+
+VkExtent2D DynamicResolution::scaleExtent(VkExtent2D max_extent) const {
+  if (!m_enabled)
+    return max_extent;
+  // Rounded down to even sizes, never empty.
+  auto scale = [&](uint32_t size) {
+    uint32_t scaled = uint32_t(float(size) * m_scale) & ~1u;
+    return std::clamp(scaled, std::min(size, 2u), size);
+  };
+  return {scale(max_extent.width), scale(max_extent.height)};
+}
+} // namespace vrtr
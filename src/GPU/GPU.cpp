@@ -9,24 +9,100 @@
 #include "utils/log.hpp"
 #include "Scene/Scene.hpp"
 
+#include <algorithm>
 #include <stb_image.h>
 #include <SDL3/SDL_vulkan.h>
 #include <VkBootstrap.h>
 
 namespace vrtr {
-void GPU::init(SDL_Window *window) {
+void GPU::init(SDL_Window *window, const Json &config) {
   LOGI("GPU init.");
   m_window = window;
+  m_headless = fetchOptional<bool>(config, "headless", false);
+  m_profiler.setEnabled(fetchOptional<bool>(config, "profile", false));
+
+  // More frames in flight trades latency for throughput.
+  int n_frames = fetchOptional<int>(config, "frames_in_flight", 2);
+  if (n_frames < int(kMinFrameOverlap) || n_frames > int(kMaxFrameOverlap)) {
+    LOGE("frames_in_flight {} out of range [{}, {}], clamped.", n_frames,
+         kMinFrameOverlap, kMaxFrameOverlap);
+    n_frames = std::clamp(n_frames, int(kMinFrameOverlap),
+                          int(kMaxFrameOverlap));
+  }
+  m_frames.resize(n_frames);
+  std::string present_mode =
+      fetchOptional<std::string>(config, "present_mode", "fifo");
+  if (present_mode == "fifo")
+    m_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+  else if (present_mode == "fifo_relaxed")
+    m_present_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+  else if (present_mode == "mailbox")
+    m_present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+  else if (present_mode == "immediate")
+    m_present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+  else
+    LOGE("Unknown present_mode {}, use fifo.", present_mode);
+  LOGI("{} frames in flight.", n_frames);
+  uint32_t n_record_threads =
+      fetchOptional<uint32_t>(config, "record_threads", 0);
+  if (n_record_threads == 0)
+    n_record_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  m_n_record_workers = std::min(n_record_threads, kMaxRecordWorkers);
+  // The calling thread records too, a single recorder starts no worker.
+  m_record_pool.init(m_n_record_workers - 1);
+  LOGI("{} threads recording draws.", m_n_record_workers);
+  m_pipeline_cache_path = fetchOptional<std::string>(
+      config, "pipeline_cache", "pipeline_cache.bin");
+  m_lod_error_pixels =
+      std::max(fetchOptional<float>(config, "lod_error_pixels", 1.f), 0.f);
+  // Off by default, sorted draws are recorded on CPU by every worker.
+  m_cluster_culling = fetchOptional<bool>(config, "cluster_culling", false);
+  m_frustum_culling = fetchOptional<bool>(config, "frustum_culling", true);
+  m_gpu_driven = fetchOptional<bool>(config, "gpu_driven", false);
+  if (m_gpu_driven) {
+    LOGI("GPU-driven draws, culled in a compute pass.");
+    m_cluster_culling = false;
+    m_frustum_culling = false;
+  }
+  m_cull_kernel = getBestCullKernel();
+  if (m_frustum_culling)
+    LOGI("Frustum culling with {} kernel.", getCullKernelName(m_cull_kernel));
+  int vertex_mb = fetchOptional<int>(config, "geometry_vertex_mb", 64);
+  int index_mb = fetchOptional<int>(config, "geometry_index_mb", 32);
+  m_geometry_vertex_capacity = VkDeviceSize(std::max(vertex_mb, 1)) << 20;
+  m_geometry_index_capacity = VkDeviceSize(std::max(index_mb, 1)) << 20;
+  int staging_mb = fetchOptional<int>(config, "staging_ring_mb", 64);
+  m_staging_capacity = VkDeviceSize(std::max(staging_mb, 1)) << 20;
+
   int w, h;
-  SDL_GetWindowSize(m_window, &w, &h);
+  if (m_headless) {
+    LOGI("Running headless.");
+    w = fetchOptional<int>(config, "headless_width", 1920);
+    h = fetchOptional<int>(config, "headless_height", 1080);
+  } else {
+    SDL_GetWindowSize(m_window, &w, &h);
+  }
   m_window_extent.width = w;
   m_window_extent.height = h;
 
+  // Readback expects full-size frames, keep headless at scale 1.
+  if (!m_headless)
+    m_dynamic_resolution.init(config);
+
   initVulkan();
-  initSwapchain();
+  if (m_headless)
+    m_target_extent = m_window_extent;
+  else {
+    initSwapchain();
+    m_target_extent = m_swapchain_extent;
+  }
+  m_render_extent = m_target_extent;
   initOffScreenImages();
   initCommands();
   initSyncStructures();
+  initUploader();
+  initGeometry();
+  initProfiler();
   initDescriptors();
   initRenderPass();
   initPipelines();
@@ -43,12 +119,15 @@ void GPU::initVulkan() {
                              .request_validation_layers(kUseValidation)
                              .use_default_debug_messenger()
                              .require_api_version(1, 3, 0)
+                             // No surface extensions without a display.
+                             .set_headless(m_headless)
                              .build();
   auto vkb_instance = instance_result.value();
   m_instance = vkb_instance.instance;
   m_debug_messenger = vkb_instance.debug_messenger;
 
-  SDL_Vulkan_CreateSurface(m_window, m_instance, NULL, &m_surface);
+  if (!m_headless)
+    SDL_Vulkan_CreateSurface(m_window, m_instance, NULL, &m_surface);
 
   // Vulkan 1.3 features.
   VkPhysicalDeviceVulkan13Features features13{
@@ -60,20 +139,34 @@ void GPU::initVulkan() {
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
   features12.bufferDeviceAddress = true;
   features12.descriptorIndexing = true;
+  // Bindless table, see BindlessTable.
+  features12.descriptorBindingPartiallyBound = true;
+  features12.descriptorBindingSampledImageUpdateAfterBind = true;
+  features12.descriptorBindingStorageBufferUpdateAfterBind = true;
+  features12.runtimeDescriptorArray = true;
+  features12.shaderSampledImageArrayNonUniformIndexing = true;
+  features12.shaderStorageBufferArrayNonUniformIndexing = true;
+  features12.drawIndirectCount = true;
+  features12.hostQueryReset = true;
+  features12.timelineSemaphore = true;
+  // Indirect draws carry their per-draw data index in first_instance.
+  VkPhysicalDeviceFeatures features{};
+  features.multiDrawIndirect = true;
+  features.drawIndirectFirstInstance = true;
 
   // Select a gpu.
   // We want a gpu that can write to the SDL surface and supports vulkan 1.3
   // with the correct features
   vkb::PhysicalDeviceSelector selector{vkb_instance};
-  vkb::PhysicalDevice physical_device =
-      selector.set_minimum_version(1, 3)
-          .set_required_features_13(features13)
-          .set_required_features_12(features12)
-          // For resetting query pool from host.
-          .add_required_extension(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME)
-          .set_surface(m_surface)
-          .select()
-          .value();
+  selector.set_minimum_version(1, 3)
+      .set_required_features_13(features13)
+      .set_required_features_12(features12)
+      .set_required_features(features)
+      // For resetting query pool from host.
+      .add_required_extension(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME);
+  if (!m_headless)
+    selector.set_surface(m_surface);
+  vkb::PhysicalDevice physical_device = selector.select().value();
 
   // Final vulkan device.
   vkb::DeviceBuilder device_builder{physical_device};
@@ -84,6 +177,21 @@ void GPU::initVulkan() {
   m_graphic_queue = vkb_device.get_queue(vkb::QueueType::graphics).value();
   m_graphic_queue_family =
       vkb_device.get_queue_index(vkb::QueueType::graphics).value();
+  // Transfer-only family runs copies alongside graphic work.
+  auto transfer_queue =
+      vkb_device.get_dedicated_queue(vkb::QueueType::transfer);
+  if (transfer_queue) {
+    m_transfer_queue = transfer_queue.value();
+    m_transfer_queue_family =
+        vkb_device.get_dedicated_queue_index(vkb::QueueType::transfer)
+            .value();
+    LOGI("Upload on dedicated transfer queue family {}.",
+         m_transfer_queue_family);
+  } else {
+    m_transfer_queue = m_graphic_queue;
+    m_transfer_queue_family = m_graphic_queue_family;
+    LOGI("No dedicated transfer queue, upload on graphic queue.");
+  }
 
   // Mem allocator.
   VmaAllocatorCreateInfo ci_alloc = {};
@@ -96,7 +204,8 @@ void GPU::initVulkan() {
   m_deletion_queue.push([&]() {
     vmaDestroyAllocator(m_mem_allocator);
     vkDestroyDevice(m_device, nullptr);
-    vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+    if (m_surface != VK_NULL_HANDLE)
+      vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
     vkb::destroy_debug_utils_messenger(m_instance, m_debug_messenger);
     vkDestroyInstance(m_instance, nullptr);
   });
@@ -107,18 +216,38 @@ void GPU::initSwapchain() {
   m_deletion_queue.push([&]() { destroySwapchain(); });
 }
 
-void GPU::createSwapchain(int w, int h) {
+VkPresentModeKHR GPU::choosePresentMode(VkPresentModeKHR desired) {
+  uint32_t n_modes = 0;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(m_chosen_GPU, m_surface, &n_modes,
+                                            nullptr);
+  std::vector<VkPresentModeKHR> modes(n_modes);
+  vkGetPhysicalDeviceSurfacePresentModesKHR(m_chosen_GPU, m_surface, &n_modes,
+                                            modes.data());
+  if (std::find(modes.begin(), modes.end(), desired) != modes.end())
+    return desired;
+  // FIFO is the only mode guaranteed by spec.
+  LOGE("Present mode {} not supported, fall back to FIFO.",
+       string_VkPresentModeKHR(desired));
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+void GPU::createSwapchain(int w, int h, VkSwapchainKHR old_swapchain) {
   vkb::SwapchainBuilder swapchainBuilder{m_chosen_GPU, m_device, m_surface};
   m_swapchain_format = VK_FORMAT_B8G8R8A8_UNORM;
+  VkPresentModeKHR present_mode = choosePresentMode(m_present_mode);
+  LOGI("Present mode {}.", string_VkPresentModeKHR(present_mode));
   vkb::Swapchain vkbSwapchain =
       swapchainBuilder
           .set_desired_format(VkSurfaceFormatKHR{
               .format = m_swapchain_format,
               .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR})
-          // use v-sync present mode
-          .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+          .set_desired_present_mode(present_mode)
+          // One more image than frames in flight, so acquire rarely blocks.
+          .set_desired_min_image_count(uint32_t(m_frames.size()) + 1)
           .set_desired_extent(w, h)
           .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+          // Lets the driver reuse resources of the retired swapchain.
+          .set_old_swapchain(old_swapchain)
           .build()
           .value();
 
@@ -134,12 +263,83 @@ void GPU::destroySwapchain() {
   }
 }
 
+bool GPU::recreateSwapchain() {
+  int w, h;
+  SDL_GetWindowSizeInPixels(m_window, &w, &h);
+  if (w == 0 || h == 0)
+    return false;
+  ProfileScope profile_scope(m_profiler, "GPU::recreateSwapchain");
+  LOGI("Recreate swapchain {}x{}.", w, h);
+  m_window_extent.width = w;
+  m_window_extent.height = h;
+  // Earlier frames may still present from or render to the old objects.
+  // A skipped frame does not advance the frame number, so they can not go
+  // with the fence of this slot.
+  VkSwapchainKHR old_swapchain = m_swapchain;
+  std::vector<VkImageView> old_views = m_swapchain_image_views;
+  createSwapchain(w, h, old_swapchain);
+  retire([this, old_swapchain, old_views]() {
+    for (auto view : old_views)
+      vkDestroyImageView(m_device, view, nullptr);
+    vkDestroySwapchainKHR(m_device, old_swapchain, nullptr);
+  });
+
+  if (m_swapchain_extent.width != m_target_extent.width ||
+      m_swapchain_extent.height != m_target_extent.height) {
+    AllocatedImage old_color = m_color_image;
+    AllocatedImage old_depth = m_depth_image;
+    VkFramebuffer old_framebuffer = m_framebuffer;
+    m_target_extent = m_swapchain_extent;
+    m_render_extent = m_dynamic_resolution.scaleExtent(m_target_extent);
+    createRenderTargets();
+    createFramebuffer();
+    retire([this, old_color, old_depth, old_framebuffer]() mutable {
+      vkDestroyFramebuffer(m_device, old_framebuffer, nullptr);
+      old_color.destroy();
+      old_depth.destroy();
+    });
+  }
+  m_swapchain_dirty = false;
+  return true;
+}
+
+void GPU::retire(std::function<void()> &&destroy) {
+  m_retired.push_back({m_frame_number, std::move(destroy)});
+}
+
+void GPU::collectRetired() {
+  // The fence just waited for is that of frame m_frame_number - N, every
+  // frame up to it is done. Objects retired at frame R were used by frames
+  // up to R - 1.
+  size_t n_frames = m_frames.size();
+  while (!m_retired.empty() &&
+         m_retired.front().frame_number + n_frames <= m_frame_number + 1) {
+    m_retired.front().destroy();
+    m_retired.pop_front();
+  }
+  // Before recording, so this frame draws from the packed arena.
+  if (m_geometry_freed) {
+    m_geometry_freed = false;
+    if (m_geometry.getFragmentation() > kMaxGeometryFragmentation)
+      defragmentGeometry();
+  }
+}
+
 void GPU::initOffScreenImages() {
+  createRenderTargets();
+  // Targets recreated on resize are destroyed here too.
+  m_deletion_queue.push([&]() {
+    m_color_image.destroy();
+    m_depth_image.destroy();
+  });
+}
+
+void GPU::createRenderTargets() {
   {
     vkimage::ImageBuilder builder;
     m_color_image =
         builder
-            .setExtent(m_swapchain_extent.width, m_swapchain_extent.height, 1)
+            .setExtent(m_target_extent.width, m_target_extent.height, 1)
             .setFormat(VK_FORMAT_R16G16B16A16_SFLOAT)
             .addUsage(VK_IMAGE_USAGE_TRANSFER_SRC_BIT)
             .addUsage(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
@@ -151,15 +351,11 @@ void GPU::initOffScreenImages() {
     vkimage::ImageBuilder builder;
     m_depth_image =
         builder
-            .setExtent(m_swapchain_extent.width, m_swapchain_extent.height, 1)
+            .setExtent(m_target_extent.width, m_target_extent.height, 1)
             .setFormat(VK_FORMAT_D32_SFLOAT)
             .addUsage(VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
             .build(m_device, m_mem_allocator);
   }
-  m_deletion_queue.push([&]() {
-    m_color_image.destroy();
-    m_depth_image.destroy();
-  });
 }
 
 void GPU::initCommands() {
@@ -169,13 +365,30 @@ void GPU::initCommands() {
   VkCommandPoolCreateInfo ci_cmd_pool = vkinit::cmdPoolCreateInfo(
       m_graphic_queue_family, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-  for (uint32_t i = 0; i < kFrameOverlap; i++) {
+  // Worker pools are reset as a whole, not buffer by buffer.
+  VkCommandPoolCreateInfo ci_worker_cmd_pool = vkinit::cmdPoolCreateInfo(
+      m_graphic_queue_family, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+  for (size_t i = 0; i < m_frames.size(); i++) {
     VK_CHECK(vkCreateCommandPool(m_device, &ci_cmd_pool, nullptr,
                                  &m_frames[i].cmd_pool));
     VkCommandBufferAllocateInfo cmd_alloc_info =
         vkinit::cmdBufferAllocInfo(m_frames[i].cmd_pool, 1);
     VK_CHECK(vkAllocateCommandBuffers(m_device, &cmd_alloc_info,
                                       &m_frames[i].cmd_buffer_main));
+
+    // A pool is externally synchronized, so each worker owns one.
+    m_frames[i].worker_cmd_pools.resize(m_n_record_workers);
+    m_frames[i].worker_cmd_buffers.resize(m_n_record_workers);
+    for (uint32_t w = 0; w < m_n_record_workers; w++) {
+      VK_CHECK(vkCreateCommandPool(m_device, &ci_worker_cmd_pool, nullptr,
+                                   &m_frames[i].worker_cmd_pools[w]));
+      VkCommandBufferAllocateInfo worker_alloc_info =
+          vkinit::cmdBufferAllocInfo(m_frames[i].worker_cmd_pools[w], 1);
+      worker_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      VK_CHECK(vkAllocateCommandBuffers(m_device, &worker_alloc_info,
+                                        &m_frames[i].worker_cmd_buffers[w]));
+    }
   }
 
   // Init immediate cmd.
@@ -198,7 +411,7 @@ void GPU::initSyncStructures() {
       vkinit::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
   VkSemaphoreCreateInfo ci_semaphore = vkinit::semaphoreCreateInfo();
 
-  for (uint32_t i = 0; i < kFrameOverlap; i++) {
+  for (size_t i = 0; i < m_frames.size(); i++) {
     VK_CHECK(
         vkCreateFence(m_device, &ci_fence, nullptr, &m_frames[i].render_fence));
     VK_CHECK(vkCreateSemaphore(m_device, &ci_semaphore, nullptr,
@@ -211,38 +424,129 @@ void GPU::initSyncStructures() {
       [&]() { vkDestroyFence(m_device, m_imm_fence, nullptr); });
 }
 
-void GPU::initDescriptors() {
-  std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
-      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1}};
-  // Descriptor pool with 10 des sets, 1 image each.
-  m_descriptor_allocator.initPool(m_device, 10, sizes);
-  {
-    DescriptorLayoutBuilder builder;
-    builder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    builder.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    m_desc_set_layouts.scene_data = builder.build(
-        m_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+void GPU::initUploader() {
+  m_uploader.init(m_device, m_mem_allocator, m_transfer_queue,
+                  m_transfer_queue_family, m_graphic_queue_family,
+                  m_staging_capacity);
+  m_deletion_queue.push([&]() { m_uploader.deinit(); });
+}
+
+void GPU::initProfiler() {
+  // Dynamic resolution needs the GPU frame time too.
+  if (!m_profiler.isEnabled() && !m_dynamic_resolution.isEnabled())
+    return;
+  LOGI("Init profiler.");
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(m_chosen_GPU, &properties);
+  m_timestamp_period = properties.limits.timestampPeriod;
+  uint32_t n_families = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(m_chosen_GPU, &n_families, nullptr);
+  std::vector<VkQueueFamilyProperties> families(n_families);
+  vkGetPhysicalDeviceQueueFamilyProperties(m_chosen_GPU, &n_families,
+                                           families.data());
+  if (families[m_graphic_queue_family].timestampValidBits == 0) {
+    LOGE("No timestamp support on graphic queue, GPU scopes disabled.");
+    return;
   }
 
+  VkQueryPoolCreateInfo ci_query_pool = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+  ci_query_pool.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  ci_query_pool.queryCount = 2 * kMaxGpuScopes;
+  for (size_t i = 0; i < m_frames.size(); i++) {
+    VK_CHECK(vkCreateQueryPool(m_device, &ci_query_pool, nullptr,
+                               &m_frames[i].timestamp_pool));
+    // Queries must be reset before first use.
+    vkResetQueryPool(m_device, m_frames[i].timestamp_pool, 0,
+                     ci_query_pool.queryCount);
+  }
+  ci_query_pool.queryCount = 2;
+  VK_CHECK(vkCreateQueryPool(m_device, &ci_query_pool, nullptr,
+                             &m_imm_timestamp_pool));
   m_deletion_queue.push([&]() {
-    m_descriptor_allocator.destroyPools(m_device);
-    vkDestroyDescriptorSetLayout(m_device, m_desc_set_layouts.scene_data,
-                                 nullptr);
+    for (size_t i = 0; i < m_frames.size(); i++)
+      vkDestroyQueryPool(m_device, m_frames[i].timestamp_pool, nullptr);
+    vkDestroyQueryPool(m_device, m_imm_timestamp_pool, nullptr);
   });
 
-  /// Frame-dedicated pools are accessed on-the-fly.
-  for (size_t i = 0; i < kFrameOverlap; i++) {
-    std::vector<DescriptorAllocator::PoolSizeRatio> frame_sizes = {
-        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3},
-        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
-        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
-    };
-    m_frames[i].descriptor_allocator = {};
-    m_frames[i].descriptor_allocator.initPool(m_device, 1000, frame_sizes);
-    m_deletion_queue.push(
-        [&, i]() { m_frames[i].descriptor_allocator.destroyPools(m_device); });
+  // Line up GPU clock with CPU clock using an empty submit.
+  // Off by the submit latency, good enough to compare the tracks.
+  vkResetQueryPool(m_device, m_imm_timestamp_pool, 0, 2);
+  int64_t cpu_ns = m_profiler.now();
+  immediateSubmit(
+      [&](VkCommandBuffer cmd) {
+        vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                             m_imm_timestamp_pool, 0);
+      },
+      "calibration");
+  uint64_t gpu_ticks = 0;
+  VK_CHECK(vkGetQueryPoolResults(m_device, m_imm_timestamp_pool, 0, 1,
+                                 sizeof(gpu_ticks), &gpu_ticks,
+                                 sizeof(gpu_ticks), VK_QUERY_RESULT_64_BIT));
+  m_profiler.setGpuClockOffset(cpu_ns - timestampToNs(gpu_ticks));
+  m_gpu_timestamps = true;
+}
+
+uint32_t GPU::beginGpuScope(VkCommandBuffer cmd, const char *name) {
+  FrameData &frame = getCurrentFrame();
+  if (!m_gpu_timestamps || frame.gpu_scope_names.size() >= kMaxGpuScopes)
+    return UINT32_MAX;
+  uint32_t scope = uint32_t(frame.gpu_scope_names.size());
+  frame.gpu_scope_names.push_back(name);
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                       frame.timestamp_pool, 2 * scope);
+  return scope;
+}
+
+void GPU::endGpuScope(VkCommandBuffer cmd, uint32_t scope) {
+  if (scope == UINT32_MAX)
+    return;
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                       getCurrentFrame().timestamp_pool, 2 * scope + 1);
+}
+
+void GPU::collectGpuScopes(FrameData &frame) {
+  if (!m_gpu_timestamps || frame.gpu_scope_names.empty())
+    return;
+  uint32_t n_queries = 2 * uint32_t(frame.gpu_scope_names.size());
+  std::array<uint64_t, 2 * kMaxGpuScopes> ticks;
+  VkResult result = vkGetQueryPoolResults(
+      m_device, frame.timestamp_pool, 0, n_queries,
+      sizeof(uint64_t) * n_queries, ticks.data(), sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT);
+  if (result == VK_SUCCESS) {
+    // "frame" is always the first scope of a frame.
+    m_dynamic_resolution.addFrameTime(
+        double(timestampToNs(ticks[1]) - timestampToNs(ticks[0])) * 1e-6);
+  }
+  if (result == VK_SUCCESS && m_profiler.isEnabled()) {
+    std::vector<ProfileEvent> events;
+    events.reserve(frame.gpu_scope_names.size());
+    for (size_t i = 0; i < frame.gpu_scope_names.size(); i++) {
+      events.push_back({frame.gpu_scope_names[i],
+                        timestampToNs(ticks[2 * i]),
+                        timestampToNs(ticks[2 * i + 1])});
+    }
+    m_profiler.addGpuEvents(frame.profiled_frame, events);
   }
+  vkResetQueryPool(m_device, frame.timestamp_pool, 0, n_queries);
+  frame.gpu_scope_names.clear();
+}
+
+void GPU::initDescriptors() {
+  m_layout_cache.init(m_device);
+  // Resources register once, draws allocate and write no descriptors.
+  m_bindless.init(m_device, m_chosen_GPU, m_layout_cache, 4096, 64, 4096);
+  std::vector<DescriptorAllocator::PoolSizeRatio> cache_sizes = {
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5}};
+  m_descriptor_cache.init(m_device, 16, cache_sizes);
+
+  m_deletion_queue.push([&]() {
+    m_bindless.destroy();
+    m_descriptor_cache.destroy();
+    // Pipelines using these layouts are gone by now.
+    m_layout_cache.destroy();
+  });
 }
 
 void GPU::initRenderPass() {
@@ -307,169 +611,193 @@ void GPU::initRenderPass() {
       [&]() { vkDestroyRenderPass(m_device, m_render_pass, nullptr); });
 }
 
-void GPU::initPipelines() { initGraphicPipeline(); }
+void GPU::initPipelines() {
+  m_pipeline_cache.init(m_device, m_chosen_GPU, m_pipeline_cache_path);
+  // Pushed first, so written back after every pipeline is built.
+  m_deletion_queue.push([&]() { m_pipeline_cache.destroy(); });
+  m_compile_pool.init();
+  // Pending compiles finish before the cache is saved.
+  m_deletion_queue.push([&]() { m_compile_pool.deinit(); });
+  initGraphicPipeline();
+  if (m_cluster_culling)
+    initClusterCull();
+  if (m_gpu_driven)
+    initDrawCull();
+}
 
-void GPU::initGraphicPipeline() {
-  /// A single-subpass render pass pipeline.
-  VkPipelineLayoutCreateInfo pipelineLayoutInfo =
-      vkinit::pipelineLayoutCreateInfo();
-  pipelineLayoutInfo.setLayoutCount = 1;
-  pipelineLayoutInfo.pSetLayouts = &m_desc_set_layouts.scene_data;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;
-  pipelineLayoutInfo.pPushConstantRanges = nullptr;
-  VK_CHECK(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr,
-                                  &m_pipeline_layout));
-  m_deletion_queue.push(
-      [&]() { vkDestroyPipelineLayout(m_device, m_pipeline_layout, nullptr); });
-  std::vector<VkDynamicState> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT,
-                                               VK_DYNAMIC_STATE_SCISSOR};
-
-  VkPipelineDynamicStateCreateInfo dynamicState{};
-  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-  dynamicState.pDynamicStates = dynamicStates.data();
-
-  auto v_binding_description = Vertex::getVertexBindingDescription();
-  auto v_attribute_descriptions = Vertex::getVertexAttributeDescriptions();
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-  vertexInputInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertexInputInfo.vertexBindingDescriptionCount = 1;
-  vertexInputInfo.pVertexBindingDescriptions = &v_binding_description;
-  vertexInputInfo.vertexAttributeDescriptionCount =
-      static_cast<uint32_t>(v_attribute_descriptions.size());
-  vertexInputInfo.pVertexAttributeDescriptions =
-      v_attribute_descriptions.data();
-
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-  inputAssembly.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  inputAssembly.primitiveRestartEnable = VK_FALSE;
+void GPU::initClusterCull() {
+  VkShaderModule cull_comp;
+  vkutil::ShaderReflection reflection;
+  if (!vkutil::loadShaderModule(
+          "../../assets/shaders/spv/cluster_cull.comp.spv", m_device,
+          &cull_comp, &reflection)) {
+    LOGE("Failed to load the cluster cull shader, draw without it.");
+    m_cluster_culling = false;
+    return;
+  }
+  // Constants are pushed from their C++ mirror, the only copy of the
+  // shader interface. The template checks bindings against the writes.
+  if (reflection.push_constants.size != sizeof(ClusterCullConstants)) {
+    LOGE("Cluster cull shader pushes {} bytes, {} expected.",
+         reflection.push_constants.size, sizeof(ClusterCullConstants));
+    vkDestroyShaderModule(m_device, cull_comp, nullptr);
+    m_cluster_culling = false;
+    return;
+  }
+  std::vector<VkDescriptorSetLayoutBinding> bindings =
+      reflection.getSetBindings(0);
+  m_desc_set_layouts.cluster_cull = m_layout_cache.getSetLayout(bindings);
+  m_desc_templates.cluster_cull.init(m_device, m_desc_set_layouts.cluster_cull,
+                                     bindings);
+  m_cluster_cull_layout = m_layout_cache.getPipelineLayout(reflection);
+
+  // The pass is skipped until it is ready.
+  m_cluster_cull_pipeline =
+      compileComputePipeline(cull_comp, m_cluster_cull_layout);
+  m_deletion_queue.push([this, cull_comp]() {
+    vkDestroyPipeline(m_device, m_cluster_cull_pipeline.wait(), nullptr);
+    vkDestroyShaderModule(m_device, cull_comp, nullptr);
+    m_desc_templates.cluster_cull.destroy(m_device);
+  });
+}
 
-  VkViewport viewport{};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float)m_swapchain_extent.width;
-  viewport.height = (float)m_swapchain_extent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-  VkRect2D scissor{};
-  scissor.offset = {0, 0};
-  scissor.extent = m_swapchain_extent;
-
-  VkPipelineViewportStateCreateInfo viewportState{};
-  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewportState.viewportCount = 1;
-  viewportState.scissorCount = 1;
-
-  VkPipelineRasterizationStateCreateInfo rasterizer{};
-  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterizer.depthClampEnable = VK_FALSE;
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterizer.lineWidth = 1.0f;
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-  rasterizer.depthBiasEnable = VK_FALSE;
-  rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-  rasterizer.depthBiasClamp = 0.0f;          // Optional
-  rasterizer.depthBiasSlopeFactor = 0.0f;    // Optional
-
-  VkPipelineMultisampleStateCreateInfo multisampling{};
-  multisampling.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-  multisampling.minSampleShading = 1.0f;          // Optional
-  multisampling.pSampleMask = nullptr;            // Optional
-  multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-  multisampling.alphaToOneEnable = VK_FALSE;      // Optional
-
-  VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-  colorBlendAttachment.colorWriteMask =
-      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  colorBlendAttachment.blendEnable = VK_FALSE;
-  colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;  // Optional
-  colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-  colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;             // Optional
-  colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;  // Optional
-  colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-  colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;             // Optional
-  VkPipelineColorBlendStateCreateInfo colorBlending{};
-  colorBlending.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  colorBlending.logicOpEnable = VK_FALSE;
-  colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-  colorBlending.attachmentCount = 1;
-  colorBlending.pAttachments = &colorBlendAttachment;
-  colorBlending.blendConstants[0] = 0.0f; // Optional
-  colorBlending.blendConstants[1] = 0.0f; // Optional
-  colorBlending.blendConstants[2] = 0.0f; // Optional
-  colorBlending.blendConstants[3] = 0.0f; // Optional
+void GPU::initDrawCull() {
+  VkShaderModule cull_comp;
+  vkutil::ShaderReflection reflection;
+  if (!vkutil::loadShaderModule("../../assets/shaders/spv/draw_cull.comp.spv",
+                                m_device, &cull_comp, &reflection)) {
+    LOGE("Failed to load the draw cull shader, draw from CPU.");
+    m_gpu_driven = false;
+    return;
+  }
+  // As for the cluster cull, only the constants have a C++ mirror.
+  if (reflection.push_constants.size != sizeof(DrawCullConstants)) {
+    LOGE("Draw cull shader pushes {} bytes, {} expected.",
+         reflection.push_constants.size, sizeof(DrawCullConstants));
+    vkDestroyShaderModule(m_device, cull_comp, nullptr);
+    m_gpu_driven = false;
+    return;
+  }
+  std::vector<VkDescriptorSetLayoutBinding> bindings =
+      reflection.getSetBindings(0);
+  m_desc_set_layouts.draw_cull = m_layout_cache.getSetLayout(bindings);
+  m_desc_templates.draw_cull.init(m_device, m_desc_set_layouts.draw_cull,
+                                  bindings);
+  m_draw_cull_layout = m_layout_cache.getPipelineLayout(reflection);
+
+  // The pass is skipped until it is ready.
+  m_draw_cull_pipeline = compileComputePipeline(cull_comp, m_draw_cull_layout);
+  m_deletion_queue.push([this, cull_comp]() {
+    vkDestroyPipeline(m_device, m_draw_cull_pipeline.wait(), nullptr);
+    vkDestroyShaderModule(m_device, cull_comp, nullptr);
+    m_desc_templates.draw_cull.destroy(m_device);
+  });
+}
 
+void GPU::initGraphicPipeline() {
+  /// A single-subpass render pass pipeline.
   VkShaderModule triangle_vert{};
+  vkutil::ShaderReflection reflection;
+  // Nothing draws without these, stop here rather than at the first frame.
   if (!vkutil::loadShaderModule("../../assets/shaders/spv/default.vert.spv",
-                                m_device, &triangle_vert))
-    fmt::println("failed loading shader");
+                                m_device, &triangle_vert, &reflection)) {
+    LOGE("Failed to load the default vertex shader.");
+    abort();
+  }
   VkShaderModule triangle_frag{};
+  vkutil::ShaderReflection frag_reflection;
   if (!vkutil::loadShaderModule("../../assets/shaders/spv/default.frag.spv",
-                                m_device, &triangle_frag))
-    fmt::println("failed loading shader");
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-  vertShaderStageInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertShaderStageInfo.module = triangle_vert;
-  vertShaderStageInfo.pName = "main";
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-  fragShaderStageInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragShaderStageInfo.module = triangle_frag;
-  fragShaderStageInfo.pName = "main";
-  VkPipelineShaderStageCreateInfo ci_shader_stages[] = {vertShaderStageInfo,
-                                                        fragShaderStageInfo};
-
-  VkPipelineDepthStencilStateCreateInfo depthStencil{};
-  depthStencil.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-  depthStencil.depthTestEnable = VK_TRUE;
-  depthStencil.depthWriteEnable = VK_TRUE;
+                                m_device, &triangle_frag, &frag_reflection)) {
+    LOGE("Failed to load the default fragment shader.");
+    abort();
+  }
+  if (!reflection.merge(frag_reflection)) {
+    LOGE("Default shaders disagree on their descriptors.");
+    abort();
+  }
+
+  // Set 0 is the bindless table, whose layout carries binding flags
+  // reflection knows nothing of. The rest comes from the shaders.
+  VkDescriptorSetLayout bindless_layout = m_bindless.getLayout();
+  m_pipeline_layout = m_layout_cache.getPipelineLayout(
+      reflection, std::span(&bindless_layout, 1));
+  if (m_pipeline_layout == VK_NULL_HANDLE ||
+      reflection.getSetCount() > 1 ||
+      reflection.push_constants.size != sizeof(DrawConstants)) {
+    LOGE("Default shaders push {} bytes and use {} sets, {} bytes and the "
+         "bindless set expected.",
+         reflection.push_constants.size, reflection.getSetCount(),
+         sizeof(DrawConstants));
+    abort();
+  }
+  m_draw_push_stages = reflection.push_constants.stageFlags;
+  auto v_binding_description = SceneVertexLayout::getBindingDescription();
+  auto v_attribute_descriptions = SceneVertexLayout::kAttributeDescriptions;
+  // Formats may differ, quantized attributes are widened on fetch.
+  for (const auto &input : reflection.inputs) {
+    if (std::none_of(v_attribute_descriptions.begin(),
+                     v_attribute_descriptions.end(),
+                     [&](const auto &attribute) {
+                       return attribute.location == input.location;
+                     })) {
+      LOGE("Vertex layout has no attribute at location {}.", input.location);
+      abort();
+    }
+  }
+
+  PipelineBuilder builder;
+  builder.setShaders(triangle_vert, triangle_frag);
+  builder.setVertexInput(std::span(&v_binding_description, 1),
+                         v_attribute_descriptions);
+  builder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+  builder.setPolygonMode(VK_POLYGON_MODE_FILL);
+  builder.setCullMode(VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+  builder.setMultisamplingNone();
+  builder.disableBlending();
   /// [0, 1] for [near, far].
-  depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-  depthStencil.depthBoundsTestEnable = VK_FALSE;
-  depthStencil.minDepthBounds = 0.0f; // Optional
-  depthStencil.maxDepthBounds = 1.0f; // Optional
-  depthStencil.stencilTestEnable = VK_FALSE;
-  depthStencil.front = {}; // Optional
-  depthStencil.back = {};  // Optional
-
-  VkGraphicsPipelineCreateInfo pipelineInfo{};
-  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
-  pipelineInfo.pStages = ci_shader_stages;
-  pipelineInfo.pVertexInputState = &vertexInputInfo;
-  pipelineInfo.pInputAssemblyState = &inputAssembly;
-  pipelineInfo.pViewportState = &viewportState;
-  pipelineInfo.pRasterizationState = &rasterizer;
-  pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pDepthStencilState = &depthStencil;
-  pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = &dynamicState;
-  pipelineInfo.layout = m_pipeline_layout;
-  pipelineInfo.renderPass = m_render_pass;
-  pipelineInfo.subpass = 0;
-  VK_CHECK(vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                     nullptr, &m_pipeline));
-
-  vkDestroyShaderModule(m_device, triangle_vert, nullptr);
-  vkDestroyShaderModule(m_device, triangle_frag, nullptr);
-  m_deletion_queue.push(
-      [&]() { vkDestroyPipeline(m_device, m_pipeline, nullptr); });
+  builder.enableDepthTest(true, VK_COMPARE_OP_LESS);
+  builder.setRenderPass(m_render_pass, 0);
+  builder.pipeline_layout = m_pipeline_layout;
+  // Frames draw nothing until it is ready, see recordCmdBuffer().
+  m_pipeline = compilePipelines({builder})[0];
+  m_deletion_queue.push([this, triangle_vert, triangle_frag]() {
+    // The compile may still read the modules.
+    vkDestroyPipeline(m_device, m_pipeline.wait(), nullptr);
+    vkDestroyShaderModule(m_device, triangle_vert, nullptr);
+    vkDestroyShaderModule(m_device, triangle_frag, nullptr);
+  });
 }
 
 void GPU::initFrameBuffers() {
+  createFramebuffer();
+  m_deletion_queue.push(
+      [&]() { vkDestroyFramebuffer(m_device, m_framebuffer, nullptr); });
+
+  vkbuffer::BufferBuilder builder;
+  builder = builder.addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+                .setMemoryUsage(VMA_MEMORY_USAGE_CPU_TO_GPU)
+                .setSize(sizeof(SceneData));
+  for (size_t i = 0; i < m_frames.size(); i++) {
+    m_frames[i].scene_data_buffer = builder.build(m_mem_allocator);
+    m_frames[i].scene_data_index =
+        m_bindless.registerBuffer(m_frames[i].scene_data_buffer.buffer);
+  }
+
+  if (m_headless) {
+    // RGBA16F, 8 bytes per texel.
+    size_t readback_size =
+        size_t(m_render_extent.width) * m_render_extent.height * 8;
+    vkbuffer::BufferBuilder readback_builder;
+    readback_builder.addBufferUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+        .setMemoryUsage(VMA_MEMORY_USAGE_GPU_TO_CPU)
+        .setSize(readback_size);
+    for (size_t i = 0; i < m_frames.size(); i++) {
+      m_frames[i].readback_buffer = readback_builder.build(m_mem_allocator);
+    }
+  }
+}
+
+void GPU::createFramebuffer() {
   std::array<VkImageView, 2> attach_views = {m_color_image.view,
                                              m_depth_image.view};
 
@@ -478,32 +806,39 @@ void GPU::initFrameBuffers() {
   ci_framebuffer.renderPass = m_render_pass;
   ci_framebuffer.attachmentCount = static_cast<uint32_t>(attach_views.size());
   ci_framebuffer.pAttachments = attach_views.data();
-  ci_framebuffer.width = m_swapchain_extent.width;
-  ci_framebuffer.height = m_swapchain_extent.height;
+  ci_framebuffer.width = m_target_extent.width;
+  ci_framebuffer.height = m_target_extent.height;
   ci_framebuffer.layers = 1;
 
   VK_CHECK(
       vkCreateFramebuffer(m_device, &ci_framebuffer, nullptr, &m_framebuffer));
-  m_deletion_queue.push(
-      [&]() { vkDestroyFramebuffer(m_device, m_framebuffer, nullptr); });
-
-  vkbuffer::BufferBuilder builder;
-  builder = builder.addBufferUsage(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
-                .setMemoryUsage(VMA_MEMORY_USAGE_CPU_TO_GPU)
-                .setSize(sizeof(SceneData));
-  for (int i = 0; i < kFrameOverlap; i++) {
-    m_frames[i].scene_data_buffer = builder.build(m_mem_allocator);
-  }
 }
 
 void GPU::draw() {
-  VK_CHECK(vkWaitForFences(m_device, 1, &getCurrentFrame().render_fence, true,
-                           VK_ONE_SEC));
+  ProfileScope profile_scope(m_profiler, "GPU::draw");
+  if (m_headless) {
+    drawHeadless();
+    return;
+  }
+  {
+    ProfileScope wait_scope(m_profiler, "GPU::waitFrame");
+    VK_CHECK(vkWaitForFences(m_device, 1, &getCurrentFrame().render_fence,
+                             true, VK_ONE_SEC));
+  }
+  collectGpuScopes(getCurrentFrame());
+  getCurrentFrame().profiled_frame = m_profiler.currentFrame();
   // Free objects dedicated to this frame (in last iteration).
   getCurrentFrame().deletion_queue.flush();
-  getCurrentFrame().descriptor_allocator.clearPools(m_device);
-  VK_CHECK(vkResetFences(m_device, 1, &getCurrentFrame().render_fence));
-
+  collectRetired();
+  getCurrentFrame().descriptor_writer.clear();
+  // Uploads issued since last frame start now.
+  m_uploader.collect();
+  m_uploader.flush();
+
+  // Skip the frame while there is nothing to present to. The fence is still
+  // signaled, so the next try does not block.
+  if (m_swapchain_dirty && !recreateSwapchain())
+    return;
   // Request an image to draw to.
   uint32_t swapchain_img_idx;
   // Will signal the semaphore.
@@ -511,30 +846,58 @@ void GPU::draw() {
                                      getCurrentFrame().swapchain_semaphore,
                                      nullptr, &swapchain_img_idx);
   if (e == VK_ERROR_OUT_OF_DATE_KHR) {
-    LOGE("No impl for swapchain resizing.");
+    // No image acquired, semaphore untouched.
+    m_swapchain_dirty = true;
+    return;
   }
+  // Suboptimal is still presentable, recreate next frame.
+  if (e == VK_SUBOPTIMAL_KHR)
+    m_swapchain_dirty = true;
+  // Only reset once this frame is sure to be submitted.
+  VK_CHECK(vkResetFences(m_device, 1, &getCurrentFrame().render_fence));
 
-  // Clear the cmd buffer.
+  // Clear the cmd buffers.
   VkCommandBuffer cmd = getCurrentFrame().cmd_buffer_main;
   VK_CHECK(vkResetCommandBuffer(cmd, 0));
+  for (auto pool : getCurrentFrame().worker_cmd_pools)
+    VK_CHECK(vkResetCommandPool(m_device, pool, 0));
   // Record cmd. Bit is to tell vulkan buffer is used exactly once.
   VkCommandBufferBeginInfo cmd_begin_info =
       vkinit::cmdBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
-  auto draw_extent = m_swapchain_extent;
+  // Targets keep their size, only the drawn area follows the scale.
+  m_render_extent = m_dynamic_resolution.scaleExtent(m_target_extent);
+  auto draw_extent = m_render_extent;
 
+  prepareCullSets();
   VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
+  uint64_t upload_value = m_uploader.recordAcquires(cmd);
+  uint32_t frame_scope = beginGpuScope(cmd, "frame");
   { // Drawing commands.
     vkimage::transitionImage(cmd, m_color_image.image,
                              VK_IMAGE_LAYOUT_UNDEFINED,
                              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    if (m_cluster_culling) {
+      uint32_t cull_scope = beginGpuScope(cmd, "clusterCull");
+      recordClusterCull(cmd);
+      endGpuScope(cmd, cull_scope);
+    }
+    if (m_gpu_driven) {
+      uint32_t cull_scope = beginGpuScope(cmd, "drawCull");
+      recordDrawCull(cmd);
+      endGpuScope(cmd, cull_scope);
+    }
+    uint32_t draw_scope = beginGpuScope(cmd, "recordCmdBuffer");
     recordCmdBuffer(cmd);
+    endGpuScope(cmd, draw_scope);
+    uint32_t blit_scope = beginGpuScope(cmd, "blit");
     vkimage::transitionImage(cmd, m_color_image.image,
                              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
     vkimage::transitionImage(cmd, m_swapchain_images[swapchain_img_idx],
                              VK_IMAGE_LAYOUT_UNDEFINED,
                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    // Upscales the drawn area if it is smaller than the swapchain.
     vkimage::copyImage(cmd, m_color_image.image,
                        m_swapchain_images[swapchain_img_idx], draw_extent,
                        m_swapchain_extent);
@@ -544,18 +907,26 @@ void GPU::draw() {
     vkimage::transitionImage(cmd, m_swapchain_images[swapchain_img_idx],
                              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
                              VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    endGpuScope(cmd, blit_scope);
   }
+  endGpuScope(cmd, frame_scope);
   VK_CHECK(vkEndCommandBuffer(cmd));
 
   // Submit commands.
   VkCommandBufferSubmitInfo cmd_submit_info = vkinit::cmdBufferSubmitInfo(cmd);
-  VkSemaphoreSubmitInfo wait_info = vkinit::semaphoreSubmitInfo(
-      VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
-      getCurrentFrame().swapchain_semaphore);
+  std::array<VkSemaphoreSubmitInfo, 2> wait_infos = {
+      vkinit::semaphoreSubmitInfo(
+          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+          getCurrentFrame().swapchain_semaphore),
+      vkinit::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                                  m_uploader.getTimeline())};
+  // Only wait for transfer queue if there are new uploads.
+  wait_infos[1].value = upload_value;
   VkSemaphoreSubmitInfo signal_info = vkinit::semaphoreSubmitInfo(
       VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, getCurrentFrame().render_semaphore);
   VkSubmitInfo2 submit_info =
-      vkinit::submitInfo(&cmd_submit_info, &signal_info, &wait_info);
+      vkinit::submitInfo(&cmd_submit_info, &signal_info, wait_infos.data());
+  submit_info.waitSemaphoreInfoCount = upload_value ? 2 : 1;
   VK_CHECK(vkQueueSubmit2(m_graphic_queue, 1, &submit_info,
                           getCurrentFrame().render_fence));
 
@@ -570,21 +941,124 @@ void GPU::draw() {
   present_info.pImageIndices = &swapchain_img_idx;
 
   e = vkQueuePresentKHR(m_graphic_queue, &present_info);
-  if (e == VK_ERROR_OUT_OF_DATE_KHR) {
-    LOGE("No impl for swapchain resizing.");
+  if (e == VK_ERROR_OUT_OF_DATE_KHR || e == VK_SUBOPTIMAL_KHR)
+    m_swapchain_dirty = true;
+
+  m_frame_number++;
+}
+
+void GPU::drawHeadless() {
+  {
+    ProfileScope wait_scope(m_profiler, "GPU::waitFrame");
+    VK_CHECK(vkWaitForFences(m_device, 1, &getCurrentFrame().render_fence,
+                             true, VK_ONE_SEC));
+  }
+  collectGpuScopes(getCurrentFrame());
+  getCurrentFrame().profiled_frame = m_profiler.currentFrame();
+  getCurrentFrame().deletion_queue.flush();
+  collectRetired();
+  getCurrentFrame().descriptor_writer.clear();
+  VK_CHECK(vkResetFences(m_device, 1, &getCurrentFrame().render_fence));
+  m_uploader.collect();
+  m_uploader.flush();
+
+  VkCommandBuffer cmd = getCurrentFrame().cmd_buffer_main;
+  VK_CHECK(vkResetCommandBuffer(cmd, 0));
+  for (auto pool : getCurrentFrame().worker_cmd_pools)
+    VK_CHECK(vkResetCommandPool(m_device, pool, 0));
+  VkCommandBufferBeginInfo cmd_begin_info =
+      vkinit::cmdBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+  prepareCullSets();
+  VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
+  uint64_t upload_value = m_uploader.recordAcquires(cmd);
+  uint32_t frame_scope = beginGpuScope(cmd, "frame");
+  {
+    vkimage::transitionImage(cmd, m_color_image.image,
+                             VK_IMAGE_LAYOUT_UNDEFINED,
+                             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    if (m_cluster_culling) {
+      uint32_t cull_scope = beginGpuScope(cmd, "clusterCull");
+      recordClusterCull(cmd);
+      endGpuScope(cmd, cull_scope);
+    }
+    if (m_gpu_driven) {
+      uint32_t cull_scope = beginGpuScope(cmd, "drawCull");
+      recordDrawCull(cmd);
+      endGpuScope(cmd, cull_scope);
+    }
+    uint32_t draw_scope = beginGpuScope(cmd, "recordCmdBuffer");
+    recordCmdBuffer(cmd);
+    endGpuScope(cmd, draw_scope);
+    uint32_t readback_scope = beginGpuScope(cmd, "readback");
+    vkimage::transitionImage(cmd, m_color_image.image,
+                             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    // Result stays in the frame, picked up by readback().
+    VkBufferImageCopy copy_region = {};
+    copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy_region.imageSubresource.layerCount = 1;
+    copy_region.imageExtent = {m_render_extent.width, m_render_extent.height,
+                               1};
+    vkCmdCopyImageToBuffer(cmd, m_color_image.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           getCurrentFrame().readback_buffer.buffer, 1,
+                           &copy_region);
+    // Made visible to the host reads of readback(), after the fence.
+    vkbuffer::barrier(cmd, getCurrentFrame().readback_buffer.buffer,
+                      VK_PIPELINE_STAGE_2_COPY_BIT,
+                      VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+    endGpuScope(cmd, readback_scope);
   }
+  endGpuScope(cmd, frame_scope);
+  VK_CHECK(vkEndCommandBuffer(cmd));
+
+  // Nothing to acquire or present, the fence is the only sync.
+  VkCommandBufferSubmitInfo cmd_submit_info = vkinit::cmdBufferSubmitInfo(cmd);
+  VkSemaphoreSubmitInfo upload_wait_info = vkinit::semaphoreSubmitInfo(
+      VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_uploader.getTimeline());
+  upload_wait_info.value = upload_value;
+  VkSubmitInfo2 submit_info = vkinit::submitInfo(
+      &cmd_submit_info, nullptr, upload_value ? &upload_wait_info : nullptr);
+  VK_CHECK(vkQueueSubmit2(m_graphic_queue, 1, &submit_info,
+                          getCurrentFrame().render_fence));
 
   m_frame_number++;
 }
 
+bool GPU::readback(std::vector<uint8_t> &out, VkExtent2D &extent) {
+  if (!m_headless) {
+    LOGE("Readback is only supported in headless mode.");
+    return false;
+  }
+  if (m_frame_number == 0) {
+    LOGE("No frame to read back yet.");
+    return false;
+  }
+  FrameData &last_frame = m_frames[(m_frame_number - 1) % m_frames.size()];
+  VK_CHECK(vkWaitForFences(m_device, 1, &last_frame.render_fence, true,
+                           VK_ONE_SEC));
+  AllocatedBuffer &buffer = last_frame.readback_buffer;
+  // Host cache may not be coherent with GPU_TO_CPU memory.
+  vmaInvalidateAllocation(m_mem_allocator, buffer.allocation, 0,
+                          VK_WHOLE_SIZE);
+  size_t size = size_t(m_render_extent.width) * m_render_extent.height * 8;
+  out.resize(size);
+  memcpy(out.data(), buffer.alloc_info.pMappedData, size);
+  extent = m_render_extent;
+  return true;
+}
+
 void GPU::recordCmdBuffer(VkCommandBuffer cmd) {
+  ProfileScope profile_scope(m_profiler, "GPU::recordCmdBuffer");
 
   VkRenderPassBeginInfo bi_render_pass{
       .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
   bi_render_pass.renderPass = m_render_pass;
   bi_render_pass.framebuffer = m_framebuffer;
   bi_render_pass.renderArea.offset = {0, 0};
-  bi_render_pass.renderArea.extent = m_swapchain_extent;
+  bi_render_pass.renderArea.extent = m_render_extent;
 
   std::array<VkClearValue, 2> clear_values{};
   clear_values[0].color = {{0.f, 0.f, 0.f, 1.f}};
@@ -592,147 +1066,731 @@ void GPU::recordCmdBuffer(VkCommandBuffer cmd) {
   bi_render_pass.clearValueCount = static_cast<uint32_t>(clear_values.size());
   bi_render_pass.pClearValues = clear_values.data();
 
-  vkCmdBeginRenderPass(cmd, &bi_render_pass, VK_SUBPASS_CONTENTS_INLINE);
-
-  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
-  {
-    SceneData *scene_uniform_data =
-        (SceneData *)getCurrentFrame()
-            .scene_data_buffer.allocation->GetMappedData();
-    *scene_uniform_data = m_scene_data;
-    VkDescriptorSet frame_ds = getCurrentFrame().descriptor_allocator.allocate(
-        m_device, m_desc_set_layouts.scene_data);
-    DescriptorWriter writer;
-    writer.writeBuffer(0, getCurrentFrame().scene_data_buffer.buffer,
-                       sizeof(SceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.writeImage(1, m_texture.view, m_default_sampler_linear,
-                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.updateDescriptorSet(m_device, frame_ds);
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            m_pipeline_layout, 0, 1, &frame_ds, 0, nullptr);
+  // Draws are recorded in parallel into secondary cmd buffers.
+  vkCmdBeginRenderPass(cmd, &bi_render_pass,
+                       VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+  // Registered in the bindless table once, only the data changes.
+  SceneData *scene_data = (SceneData *)getCurrentFrame()
+                              .scene_data_buffer.allocation->GetMappedData();
+  *scene_data = m_scene_data;
+  // Created with the draws, by uploadScene().
+  if (!m_draw_instances.empty()) {
+    auto *instances = (DrawInstance *)getCurrentFrame()
+                          .draw_instance_buffer.allocation->GetMappedData();
+    std::copy(m_draw_instances.begin(), m_draw_instances.end(), instances);
   }
-  VkBuffer vertex_buffers[] = {m_vertex_buffer.buffer};
-  VkDeviceSize offsets[] = {0};
-  vkCmdBindVertexBuffers(cmd, 0, 1, vertex_buffers, offsets);
-  vkCmdBindIndexBuffer(cmd, m_index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
 
+  // Same for every worker, nothing is drawn while it compiles.
+  m_frame_pipeline = m_pipeline.getOr(VK_NULL_HANDLE);
+  // Even split, each worker records one contiguous range. Culled clusters
+  // and GPU-driven objects are a single indirect draw.
+  bool indirect = m_cluster_culling || m_gpu_driven;
+  if (!indirect)
+    buildDrawList();
+  size_t n_draws = indirect ? 1 : m_draw_list.size();
+  uint32_t n_workers = (uint32_t)std::clamp<size_t>(
+      n_draws / kMinDrawsPerRecordWorker, 1, m_n_record_workers);
+  auto &worker_cmds = getCurrentFrame().worker_cmd_buffers;
+  m_record_pool.parallelFor(n_workers, [&](uint32_t w) {
+    m_worker_draw_stats[w] =
+        recordDraws(worker_cmds[w], n_draws * w / n_workers,
+                    n_draws * (w + 1) / n_workers);
+  });
+  vkCmdExecuteCommands(cmd, n_workers, worker_cmds.data());
+  m_draw_stats = {};
+  for (uint32_t w = 0; w < n_workers; w++)
+    m_draw_stats += m_worker_draw_stats[w];
+  m_draw_stats_total += m_draw_stats;
+  m_n_draw_stats_frames++;
+
+  vkCmdEndRenderPass(cmd);
+}
+
+DrawList::Stats GPU::recordDraws(VkCommandBuffer cmd, size_t begin,
+                                 size_t end) {
+  VkCommandBufferInheritanceInfo inheritance_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+  inheritance_info.renderPass = m_render_pass;
+  inheritance_info.subpass = 0;
+  inheritance_info.framebuffer = m_framebuffer;
+  VkCommandBufferBeginInfo cmd_begin_info = vkinit::cmdBufferBeginInfo(
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+      VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+  cmd_begin_info.pInheritanceInfo = &inheritance_info;
+  VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
+
+  // Secondaries inherit no state, bind everything again.
   VkViewport viewport{};
   viewport.x = 0.0f;
   viewport.y = 0.0f;
-  viewport.width = static_cast<float>(m_swapchain_extent.width);
-  viewport.height = static_cast<float>(m_swapchain_extent.height);
+  viewport.width = static_cast<float>(m_render_extent.width);
+  viewport.height = static_cast<float>(m_render_extent.height);
   viewport.minDepth = 0.0f;
   viewport.maxDepth = 1.0f;
   vkCmdSetViewport(cmd, 0, 1, &viewport);
 
   VkRect2D scissor{};
   scissor.offset = {0, 0};
-  scissor.extent = m_swapchain_extent;
+  scissor.extent = m_render_extent;
   vkCmdSetScissor(cmd, 0, 1, &scissor);
 
-  vkCmdDrawIndexed(cmd, m_num_indices, 1, 0, 0, 0);
+  // Every mesh lives in the geometry arena, one bind for all draws.
+  VkBuffer vertex_buffer = m_geometry.getVertexBuffer();
+  VkDeviceSize vertex_buffer_offset = 0;
+  vkCmdBindVertexBuffers(cmd, 0, 1, &vertex_buffer, &vertex_buffer_offset);
+  FrameData &frame = getCurrentFrame();
+  DrawConstants constants = {frame.scene_data_index, m_texture_index,
+                             m_sampler_linear_index,
+                             frame.draw_instance_index};
+  vkCmdPushConstants(cmd, m_pipeline_layout, m_draw_push_stages, 0,
+                     sizeof(DrawConstants), &constants);
+  if (m_frame_pipeline == VK_NULL_HANDLE) {
+    VK_CHECK(vkEndCommandBuffer(cmd));
+    return {};
+  }
+  if (m_cluster_culling || m_gpu_driven) {
+    // A single indirect draw, its state is bound once.
+    VkDescriptorSet bindless_set = m_bindless.getSet();
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      m_frame_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_pipeline_layout, 0, 1, &bindless_set, 0,
+                            nullptr);
+    DrawList::Stats stats = {0, 1, 1, 1};
+    if (m_cluster_culling) {
+      vkCmdBindIndexBuffer(cmd, frame.cluster_index_buffer.buffer, 0,
+                           VK_INDEX_TYPE_UINT32);
+      // A command per visible draw, each with its own instance.
+      vkCmdDrawIndexedIndirect(cmd, frame.cluster_draw_buffer.buffer, 0,
+                               m_n_visible_draws,
+                               sizeof(VkDrawIndexedIndirectCommand));
+      stats.n_draws = m_n_visible_draws;
+    } else {
+      // A single pipeline, so a single draw whatever the object count.
+      vkCmdBindIndexBuffer(cmd, m_geometry.getIndexBuffer(), 0,
+                           VK_INDEX_TYPE_UINT32);
+      vkCmdDrawIndexedIndirectCount(
+          cmd, frame.draw_command_buffer.buffer, 0,
+          frame.draw_count_buffer.buffer, 0, m_n_draw_objects,
+          sizeof(VkDrawIndexedIndirectCommand));
+      // Draws the cull wrote the last time this frame slot was used, its
+      // fence has been waited for.
+      if (m_frame_number >= m_frames.size()) {
+        vmaInvalidateAllocation(m_mem_allocator,
+                                frame.draw_count_readback.allocation, 0,
+                                VK_WHOLE_SIZE);
+        stats.n_draws =
+            *(uint32_t *)frame.draw_count_readback.alloc_info.pMappedData;
+      }
+    }
+    VK_CHECK(vkEndCommandBuffer(cmd));
+    return stats;
+  }
 
-  vkCmdEndRenderPass(cmd);
+  // Sorted draws, pipelines and sets are bound where they change.
+  DrawList::Stats stats = m_draw_list.record(cmd, begin, end, 0);
+  VK_CHECK(vkEndCommandBuffer(cmd));
+  return stats;
+}
+
+void GPU::buildDrawList() {
+  ProfileScope profile_scope(m_profiler, "GPU::buildDrawList");
+  // Materials differ by bindless indices only, they all share set 0.
+  MaterialPipeline pipeline = {m_frame_pipeline, m_pipeline_layout};
+  GPUMaterialInstance material = {MaterialPass::BaseOpaque, &pipeline,
+                                  m_bindless.getSet()};
+  m_draw_list.clear();
+  for (uint32_t v = 0; v < m_n_visible_draws; v++) {
+    uint32_t i = m_visible_draws[v];
+    m_draw_list.add(material, m_geometry.getIndexBuffer(), m_draw_depths[i],
+                    m_draws[i]);
+  }
+  m_draw_list.sort();
 }
 
-void GPU::uploadScene(const Scene &scene) {
+UploadHandle GPU::uploadScene(const Scene &scene) {
   LOGI("Uploading scene to GPU.");
-  {
-    LOGI("Uploading vertex data.");
-    auto vertices = scene.getVertices();
-    size_t vertices_size = sizeof(vertices[0]) * vertices.size();
-    {
-      vkbuffer::BufferBuilder builder;
-      m_vertex_buffer =
-          builder.setSize(vertices_size)
-              .addBufferUsage(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
-              .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
-              /// TODO Use Buffer Device Address to upload vertices.
-              // .addBufferUsage(VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
-              .setMemoryUsage(VMA_MEMORY_USAGE_GPU_ONLY)
-              .build(m_mem_allocator);
-      // VkBufferDeviceAddressInfo i_device_address{
-      //     .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-      //     .buffer = m_vertex_buffer.buffer,
-      // };
-      // m_vertex_buffer_address =
-      //     vkGetBufferDeviceAddress(m_device, &i_device_address);
+  ProfileScope profile_scope(m_profiler, "GPU::uploadScene");
+  // Encoded by the scene already, uploaded as is.
+  const std::vector<std::byte> &vertices = scene.getVertexData();
+  UploadHandle handle;
+  m_draws.clear();
+  m_draw_submeshes.clear();
+  m_draw_geometry.clear();
+  m_draw_nodes.clear();
+  m_draw_instances.clear();
+  m_n_visible_draws = 0;
+  // Meshes of the former scene go once no frame draws them anymore.
+  for (GeometryArena::Handle mesh : m_submesh_geometry)
+    retire([this, mesh]() {
+      m_geometry.free(mesh);
+      m_geometry_freed = true;
+    });
+  m_submesh_geometry.clear();
+
+  LOGI("Uploading {} submeshes.", scene.getSubmeshes().size());
+  // Each submesh is a mesh of the arena, its levels of detail follow each
+  // other in its index range. Indices become local to its vertices, level
+  // and meshlet ranges local to its index range.
+  std::vector<Submesh> submeshes = scene.getSubmeshes();
+  std::vector<Meshlet> meshlets = scene.getMeshlets();
+  const std::vector<uint32_t> &scene_indices = scene.getIndices();
+  std::vector<uint32_t> indices;
+  for (Submesh &submesh : submeshes) {
+    indices.clear();
+    for (uint32_t l = 0; l < submesh.lod_count; l++) {
+      MeshLod &lod = submesh.lods[l];
+      uint32_t first_index = uint32_t(indices.size());
+      for (uint32_t k = 0; k < lod.index_count; k++) {
+        indices.push_back(scene_indices[lod.first_index + k] -
+                          submesh.first_vertex);
+      }
+      for (uint32_t m = 0; m < lod.meshlet_count; m++) {
+        Meshlet &meshlet = meshlets[lod.first_meshlet + m];
+        meshlet.first_index =
+            meshlet.first_index - lod.first_index + first_index;
+      }
+      lod.first_index = first_index;
     }
-    {
-      AllocatedBuffer staging;
-      vkbuffer::BufferBuilder builder;
-      staging = builder.setSize(vertices_size)
-                    .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
-                    .setMemoryUsage(VMA_MEMORY_USAGE_CPU_ONLY)
-                    .build(m_mem_allocator);
-      void *data = staging.allocation->GetMappedData();
-      memcpy(data, vertices.data(), vertices_size);
-      immediateSubmit([&](VkCommandBuffer cmd) {
-        VkBufferCopy vertex_copy = {};
-        vertex_copy.dstOffset = 0;
-        vertex_copy.srcOffset = 0;
-        vertex_copy.size = vertices_size;
-        vkCmdCopyBuffer(cmd, staging.buffer, m_vertex_buffer.buffer, 1,
-                        &vertex_copy);
-      });
-      staging.destroy();
+    submesh.first_index = submesh.lods[0].first_index;
+    size_t vertex_size =
+        size_t(submesh.vertex_count) * SceneVertexLayout::kStride;
+    GeometryArena::Handle mesh = allocateGeometry(
+        vertex_size, SceneVertexLayout::kStride, uint32_t(indices.size()));
+    if (!mesh.isValid()) {
+      LOGE("Scene does not fit in the geometry arena.");
+      // Nothing drew them yet.
+      for (GeometryArena::Handle allocated : m_submesh_geometry)
+        m_geometry.free(allocated);
+      m_submesh_geometry.clear();
+      return handle;
     }
+    m_submesh_geometry.push_back(mesh);
+    const GeometryArena::Range &range = m_geometry.get(mesh);
+    const std::byte *mesh_vertices =
+        vertices.data() + size_t(submesh.first_vertex) *
+                              SceneVertexLayout::kStride;
+    m_uploader.uploadBuffer(mesh_vertices, vertex_size,
+                            m_geometry.getVertexBuffer(), range.vertex_offset);
+    // Batched with the vertices, submitted together by flush().
+    handle = m_uploader.uploadBuffer(indices.data(),
+                                     sizeof(uint32_t) * indices.size(),
+                                     m_geometry.getIndexBuffer(),
+                                     range.first_index * sizeof(uint32_t));
+    m_geometry_upload = handle;
+  }
+
+  // One draw per mesh instance, following the world transform of its node.
+  for (const MeshInstance &instance : scene.getMeshInstances()) {
+    const Submesh &submesh = submeshes[instance.submesh];
+    uint32_t i = uint32_t(m_draws.size());
+    // Arena offsets are set by updateDrawGeometry().
+    m_draws.push_back({0, submesh.index_count, 0, i});
+    m_draw_submeshes.push_back(submesh);
+    m_draw_geometry.push_back(m_submesh_geometry[instance.submesh]);
+    m_draw_nodes.push_back(instance.node);
+    // Each submesh is quantized to its own box, its draw dequantizes it.
+    VertexQuantization q = getSubmeshQuantization(submesh);
+    m_draw_instances.push_back({glm::mat4(1.f), glm::vec4(q.center, 0.f),
+                                glm::vec4(q.half_extent, 0.f)});
   }
+  uint32_t n_draws = uint32_t(m_draws.size());
+  m_draw_lods.assign(n_draws, 0);
+  m_draw_bounds.resize(n_draws);
+  m_draw_spheres.assign(n_draws, glm::vec4(0.f));
+  m_draw_scales.assign(n_draws, 1.f);
+  // Moved to their node by the next updateScene().
+  m_draw_transform_version = UINT64_MAX;
+  updateDrawGeometry();
   {
-    LOGI("Uploading index data.");
-    auto indices = scene.getIndices();
-    size_t indices_size = sizeof(indices[0]) * indices.size();
-    m_num_indices = indices.size();
-    {
-      vkbuffer::BufferBuilder builder;
-      m_index_buffer = builder.setSize(indices_size)
-                           .addBufferUsage(VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+    // Written every frame, read through the bindless table by every path.
+    size_t instances_size =
+        sizeof(DrawInstance) * std::max<size_t>(n_draws, 1);
+    vkbuffer::BufferBuilder builder;
+    builder = builder.addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+                  .setMemoryUsage(VMA_MEMORY_USAGE_CPU_TO_GPU)
+                  .setSize(instances_size);
+    for (FrameData &frame : m_frames) {
+      frame.draw_instance_buffer = builder.build(m_mem_allocator);
+      frame.draw_instance_index =
+          m_bindless.registerBuffer(frame.draw_instance_buffer.buffer);
+    }
+    m_deletion_queue.push([&]() {
+      for (FrameData &frame : m_frames)
+        frame.draw_instance_buffer.destroy();
+    });
+  }
+  if (m_cluster_culling && meshlets.empty()) {
+    LOGI("No meshlets, draw without cluster culling.");
+    m_cluster_culling = false;
+  }
+  if (m_cluster_culling) {
+    LOGI("Uploading {} meshlets.", meshlets.size());
+    size_t meshlets_size = sizeof(meshlets[0]) * meshlets.size();
+    vkbuffer::BufferBuilder builder;
+    m_meshlet_buffer = builder.setSize(meshlets_size)
+                           .addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
                            .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
                            .setMemoryUsage(VMA_MEMORY_USAGE_GPU_ONLY)
                            .build(m_mem_allocator);
+    handle = m_uploader.uploadBuffer(meshlets.data(), meshlets_size,
+                                     m_meshlet_buffer.buffer);
+    createClusterBuffers();
+  }
+  if (m_gpu_driven && m_draws.empty()) {
+    LOGI("No objects, draw without GPU culling.");
+    m_gpu_driven = false;
+  }
+  if (m_gpu_driven) {
+    LOGI("Uploading {} draw objects.", m_draws.size());
+    // Bounds in mesh space, the shader moves them with each instance.
+    std::vector<DrawObject> objects(m_draws.size());
+    for (size_t i = 0; i < m_draws.size(); i++) {
+      const Submesh &submesh = m_draw_submeshes[i];
+      objects[i].sphere = submesh.bounds;
+      objects[i].lod_count = submesh.lod_count;
+      for (uint32_t l = 0; l < submesh.lod_count; l++) {
+        objects[i].lods[l] = {submesh.lods[l].first_index,
+                              submesh.lods[l].index_count,
+                              submesh.lods[l].error, 0};
+      }
     }
-    {
-      AllocatedBuffer staging;
-      vkbuffer::BufferBuilder builder;
-      staging = builder.setSize(indices_size)
-                    .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
-                    .setMemoryUsage(VMA_MEMORY_USAGE_CPU_ONLY)
-                    .build(m_mem_allocator);
-      void *data = staging.allocation->GetMappedData();
-      memcpy(data, indices.data(), indices_size);
-      immediateSubmit([&](VkCommandBuffer cmd) {
-        VkBufferCopy index_copy = {};
-        index_copy.dstOffset = 0;
-        index_copy.srcOffset = 0;
-        index_copy.size = indices_size;
-        vkCmdCopyBuffer(cmd, staging.buffer, m_index_buffer.buffer, 1,
-                        &index_copy);
-      });
-      staging.destroy();
-    }
+    size_t objects_size = sizeof(DrawObject) * objects.size();
+    vkbuffer::BufferBuilder builder;
+    m_draw_object_buffer =
+        builder.setSize(objects_size)
+            .addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+            .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+            .setMemoryUsage(VMA_MEMORY_USAGE_GPU_ONLY)
+            .build(m_mem_allocator);
+    handle = m_uploader.uploadBuffer(objects.data(), objects_size,
+                                     m_draw_object_buffer.buffer);
+    m_n_draw_objects = uint32_t(objects.size());
+    createDrawCullBuffers(m_n_draw_objects);
+  }
+  m_uploader.flush();
+  m_visible_draws.resize(m_draws.size());
+  m_n_visible_draws = 0;
+  m_draw_depths.assign(m_draws.size(), 0.f);
+  return handle;
+}
+
+void GPU::initGeometry() {
+  m_geometry.init(m_mem_allocator, m_geometry_vertex_capacity,
+                  m_geometry_index_capacity);
+  m_deletion_queue.push([&]() { m_geometry.destroy(); });
+}
+
+GeometryArena::Handle GPU::allocateGeometry(VkDeviceSize vertex_size,
+                                            uint32_t vertex_stride,
+                                            uint32_t index_count) {
+  GeometryArena::Handle handle =
+      m_geometry.allocate(vertex_size, vertex_stride, index_count);
+  if (handle.isValid())
+    return handle;
+  // Packing alone may be enough, otherwise double until it fits.
+  VkDeviceSize vertex_needed =
+      m_geometry.getPackedVertexSize() + vertex_size + vertex_stride;
+  VkDeviceSize index_needed =
+      m_geometry.getPackedIndexSize() +
+      (index_count + GeometryArena::kIndexAlignment) * sizeof(uint32_t);
+  VkDeviceSize vertex_capacity = m_geometry.getVertexCapacity();
+  VkDeviceSize index_capacity = m_geometry.getIndexCapacity();
+  while (vertex_capacity < vertex_needed)
+    vertex_capacity *= 2;
+  while (index_capacity < index_needed)
+    index_capacity *= 2;
+  relocateGeometry(vertex_capacity, index_capacity);
+  return m_geometry.allocate(vertex_size, vertex_stride, index_count);
+}
+
+void GPU::relocateGeometry(VkDeviceSize vertex_capacity,
+                           VkDeviceSize index_capacity) {
+  LOGI("Relocating geometry arena to {} MB vertices, {} MB indices.",
+       vertex_capacity >> 20, index_capacity >> 20);
+  // Copies read what the arena holds now.
+  m_uploader.wait(m_geometry_upload);
+  std::pair<AllocatedBuffer, AllocatedBuffer> old;
+  immediateSubmit(
+      [&](VkCommandBuffer cmd) {
+        // Uploads from a transfer family are owned by the graphic queue
+        // only once acquired, which the next frame would do too late.
+        uint64_t upload_value = m_uploader.recordAcquires(cmd);
+        // Releases recorded after the arena upload must be done as well.
+        if (upload_value != 0)
+          m_uploader.wait({upload_value});
+        old = m_geometry.relocate(cmd, vertex_capacity, index_capacity);
+      },
+      "GPU::relocateGeometry");
+  // Frames in flight may still read the former buffers and bind sets
+  // writing them. Sets are only rewritten by misses once every one of those
+  // frames is done, the next frame slot alone does not cover them.
+  retire([this, old]() mutable {
+    m_descriptor_cache.evict(old.first.buffer);
+    m_descriptor_cache.evict(old.second.buffer);
+    old.first.destroy();
+    old.second.destroy();
+  });
+  updateDrawGeometry();
+}
+
+void GPU::updateDrawGeometry() {
+  for (uint32_t i = 0; i < m_draws.size(); i++) {
+    GeometryArena::Handle mesh = m_draw_geometry[i];
+    m_draw_instances[i].first_index = m_geometry.get(mesh).first_index;
+    m_draw_instances[i].vertex_offset = m_geometry.getVertexOffset(mesh);
+    m_draws[i].index_offset = m_draw_instances[i].first_index +
+                              m_draw_submeshes[i].lods[m_draw_lods[i]]
+                                  .first_index;
+    m_draws[i].vertex_offset = m_draw_instances[i].vertex_offset;
+  }
+}
+
+void GPU::defragmentGeometry() {
+  if (m_geometry.getFragmentation() == 0.f)
+    return;
+  relocateGeometry(m_geometry.getVertexCapacity(),
+                   m_geometry.getIndexCapacity());
+}
+
+void GPU::createClusterBuffers() {
+  // A draw never outputs more than its full detail level.
+  size_t max_indices = 0;
+  for (auto &submesh : m_draw_submeshes)
+    max_indices += submesh.index_count;
+  size_t n_draws = m_draws.size();
+  for (FrameData &frame : m_frames) {
+    vkbuffer::BufferBuilder range_builder;
+    // Zero-sized buffers are invalid, an empty scene still gets one range.
+    frame.cluster_range_buffer =
+        range_builder
+            .setSize(std::max<VkDeviceSize>(sizeof(uint32_t) * 4 * n_draws,
+                                            sizeof(uint32_t) * 4))
+            .addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+            .setMemoryUsage(VMA_MEMORY_USAGE_CPU_TO_GPU)
+            .build(m_mem_allocator);
+    vkbuffer::BufferBuilder index_builder;
+    size_t index_size = sizeof(uint32_t) * std::max<size_t>(max_indices, 1);
+    frame.cluster_index_buffer =
+        index_builder.setSize(index_size)
+            .addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+            .addBufferUsage(VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+            .setMemoryUsage(VMA_MEMORY_USAGE_GPU_ONLY)
+            .build(m_mem_allocator);
+    vkbuffer::BufferBuilder draw_builder;
+    frame.cluster_draw_buffer =
+        draw_builder
+            .setSize(sizeof(VkDrawIndexedIndirectCommand) *
+                     std::max<size_t>(n_draws, 1))
+            .addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+            .addBufferUsage(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+            .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+            .setMemoryUsage(VMA_MEMORY_USAGE_GPU_ONLY)
+            .build(m_mem_allocator);
   }
+  m_deletion_queue.push([&]() {
+    m_meshlet_buffer.destroy();
+    for (FrameData &frame : m_frames) {
+      frame.cluster_range_buffer.destroy();
+      frame.cluster_index_buffer.destroy();
+      frame.cluster_draw_buffer.destroy();
+    }
+  });
+}
 
+void GPU::createDrawCullBuffers(uint32_t n_objects) {
+  for (FrameData &frame : m_frames) {
+    vkbuffer::BufferBuilder command_builder;
+    frame.draw_command_buffer =
+        command_builder
+            .setSize(sizeof(VkDrawIndexedIndirectCommand) * n_objects)
+            .addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+            .addBufferUsage(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+            .setMemoryUsage(VMA_MEMORY_USAGE_GPU_ONLY)
+            .build(m_mem_allocator);
+    vkbuffer::BufferBuilder count_builder;
+    frame.draw_count_buffer =
+        count_builder.setSize(sizeof(uint32_t))
+            .addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+            .addBufferUsage(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+            .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+            .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+            .setMemoryUsage(VMA_MEMORY_USAGE_GPU_ONLY)
+            .build(m_mem_allocator);
+    vkbuffer::BufferBuilder readback_builder;
+    frame.draw_count_readback =
+        readback_builder.setSize(sizeof(uint32_t))
+            .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+            .setMemoryUsage(VMA_MEMORY_USAGE_GPU_TO_CPU)
+            .build(m_mem_allocator);
+  }
   m_deletion_queue.push([&]() {
-    m_vertex_buffer.destroy();
-    m_index_buffer.destroy();
+    m_draw_object_buffer.destroy();
+    for (FrameData &frame : m_frames) {
+      frame.draw_command_buffer.destroy();
+      frame.draw_count_buffer.destroy();
+      frame.draw_count_readback.destroy();
+    }
   });
 }
 
+void GPU::updateDrawCullConstants() {
+  for (int i = 0; i < 6; i++)
+    m_draw_cull_constants.planes[i] = m_frustum.planes[i];
+  // The shader takes the camera to the mesh space of each object, errors
+  // and distances are both in it.
+  m_draw_cull_constants.camera =
+      glm::inverse(m_scene_data.view * m_scene_data.model) *
+      glm::vec4(0.f, 0.f, 0.f, 1.f);
+  m_draw_cull_constants.camera.w =
+      std::abs(m_scene_data.proj[1][1]) * 0.5f * float(m_render_extent.height);
+  m_draw_cull_constants.n_objects = m_n_draw_objects;
+  m_draw_cull_constants.lod_error_pixels = m_lod_error_pixels;
+}
+
+void GPU::prepareCullSets() {
+  FrameData &frame = getCurrentFrame();
+  DescriptorWriter &writer = frame.descriptor_writer;
+  m_cull_sets = {};
+  if (m_cluster_culling) {
+    writer.writeBuffer(0, m_meshlet_buffer.buffer, VK_WHOLE_SIZE, 0,
+                       VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    // The whole arena, meshlet ranges are relative to the range of their
+    // submesh, given by the instance of each draw.
+    writer.writeBuffer(1, m_geometry.getIndexBuffer(), VK_WHOLE_SIZE, 0,
+                       VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.writeBuffer(2, frame.cluster_range_buffer.buffer, VK_WHOLE_SIZE,
+                       0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.writeBuffer(3, frame.cluster_index_buffer.buffer, VK_WHOLE_SIZE,
+                       0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.writeBuffer(4, frame.cluster_draw_buffer.buffer, VK_WHOLE_SIZE, 0,
+                       VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.writeBuffer(5, frame.draw_instance_buffer.buffer, VK_WHOLE_SIZE,
+                       0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    // Written again only when the arena buffers move.
+    m_cull_sets.cluster_cull =
+        m_descriptor_cache.get(m_desc_set_layouts.cluster_cull, writer,
+                               &m_desc_templates.cluster_cull);
+  }
+  if (m_gpu_driven) {
+    writer.writeBuffer(0, m_draw_object_buffer.buffer, VK_WHOLE_SIZE, 0,
+                       VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.writeBuffer(1, frame.draw_command_buffer.buffer, VK_WHOLE_SIZE, 0,
+                       VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.writeBuffer(2, frame.draw_count_buffer.buffer, VK_WHOLE_SIZE, 0,
+                       VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.writeBuffer(3, frame.draw_instance_buffer.buffer, VK_WHOLE_SIZE,
+                       0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    // Same buffers every frame, written once per frame slot.
+    m_cull_sets.draw_cull = m_descriptor_cache.get(
+        m_desc_set_layouts.draw_cull, writer, &m_desc_templates.draw_cull);
+  }
+  // Writes queued by the misses above go in one call. A set must not be
+  // written once a command buffer binds it.
+  writer.flush(m_device);
+}
+
+void GPU::recordDrawCull(VkCommandBuffer cmd) {
+  FrameData &frame = getCurrentFrame();
+  vkCmdFillBuffer(cmd, frame.draw_count_buffer.buffer, 0, sizeof(uint32_t),
+                  0);
+  vkbuffer::barrier(cmd, frame.draw_count_buffer.buffer,
+                    VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                    VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+  VkDescriptorSet cull_ds = m_cull_sets.draw_cull;
+  VkPipeline cull_pipeline = m_draw_cull_pipeline.getOr(VK_NULL_HANDLE);
+  // Out of descriptors or still compiling, the count stays 0 and the frame
+  // draws nothing.
+  if (cull_ds != VK_NULL_HANDLE && cull_pipeline != VK_NULL_HANDLE) {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_draw_cull_layout, 0, 1, &cull_ds, 0, nullptr);
+    vkCmdPushConstants(cmd, m_draw_cull_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(DrawCullConstants), &m_draw_cull_constants);
+    // One thread per object.
+    vkCmdDispatch(cmd, (m_n_draw_objects + 63) / 64, 1, 1);
+  }
+
+  vkbuffer::barrier(cmd, frame.draw_command_buffer.buffer,
+                    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+                    VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+  vkbuffer::barrier(cmd, frame.draw_count_buffer.buffer,
+                    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                        VK_PIPELINE_STAGE_2_COPY_BIT,
+                    VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT |
+                        VK_ACCESS_2_TRANSFER_READ_BIT);
+  // Read on CPU for draw stats, once the frame slot comes back.
+  VkBufferCopy count_copy = {0, 0, sizeof(uint32_t)};
+  vkCmdCopyBuffer(cmd, frame.draw_count_buffer.buffer,
+                  frame.draw_count_readback.buffer, 1, &count_copy);
+  vkbuffer::barrier(cmd, frame.draw_count_readback.buffer,
+                    VK_PIPELINE_STAGE_2_COPY_BIT,
+                    VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+}
+
+void GPU::updateClusterCullConstants() {
+  for (int i = 0; i < 6; i++)
+    m_cluster_cull_constants.planes[i] = m_frustum.planes[i];
+  m_cluster_cull_constants.camera =
+      glm::inverse(m_scene_data.view * m_scene_data.model) *
+      glm::vec4(0.f, 0.f, 0.f, 1.f);
+}
+
+void GPU::recordClusterCull(VkCommandBuffer cmd) {
+  FrameData &frame = getCurrentFrame();
+  auto *ranges =
+      (uint32_t *)frame.cluster_range_buffer.allocation->GetMappedData();
+  // Each draw writes its own span of indices, as long as its level.
+  uint32_t out_first_index = 0;
+  for (uint32_t v = 0; v < m_n_visible_draws; v++) {
+    uint32_t i = m_visible_draws[v];
+    const MeshLod &lod = m_draw_submeshes[i].lods[m_draw_lods[i]];
+    ranges[4 * v] = lod.first_meshlet;
+    ranges[4 * v + 1] = lod.meshlet_count;
+    ranges[4 * v + 2] = out_first_index;
+    ranges[4 * v + 3] = m_draws[i].first_instance;
+    out_first_index += lod.index_count;
+  }
+
+  VkDescriptorSet cull_ds = m_cull_sets.cluster_cull;
+  VkPipeline cull_pipeline = m_cluster_cull_pipeline.getOr(VK_NULL_HANDLE);
+  // Out of descriptors or still compiling, every draw gets 0 indices and
+  // the frame is empty.
+  if (cull_ds == VK_NULL_HANDLE || cull_pipeline == VK_NULL_HANDLE) {
+    vkCmdFillBuffer(cmd, frame.cluster_draw_buffer.buffer, 0, VK_WHOLE_SIZE,
+                    0);
+  } else {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_cluster_cull_layout, 0, 1, &cull_ds, 0,
+                            nullptr);
+    vkCmdPushConstants(cmd, m_cluster_cull_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(ClusterCullConstants),
+                       &m_cluster_cull_constants);
+    // One workgroup per visible draw, each writes its command.
+    vkCmdDispatch(cmd, m_n_visible_draws, 1, 1);
+  }
+
+  vkbuffer::barrier(cmd, frame.cluster_index_buffer.buffer,
+                    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+                    VK_ACCESS_2_INDEX_READ_BIT);
+  vkbuffer::barrier(cmd, frame.cluster_draw_buffer.buffer,
+                    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT |
+                        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+                        VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+                    VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+}
+
 void GPU::updateScene(const Scene &scene) {
   m_scene_data = scene.getSceneData();
+  // Only when nodes moved, static scenes keep their bounds.
+  if (scene.getTransformVersion() != m_draw_transform_version) {
+    m_draw_transform_version = scene.getTransformVersion();
+    updateDrawTransforms(scene.getTransforms());
+  }
+  // World space, as draw bounds.
+  m_frustum = Frustum::fromMatrix(m_scene_data.proj * m_scene_data.view *
+                                  m_scene_data.model);
+  if (m_gpu_driven) {
+    // Culling and LOD selection happen on GPU, nothing per object here.
+    updateDrawCullConstants();
+  } else {
+    cullDraws();
+    selectLods();
+    if (m_cluster_culling)
+      updateClusterCullConstants();
+  }
+}
+
+void GPU::updateDrawTransforms(const TransformHierarchy &transforms) {
+  ProfileScope profile_scope(m_profiler, "GPU::updateDrawTransforms");
+  for (uint32_t i = 0; i < m_draws.size(); i++) {
+    const Submesh &submesh = m_draw_submeshes[i];
+    const glm::mat4 &world = transforms.getWorld(m_draw_nodes[i]);
+    m_draw_instances[i].world = world;
+    glm::vec3 axes[3] = {glm::vec3(world[0]), glm::vec3(world[1]),
+                         glm::vec3(world[2])};
+    float scale = std::max({glm::length(axes[0]), glm::length(axes[1]),
+                            glm::length(axes[2])});
+    glm::vec3 center = world * glm::vec4(glm::vec3(submesh.bounds), 1.f);
+    m_draw_spheres[i] = glm::vec4(center, submesh.bounds.w * scale);
+    m_draw_scales[i] = scale;
+    // Box around the transformed box, from its center and half extent.
+    glm::vec3 box_center = (submesh.aabb_min + submesh.aabb_max) * 0.5f;
+    glm::vec3 box_extent = (submesh.aabb_max - submesh.aabb_min) * 0.5f;
+    glm::vec3 world_center = world * glm::vec4(box_center, 1.f);
+    glm::vec3 world_extent = glm::abs(axes[0]) * box_extent.x +
+                             glm::abs(axes[1]) * box_extent.y +
+                             glm::abs(axes[2]) * box_extent.z;
+    m_draw_bounds.set(i, m_draw_spheres[i], world_center - world_extent,
+                      world_center + world_extent);
+  }
+}
+
+void GPU::cullDraws() {
+  ProfileScope profile_scope(m_profiler, "GPU::cullDraws");
+  if (!m_frustum_culling) {
+    for (uint32_t i = 0; i < m_draws.size(); i++)
+      m_visible_draws[i] = i;
+    m_n_visible_draws = uint32_t(m_draws.size());
+    return;
+  }
+  m_n_visible_draws =
+      m_draw_bounds.cull(m_frustum, m_visible_draws.data(), m_cull_kernel);
+}
+
+void GPU::selectLods() {
+  // Spheres are in world space, errors in the mesh space of each draw.
+  glm::mat4 model_view = m_scene_data.view * m_scene_data.model;
+  float scale = std::max({glm::length(glm::vec3(model_view[0])),
+                          glm::length(glm::vec3(model_view[1])),
+                          glm::length(glm::vec3(model_view[2]))});
+  // World units at distance 1 to pixels.
+  float pixels_per_unit =
+      std::abs(m_scene_data.proj[1][1]) * 0.5f * float(m_render_extent.height);
+  for (uint32_t v = 0; v < m_n_visible_draws; v++) {
+    uint32_t i = m_visible_draws[v];
+    const Submesh &submesh = m_draw_submeshes[i];
+    const glm::vec4 &sphere = m_draw_spheres[i];
+    glm::vec3 center = model_view * glm::vec4(glm::vec3(sphere), 1.f);
+    // The view looks down -z.
+    m_draw_depths[i] = -center.z;
+    float distance = std::max(glm::length(center) - sphere.w * scale, 1e-3f);
+    float unit_error = scale * m_draw_scales[i] * pixels_per_unit / distance;
+    // Errors grow along the chain, keep the last level that fits.
+    uint32_t lod = 0;
+    while (lod + 1 < submesh.lod_count &&
+           submesh.lods[lod + 1].error * unit_error <= m_lod_error_pixels)
+      lod++;
+    m_draw_lods[i] = lod;
+    // Levels are local to the arena range of the submesh.
+    m_draws[i].index_offset =
+        m_draw_instances[i].first_index + submesh.lods[lod].first_index;
+    m_draws[i].index_count = submesh.lods[lod].index_count;
+  }
 }
 
 AllocatedImage GPU::uploadImage(void *data, VkExtent3D size, VkFormat format,
-                                VkImageUsageFlags usage, bool mipmap) {
+                                VkImageUsageFlags usage, bool mipmap,
+                                UploadHandle *handle) {
+  ProfileScope profile_scope(m_profiler, "GPU::uploadImage");
   // Assume R8G8B8A8 format.
   size_t data_size = size.depth * size.width * size.height * 4;
-  vkbuffer::BufferBuilder buffer_builder;
-  AllocatedBuffer upload = buffer_builder.setSize(data_size)
-                               .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
-                               .setMemoryUsage(VMA_MEMORY_USAGE_CPU_TO_GPU)
-                               .build(m_mem_allocator);
-  memcpy(upload.alloc_info.pMappedData, data, data_size);
 
   vkimage::ImageBuilder image_builder;
   AllocatedImage new_image =
@@ -743,32 +1801,10 @@ AllocatedImage GPU::uploadImage(void *data, VkExtent3D size, VkFormat format,
           .setFormat(format)
           .build(m_device, m_mem_allocator, mipmap);
 
-  immediateSubmit([&](VkCommandBuffer cmd) {
-    vkimage::transitionImage(cmd, new_image.image, VK_IMAGE_LAYOUT_UNDEFINED,
-                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    VkBufferImageCopy copy_region = {};
-    copy_region.bufferOffset = 0;
-    copy_region.bufferRowLength = 0;
-    copy_region.bufferImageHeight = 0;
-    copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    copy_region.imageSubresource.mipLevel = 0;
-    copy_region.imageSubresource.baseArrayLayer = 0;
-    copy_region.imageSubresource.layerCount = 1;
-    copy_region.imageExtent = size;
-    vkCmdCopyBufferToImage(cmd, upload.buffer, new_image.image,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
-                           &copy_region);
-    if (mipmap) {
-      vkimage::generateMipmap(
-          cmd, new_image.image,
-          VkExtent2D{new_image.extent.width, new_image.extent.height});
-    } else {
-      vkimage::transitionImage(cmd, new_image.image,
-                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    }
-  });
-  upload.destroy();
+  UploadHandle upload_handle =
+      m_uploader.uploadImage(data, data_size, new_image, mipmap);
+  if (handle)
+    *handle = upload_handle;
   return new_image;
 }
 
@@ -786,6 +1822,7 @@ void GPU::initTextures() {
     m_texture = uploadImage(data, img_size, VK_FORMAT_R8G8B8A8_UNORM,
                             VK_IMAGE_USAGE_SAMPLED_BIT, mipmap);
     stbi_image_free(data);
+    m_texture_index = m_bindless.registerImage(m_texture.view);
   } else {
     LOGE("Error loading texture file.");
   }
@@ -799,6 +1836,9 @@ void GPU::initTextures() {
   ci_sampler.magFilter = VK_FILTER_NEAREST;
   ci_sampler.minFilter = VK_FILTER_NEAREST;
   vkCreateSampler(m_device, &ci_sampler, nullptr, &m_default_sampler_nearest);
+  m_sampler_linear_index = m_bindless.registerSampler(m_default_sampler_linear);
+  m_sampler_nearest_index =
+      m_bindless.registerSampler(m_default_sampler_nearest);
 
   m_deletion_queue.push([&]() {
     m_texture.destroy();
@@ -807,7 +1847,9 @@ void GPU::initTextures() {
   });
 }
 
-void GPU::immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&func) {
+void GPU::immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&func,
+                          const char *name) {
+  ProfileScope profile_scope(m_profiler, name);
   VK_CHECK(vkResetFences(m_device, 1, &m_imm_fence));
   VK_CHECK(vkResetCommandBuffer(m_imm_cmd, 0));
 
@@ -816,7 +1858,15 @@ void GPU::immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&func) {
       vkinit::cmdBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
   VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+  if (m_gpu_timestamps) {
+    vkResetQueryPool(m_device, m_imm_timestamp_pool, 0, 2);
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                         m_imm_timestamp_pool, 0);
+  }
   func(cmd);
+  if (m_gpu_timestamps)
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                         m_imm_timestamp_pool, 1);
 
   VK_CHECK(vkEndCommandBuffer(cmd));
   VkCommandBufferSubmitInfo cmd_info = vkinit::cmdBufferSubmitInfo(cmd);
@@ -826,21 +1876,59 @@ void GPU::immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&func) {
   // imm_fence will now block until the graphic commands finish execution.
   VK_CHECK(vkQueueSubmit2(m_graphic_queue, 1, &submit, m_imm_fence));
   VK_CHECK(vkWaitForFences(m_device, 1, &m_imm_fence, true, VK_ONE_SEC));
+
+  if (m_gpu_timestamps) {
+    uint64_t ticks[2];
+    if (vkGetQueryPoolResults(m_device, m_imm_timestamp_pool, 0, 2,
+                              sizeof(ticks), ticks, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+      m_profiler.addGpuEvents(
+          m_profiler.currentFrame(),
+          {{name, timestampToNs(ticks[0]), timestampToNs(ticks[1])}});
+  }
 }
 
 void GPU::deinit() {
   LOGI("GPU deinit.");
+  if (m_n_draw_stats_frames > 0) {
+    double n_frames = double(m_n_draw_stats_frames);
+    LOGI("Per frame: {:.1f} draws, {:.1f} pipeline, {:.1f} descriptor set "
+         "and {:.1f} index buffer binds.",
+         m_draw_stats_total.n_draws / n_frames,
+         m_draw_stats_total.pipeline_binds / n_frames,
+         m_draw_stats_total.descriptor_binds / n_frames,
+         m_draw_stats_total.index_buffer_binds / n_frames);
+  }
+  DescriptorAllocator::Stats descriptor_stats = getDescriptorAllocatorStats();
+  LOGI("Descriptor pools: {} now, {} at peak, {} created, {} sets total, "
+       "{} retried and {} failed allocations.",
+       descriptor_stats.n_pools, descriptor_stats.peak_pools,
+       descriptor_stats.n_pools_created, descriptor_stats.n_sets_total,
+       descriptor_stats.n_retries, descriptor_stats.n_failed);
+  // Pending copies may target resources destroyed below.
+  m_uploader.flush();
   vkDeviceWaitIdle(m_device);
-  for (uint32_t i = 0; i < kFrameOverlap; i++) {
+  for (size_t i = 0; i < m_frames.size(); i++) {
+    // Frames still in the ring when we stop.
+    collectGpuScopes(m_frames[i]);
     // Cmd buffer is destroyed with pool it comes from.
     vkDestroyCommandPool(m_device, m_frames[i].cmd_pool, nullptr);
+    for (auto pool : m_frames[i].worker_cmd_pools)
+      vkDestroyCommandPool(m_device, pool, nullptr);
     vkDestroyFence(m_device, m_frames[i].render_fence, nullptr);
     vkDestroySemaphore(m_device, m_frames[i].render_semaphore, nullptr);
     vkDestroySemaphore(m_device, m_frames[i].swapchain_semaphore, nullptr);
     m_frames[i].scene_data_buffer.destroy();
+    if (m_headless)
+      m_frames[i].readback_buffer.destroy();
     m_frames[i].deletion_queue.flush();
   }
+  // The device is idle, nothing retired is in use anymore.
+  for (Retired &retired : m_retired)
+    retired.destroy();
+  m_retired.clear();
 
   m_deletion_queue.flush();
+  m_record_pool.deinit();
 }
 } // namespace vrtr
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "GPU/GeometryArena.hpp"
+#include "utils/vk/buffers.hpp"
+
+#include <algorithm>
+
+namespace vrtr {
+void GeometryArena::init(VmaAllocator allocator, VkDeviceSize vertex_capacity,
+                         VkDeviceSize index_capacity) {
+  m_allocator = allocator;
+  createBuffers(vertex_capacity, index_capacity);
+  LOGI("Geometry arena of {} MB vertices, {} MB indices.",
+       vertex_capacity >> 20, index_capacity >> 20);
+}
+
+void GeometryArena::destroy() {
+  Stats stats = getStats();
+  LOGI("Geometry arena: {} meshes, {} / {} vertex bytes, {} / {} indices, "
+       "{} relocations.",
+       stats.n_meshes, stats.vertices.used, stats.vertices.capacity,
+       stats.indices.used, stats.indices.capacity, stats.n_relocations);
+  m_vertex_buffer.destroy();
+  m_index_buffer.destroy();
+}
+
+void GeometryArena::createBuffers(VkDeviceSize vertex_capacity,
+                                  VkDeviceSize index_capacity) {
+  // Storage and transfer source for GPU-driven passes and relocation.
+  vkbuffer::BufferBuilder vertex_builder;
+  m_vertex_buffer = vertex_builder.setSize(vertex_capacity)
+                        .addBufferUsage(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+                        .addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+                        .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+                        .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+                        .setMemoryUsage(VMA_MEMORY_USAGE_GPU_ONLY)
+                        .build(m_allocator);
+  vkbuffer::BufferBuilder index_builder;
+  m_index_buffer = index_builder.setSize(index_capacity)
+                       .addBufferUsage(VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+                       .addBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+                       .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+                       .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+                       .setMemoryUsage(VMA_MEMORY_USAGE_GPU_ONLY)
+                       .build(m_allocator);
+  m_vertex_ranges.init(vertex_capacity);
+  m_index_ranges.init(index_capacity / sizeof(uint32_t));
+}
+
+GeometryArena::Handle GeometryArena::allocate(VkDeviceSize vertex_size,
+                                              uint32_t vertex_stride,
+                                              uint32_t index_count) {
+  // Aligned to the stride, so the offset is a whole vertexOffset.
+  uint64_t vertex_offset = m_vertex_ranges.allocate(vertex_size, vertex_stride);
+  if (vertex_offset == RangeAllocator::kInvalidOffset)
+    return {};
+  uint64_t first_index = m_index_ranges.allocate(index_count, kIndexAlignment);
+  if (first_index == RangeAllocator::kInvalidOffset) {
+    m_vertex_ranges.free(vertex_offset);
+    return {};
+  }
+
+  Handle handle;
+  if (m_free_ids.empty()) {
+    handle.id = uint32_t(m_ranges.size());
+    m_ranges.emplace_back();
+    m_live.push_back(false);
+  } else {
+    handle.id = m_free_ids.back();
+    m_free_ids.pop_back();
+  }
+  m_ranges[handle.id] = {vertex_offset, vertex_size, vertex_stride,
+                         uint32_t(first_index), index_count};
+  m_live[handle.id] = true;
+  return handle;
+}
+
+void GeometryArena::free(Handle handle) {
+  if (!handle.isValid() || !m_live[handle.id])
+    return;
+  m_vertex_ranges.free(m_ranges[handle.id].vertex_offset);
+  m_index_ranges.free(m_ranges[handle.id].first_index);
+  m_live[handle.id] = false;
+  m_free_ids.push_back(handle.id);
+}
+
+VkDeviceSize GeometryArena::getPackedVertexSize() const {
+  // Alignment padding is less than a stride per mesh.
+  VkDeviceSize size = 0;
+  for (uint32_t id = 0; id < m_ranges.size(); id++) {
+    if (m_live[id])
+      size += m_ranges[id].vertex_size + m_ranges[id].vertex_stride;
+  }
+  return size;
+}
+
+VkDeviceSize GeometryArena::getPackedIndexSize() const {
+  VkDeviceSize n_indices = 0;
+  for (uint32_t id = 0; id < m_ranges.size(); id++) {
+    if (m_live[id])
+      n_indices += m_ranges[id].index_count + kIndexAlignment;
+  }
+  return n_indices * sizeof(uint32_t);
+}
+
+float GeometryArena::getFragmentation() const {
+  return std::max(m_vertex_ranges.getFragmentation(),
+                  m_index_ranges.getFragmentation());
+}
+
+GeometryArena::Stats GeometryArena::getStats() const {
+  Stats stats;
+  stats.vertices = m_vertex_ranges.getStats();
+  stats.indices = m_index_ranges.getStats();
+  stats.n_meshes = uint32_t(m_ranges.size() - m_free_ids.size());
+  stats.n_relocations = m_n_relocations;
+  return stats;
+}
+
+std::pair<AllocatedBuffer, AllocatedBuffer>
+GeometryArena::relocate(VkCommandBuffer cmd, VkDeviceSize vertex_capacity,
+                        VkDeviceSize index_capacity) {
+  std::pair<AllocatedBuffer, AllocatedBuffer> old = {m_vertex_buffer,
+                                                     m_index_buffer};
+  createBuffers(vertex_capacity, index_capacity);
+
+  // Packed in their former order, which keeps the copies sequential.
+  std::vector<uint32_t> order;
+  for (uint32_t id = 0; id < m_ranges.size(); id++) {
+    if (m_live[id])
+      order.push_back(id);
+  }
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return m_ranges[a].vertex_offset < m_ranges[b].vertex_offset;
+  });
+  std::vector<VkBufferCopy> vertex_copies;
+  std::vector<VkBufferCopy> index_copies;
+  for (uint32_t id : order) {
+    Range &range = m_ranges[id];
+    uint64_t vertex_offset =
+        m_vertex_ranges.allocate(range.vertex_size, range.vertex_stride);
+    uint64_t first_index =
+        m_index_ranges.allocate(range.index_count, kIndexAlignment);
+    // Capacities below the live size are a caller bug.
+    if (vertex_offset == RangeAllocator::kInvalidOffset ||
+        first_index == RangeAllocator::kInvalidOffset) {
+      LOGE("Geometry arena relocation to {} / {} bytes is too small.",
+           vertex_capacity, index_capacity);
+      abort();
+    }
+    vertex_copies.push_back(
+        {range.vertex_offset, vertex_offset, range.vertex_size});
+    index_copies.push_back({range.first_index * sizeof(uint32_t),
+                            first_index * sizeof(uint32_t),
+                            range.index_count * sizeof(uint32_t)});
+    range.vertex_offset = vertex_offset;
+    range.first_index = uint32_t(first_index);
+  }
+  if (!vertex_copies.empty()) {
+    vkCmdCopyBuffer(cmd, old.first.buffer, m_vertex_buffer.buffer,
+                    uint32_t(vertex_copies.size()), vertex_copies.data());
+    vkCmdCopyBuffer(cmd, old.second.buffer, m_index_buffer.buffer,
+                    uint32_t(index_copies.size()), index_copies.data());
+  }
+  // Later submissions on the queue read the new buffers.
+  vkbuffer::barrier(cmd, m_vertex_buffer.buffer,
+                    VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                    VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                    VK_ACCESS_2_MEMORY_READ_BIT);
+  vkbuffer::barrier(cmd, m_index_buffer.buffer,
+                    VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                    VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                    VK_ACCESS_2_MEMORY_READ_BIT);
+  m_n_relocations++;
+  return old;
+}
+} // namespace vrtr
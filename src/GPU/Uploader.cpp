@@ -0,0 +1,289 @@
+#include "GPU/Uploader.hpp"
+#include "utils/vk/buffers.hpp"
+#include "utils/vk/images.hpp"
+#include "utils/vk/initializers.hpp"
+
+#include <cstring>
+
+namespace vrtr {
+void Uploader::init(VkDevice device, VmaAllocator allocator, VkQueue queue,
+                    uint32_t queue_family, uint32_t graphic_queue_family,
+                    VkDeviceSize staging_capacity) {
+  m_device = device;
+  m_allocator = allocator;
+  m_queue = queue;
+  m_queue_family = queue_family;
+  m_graphic_queue_family = graphic_queue_family;
+  m_dedicated = m_queue_family != m_graphic_queue_family;
+
+  VkSemaphoreTypeCreateInfo ci_type = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+  ci_type.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  ci_type.initialValue = 0;
+  VkSemaphoreCreateInfo ci_semaphore = vkinit::semaphoreCreateInfo();
+  ci_semaphore.pNext = &ci_type;
+  VK_CHECK(vkCreateSemaphore(m_device, &ci_semaphore, nullptr, &m_timeline));
+  m_staging.init(m_allocator, staging_capacity);
+}
+
+void Uploader::deinit() {
+  flush();
+  wait(UploadHandle{m_next_value - 1});
+  collect();
+  for (auto &batch : m_free)
+    vkDestroyCommandPool(m_device, batch.cmd_pool, nullptr);
+  m_free.clear();
+  Stats stats = getStats();
+  LOGI("Uploader: {} uploads, {} bytes, {} batches, {} fallbacks, peak "
+       "staging {}/{} bytes.",
+       stats.n_uploads, stats.n_bytes, stats.n_batches, stats.n_fallbacks,
+       stats.ring.peak_in_use, stats.ring.capacity);
+  m_staging.destroy();
+  vkDestroySemaphore(m_device, m_timeline, nullptr);
+}
+
+Uploader::Batch &Uploader::getOpenBatch() {
+  if (m_has_open_batch)
+    return m_open_batch;
+  collect();
+  if (!m_free.empty()) {
+    m_open_batch = std::move(m_free.back());
+    m_free.pop_back();
+  } else {
+    VkCommandPoolCreateInfo ci_cmd_pool = vkinit::cmdPoolCreateInfo(
+        m_queue_family, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+    VK_CHECK(vkCreateCommandPool(m_device, &ci_cmd_pool, nullptr,
+                                 &m_open_batch.cmd_pool));
+    VkCommandBufferAllocateInfo cmd_alloc_info =
+        vkinit::cmdBufferAllocInfo(m_open_batch.cmd_pool, 1);
+    VK_CHECK(vkAllocateCommandBuffers(m_device, &cmd_alloc_info,
+                                      &m_open_batch.cmd));
+  }
+  m_open_batch.value = m_next_value++;
+  VkCommandBufferBeginInfo cmd_begin_info =
+      vkinit::cmdBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  VK_CHECK(vkBeginCommandBuffer(m_open_batch.cmd, &cmd_begin_info));
+  m_has_open_batch = true;
+  return m_open_batch;
+}
+
+StagingRing::Region Uploader::stage(const void *data, size_t size) {
+  Batch &batch = getOpenBatch();
+  m_stats.n_uploads++;
+  m_stats.n_bytes += size;
+  StagingRing::Region region;
+  bool fit = m_staging.allocate(size, kStagingAlignment, batch.value, region);
+  if (!fit && size <= m_staging.getCapacity()) {
+    // Ring is full of in-flight data, reclaim what is done and retry.
+    collect();
+    fit = m_staging.allocate(size, kStagingAlignment, batch.value, region);
+  }
+  if (!fit) {
+    // Never block on the ring, take a one-off buffer instead.
+    m_stats.n_fallbacks++;
+    vkbuffer::BufferBuilder builder;
+    AllocatedBuffer staging =
+        builder.setSize(size)
+            .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+            .setMemoryUsage(VMA_MEMORY_USAGE_CPU_ONLY)
+            .build(m_allocator);
+    batch.staging.push_back(staging);
+    region.buffer = staging.buffer;
+    region.offset = 0;
+    region.mapped = staging.alloc_info.pMappedData;
+  }
+  memcpy(region.mapped, data, size);
+  return region;
+}
+
+Uploader::Stats Uploader::getStats() const {
+  Stats stats = m_stats;
+  stats.ring = m_staging.getStats();
+  return stats;
+}
+
+UploadHandle Uploader::uploadBuffer(const void *data, size_t size,
+                                    VkBuffer dst, VkDeviceSize dst_offset) {
+  StagingRing::Region staging = stage(data, size);
+  Batch &batch = getOpenBatch();
+  VkBufferCopy copy_region = {};
+  copy_region.srcOffset = staging.offset;
+  copy_region.dstOffset = dst_offset;
+  copy_region.size = size;
+  vkCmdCopyBuffer(batch.cmd, staging.buffer, dst, 1, &copy_region);
+
+  if (m_dedicated) {
+    VkBufferMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2};
+    barrier.srcQueueFamilyIndex = m_queue_family;
+    barrier.dstQueueFamilyIndex = m_graphic_queue_family;
+    barrier.buffer = dst;
+    barrier.offset = dst_offset;
+    barrier.size = size;
+    // Release half, the dst scope is ignored.
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    m_buffer_releases.push_back(barrier);
+    // Acquire half, the src scope is ignored.
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.srcAccessMask = VK_ACCESS_2_NONE;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+    m_open_buffer_acquires.push_back(barrier);
+  }
+  return UploadHandle{batch.value};
+}
+
+UploadHandle Uploader::uploadImage(const void *data, size_t size,
+                                   const AllocatedImage &dst, bool mipmap) {
+  StagingRing::Region staging = stage(data, size);
+  Batch &batch = getOpenBatch();
+  vkimage::transitionImage(batch.cmd, dst.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  VkBufferImageCopy copy_region = {};
+  copy_region.bufferOffset = staging.offset;
+  copy_region.bufferRowLength = 0;
+  copy_region.bufferImageHeight = 0;
+  copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  copy_region.imageSubresource.mipLevel = 0;
+  copy_region.imageSubresource.baseArrayLayer = 0;
+  copy_region.imageSubresource.layerCount = 1;
+  copy_region.imageExtent = dst.extent;
+  vkCmdCopyBufferToImage(batch.cmd, staging.buffer, dst.image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                         &copy_region);
+
+  if (!m_dedicated) {
+    // Graphic queue, finish it right here.
+    if (mipmap)
+      vkimage::generateMipmap(batch.cmd, dst.image,
+                              VkExtent2D{dst.extent.width, dst.extent.height});
+    else
+      vkimage::transitionImage(batch.cmd, dst.image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    return UploadHandle{batch.value};
+  }
+
+  VkImageMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+  barrier.srcQueueFamilyIndex = m_queue_family;
+  barrier.dstQueueFamilyIndex = m_graphic_queue_family;
+  barrier.image = dst.image;
+  barrier.subresourceRange =
+      vkinit::imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+  // Layout transition must match on both halves.
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = mipmap ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+                             : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+  barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  m_image_releases.push_back(barrier);
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+  barrier.srcAccessMask = VK_ACCESS_2_NONE;
+  barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+  m_open_image_acquires.push_back(ImageAcquire{
+      .barrier = barrier, .extent = dst.extent, .mipmap = mipmap});
+  return UploadHandle{batch.value};
+}
+
+void Uploader::flush() {
+  if (!m_has_open_batch)
+    return;
+  Batch &batch = m_open_batch;
+  if (!m_buffer_releases.empty() || !m_image_releases.empty()) {
+    VkDependencyInfo dep_info = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dep_info.bufferMemoryBarrierCount = (uint32_t)m_buffer_releases.size();
+    dep_info.pBufferMemoryBarriers = m_buffer_releases.data();
+    dep_info.imageMemoryBarrierCount = (uint32_t)m_image_releases.size();
+    dep_info.pImageMemoryBarriers = m_image_releases.data();
+    vkCmdPipelineBarrier2(batch.cmd, &dep_info);
+    m_buffer_releases.clear();
+    m_image_releases.clear();
+  }
+  VK_CHECK(vkEndCommandBuffer(batch.cmd));
+
+  VkCommandBufferSubmitInfo cmd_info = vkinit::cmdBufferSubmitInfo(batch.cmd);
+  VkSemaphoreSubmitInfo signal_info = vkinit::semaphoreSubmitInfo(
+      VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_timeline);
+  signal_info.value = batch.value;
+  VkSubmitInfo2 submit = vkinit::submitInfo(&cmd_info, &signal_info, nullptr);
+  VK_CHECK(vkQueueSubmit2(m_queue, 1, &submit, VK_NULL_HANDLE));
+
+  m_unwaited_value = batch.value;
+  m_stats.n_batches++;
+  m_buffer_acquires.insert(m_buffer_acquires.end(),
+                           m_open_buffer_acquires.begin(),
+                           m_open_buffer_acquires.end());
+  m_image_acquires.insert(m_image_acquires.end(),
+                          m_open_image_acquires.begin(),
+                          m_open_image_acquires.end());
+  m_open_buffer_acquires.clear();
+  m_open_image_acquires.clear();
+  m_submitted.push_back(std::move(batch));
+  m_has_open_batch = false;
+}
+
+bool Uploader::isDone(UploadHandle handle) const {
+  uint64_t value = 0;
+  VK_CHECK(vkGetSemaphoreCounterValue(m_device, m_timeline, &value));
+  return value >= handle.value;
+}
+
+void Uploader::wait(UploadHandle handle) {
+  if (m_has_open_batch && handle.value >= m_open_batch.value)
+    flush();
+  VkSemaphoreWaitInfo wait_info = {.sType =
+                                       VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+  wait_info.semaphoreCount = 1;
+  wait_info.pSemaphores = &m_timeline;
+  wait_info.pValues = &handle.value;
+  VK_CHECK(vkWaitSemaphores(m_device, &wait_info, UINT64_MAX));
+}
+
+void Uploader::collect() {
+  uint64_t done_value = 0;
+  VK_CHECK(vkGetSemaphoreCounterValue(m_device, m_timeline, &done_value));
+  m_staging.retire(done_value);
+  while (!m_submitted.empty() && m_submitted.front().value <= done_value) {
+    Batch batch = std::move(m_submitted.front());
+    m_submitted.pop_front();
+    for (auto &staging : batch.staging)
+      staging.destroy();
+    batch.staging.clear();
+    VK_CHECK(vkResetCommandPool(m_device, batch.cmd_pool, 0));
+    m_free.push_back(std::move(batch));
+    m_stats.n_retired_batches++;
+  }
+}
+
+uint64_t Uploader::recordAcquires(VkCommandBuffer cmd) {
+  if (m_unwaited_value == 0)
+    return 0;
+  if (!m_buffer_acquires.empty() || !m_image_acquires.empty()) {
+    std::vector<VkImageMemoryBarrier2> image_barriers;
+    image_barriers.reserve(m_image_acquires.size());
+    for (auto &acquire : m_image_acquires)
+      image_barriers.push_back(acquire.barrier);
+    VkDependencyInfo dep_info = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dep_info.bufferMemoryBarrierCount = (uint32_t)m_buffer_acquires.size();
+    dep_info.pBufferMemoryBarriers = m_buffer_acquires.data();
+    dep_info.imageMemoryBarrierCount = (uint32_t)image_barriers.size();
+    dep_info.pImageMemoryBarriers = image_barriers.data();
+    vkCmdPipelineBarrier2(cmd, &dep_info);
+    for (auto &acquire : m_image_acquires) {
+      if (acquire.mipmap)
+        vkimage::generateMipmap(
+            cmd, acquire.barrier.image,
+            VkExtent2D{acquire.extent.width, acquire.extent.height});
+    }
+    m_buffer_acquires.clear();
+    m_image_acquires.clear();
+  }
+  uint64_t value = m_unwaited_value;
+  m_unwaited_value = 0;
+  return value;
+}
+} // namespace vrtr
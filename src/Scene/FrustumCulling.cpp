@@ -0,0 +1,310 @@
+#include "Scene/FrustumCulling.hpp"
+#include "utils/log.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <glm/gtc/matrix_transform.hpp>
+#include <random>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VRTR_CULL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC emits any intrinsic, dispatch is up to the caller.
+#define VRTR_TARGET_AVX2
+#else
+#define VRTR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace vrtr {
+namespace {
+/// A plane and the box corner furthest along its normal, per object.
+struct CullPlane {
+  float x, y, z, w;
+  const float *corner_x;
+  const float *corner_y;
+  const float *corner_z;
+};
+
+struct CullInput {
+  uint32_t size;
+  const float *center_x;
+  const float *center_y;
+  const float *center_z;
+  const float *radius;
+  CullPlane planes[6];
+};
+
+/// Write objects of the set bits of mask, lane i is object base + i.
+inline uint32_t appendVisible(uint32_t mask, uint32_t base, uint32_t *visible,
+                              uint32_t n_visible) {
+  while (mask) {
+    visible[n_visible++] = base + uint32_t(std::countr_zero(mask));
+    mask &= mask - 1;
+  }
+  return n_visible;
+}
+
+uint32_t cullScalar(const CullInput &in, uint32_t *visible) {
+  uint32_t n_visible = 0;
+  for (uint32_t i = 0; i < in.size; i++) {
+    bool inside = true;
+    for (const CullPlane &plane : in.planes) {
+      float distance = plane.x * in.center_x[i] + plane.y * in.center_y[i] +
+                       plane.z * in.center_z[i] + plane.w;
+      float corner = plane.x * plane.corner_x[i] +
+                     plane.y * plane.corner_y[i] +
+                     plane.z * plane.corner_z[i] + plane.w;
+      inside &= distance + in.radius[i] >= 0.f && corner >= 0.f;
+    }
+    // Branchless, the slot is overwritten if the object is culled.
+    visible[n_visible] = i;
+    n_visible += inside;
+  }
+  return n_visible;
+}
+
+#ifdef VRTR_CULL_X86
+uint32_t cullSse(const CullInput &in, uint32_t *visible) {
+  __m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+  for (int p = 0; p < 6; p++) {
+    plane_x[p] = _mm_set1_ps(in.planes[p].x);
+    plane_y[p] = _mm_set1_ps(in.planes[p].y);
+    plane_z[p] = _mm_set1_ps(in.planes[p].z);
+    plane_w[p] = _mm_set1_ps(in.planes[p].w);
+  }
+  const __m128 zero = _mm_setzero_ps();
+  uint32_t n_visible = 0;
+  for (uint32_t i = 0; i < in.size; i += 4) {
+    __m128 center_x = _mm_loadu_ps(in.center_x + i);
+    __m128 center_y = _mm_loadu_ps(in.center_y + i);
+    __m128 center_z = _mm_loadu_ps(in.center_z + i);
+    __m128 radius = _mm_loadu_ps(in.radius + i);
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      const CullPlane &plane = in.planes[p];
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(plane_x[p], center_x),
+                     _mm_mul_ps(plane_y[p], center_y)),
+          _mm_add_ps(_mm_mul_ps(plane_z[p], center_z), plane_w[p]));
+      inside = _mm_and_ps(
+          inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+      __m128 corner = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(plane_x[p], _mm_loadu_ps(plane.corner_x + i)),
+                     _mm_mul_ps(plane_y[p], _mm_loadu_ps(plane.corner_y + i))),
+          _mm_add_ps(_mm_mul_ps(plane_z[p], _mm_loadu_ps(plane.corner_z + i)),
+                     plane_w[p]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(corner, zero));
+    }
+    uint32_t mask = uint32_t(_mm_movemask_ps(inside));
+    // Lanes past the end read padding.
+    if (in.size - i < 4)
+      mask &= (1u << (in.size - i)) - 1;
+    n_visible = appendVisible(mask, i, visible, n_visible);
+  }
+  return n_visible;
+}
+
+VRTR_TARGET_AVX2 uint32_t cullAvx2(const CullInput &in, uint32_t *visible) {
+  __m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+  for (int p = 0; p < 6; p++) {
+    plane_x[p] = _mm256_set1_ps(in.planes[p].x);
+    plane_y[p] = _mm256_set1_ps(in.planes[p].y);
+    plane_z[p] = _mm256_set1_ps(in.planes[p].z);
+    plane_w[p] = _mm256_set1_ps(in.planes[p].w);
+  }
+  const __m256 zero = _mm256_setzero_ps();
+  uint32_t n_visible = 0;
+  for (uint32_t i = 0; i < in.size; i += 8) {
+    __m256 center_x = _mm256_loadu_ps(in.center_x + i);
+    __m256 center_y = _mm256_loadu_ps(in.center_y + i);
+    __m256 center_z = _mm256_loadu_ps(in.center_z + i);
+    __m256 radius = _mm256_loadu_ps(in.radius + i);
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      const CullPlane &plane = in.planes[p];
+      __m256 distance = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(plane_x[p], center_x),
+                        _mm256_mul_ps(plane_y[p], center_y)),
+          _mm256_add_ps(_mm256_mul_ps(plane_z[p], center_z), plane_w[p]));
+      inside = _mm256_and_ps(
+          inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero,
+                                _CMP_GE_OQ));
+      __m256 corner = _mm256_add_ps(
+          _mm256_add_ps(
+              _mm256_mul_ps(plane_x[p], _mm256_loadu_ps(plane.corner_x + i)),
+              _mm256_mul_ps(plane_y[p], _mm256_loadu_ps(plane.corner_y + i))),
+          _mm256_add_ps(
+              _mm256_mul_ps(plane_z[p], _mm256_loadu_ps(plane.corner_z + i)),
+              plane_w[p]));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(corner, zero, _CMP_GE_OQ));
+    }
+    uint32_t mask = uint32_t(_mm256_movemask_ps(inside));
+    if (in.size - i < 8)
+      mask &= (1u << (in.size - i)) - 1;
+    n_visible = appendVisible(mask, i, visible, n_visible);
+  }
+  return n_visible;
+}
+
+bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  // AVX state must also be enabled by the OS.
+  __cpuid(info, 1);
+  bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+  if (!os_avx || (_xgetbv(0) & 6) != 6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return info[1] & (1 << 5);
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+} // namespace
+
+Frustum Frustum::fromMatrix(const glm::mat4 &matrix) {
+  glm::mat4 rows = glm::transpose(matrix);
+  Frustum frustum;
+  frustum.planes[0] = rows[3] + rows[0];
+  frustum.planes[1] = rows[3] - rows[0];
+  frustum.planes[2] = rows[3] + rows[1];
+  frustum.planes[3] = rows[3] - rows[1];
+  frustum.planes[4] = rows[2];
+  frustum.planes[5] = rows[3] - rows[2];
+  for (glm::vec4 &plane : frustum.planes)
+    plane /= glm::length(glm::vec3(plane));
+  return frustum;
+}
+
+CullKernel getBestCullKernel() {
+#ifdef VRTR_CULL_X86
+  static const CullKernel kernel =
+      cpuHasAvx2() ? CullKernel::Avx2 : CullKernel::Sse;
+  return kernel;
+#else
+  return CullKernel::Scalar;
+#endif
+}
+
+const char *getCullKernelName(CullKernel kernel) {
+  switch (kernel) {
+  case CullKernel::Sse:
+    return "SSE";
+  case CullKernel::Avx2:
+    return "AVX2";
+  default:
+    return "scalar";
+  }
+}
+
+void CullBounds::resize(uint32_t n_objects) {
+  m_size = n_objects;
+  size_t padded = (n_objects + kBatch - 1) / kBatch * kBatch;
+  for (std::vector<float> *component :
+       {&m_center_x, &m_center_y, &m_center_z, &m_radius, &m_min_x, &m_min_y,
+        &m_min_z, &m_max_x, &m_max_y, &m_max_z})
+    component->resize(padded, 0.f);
+}
+
+void CullBounds::set(uint32_t object, const glm::vec4 &sphere,
+                     const glm::vec3 &aabb_min, const glm::vec3 &aabb_max) {
+  m_center_x[object] = sphere.x;
+  m_center_y[object] = sphere.y;
+  m_center_z[object] = sphere.z;
+  m_radius[object] = sphere.w;
+  m_min_x[object] = aabb_min.x;
+  m_min_y[object] = aabb_min.y;
+  m_min_z[object] = aabb_min.z;
+  m_max_x[object] = aabb_max.x;
+  m_max_y[object] = aabb_max.y;
+  m_max_z[object] = aabb_max.z;
+}
+
+uint32_t CullBounds::cull(const Frustum &frustum, uint32_t *visible,
+                          CullKernel kernel) const {
+  if (m_size == 0)
+    return 0;
+  CullInput in;
+  in.size = m_size;
+  in.center_x = m_center_x.data();
+  in.center_y = m_center_y.data();
+  in.center_z = m_center_z.data();
+  in.radius = m_radius.data();
+  // Corners are picked once per plane instead of per object.
+  for (int p = 0; p < 6; p++) {
+    const glm::vec4 &plane = frustum.planes[p];
+    in.planes[p] = {plane.x,
+                    plane.y,
+                    plane.z,
+                    plane.w,
+                    plane.x >= 0.f ? m_max_x.data() : m_min_x.data(),
+                    plane.y >= 0.f ? m_max_y.data() : m_min_y.data(),
+                    plane.z >= 0.f ? m_max_z.data() : m_min_z.data()};
+  }
+  switch (kernel) {
+#ifdef VRTR_CULL_X86
+  case CullKernel::Avx2:
+    return cullAvx2(in, visible);
+  case CullKernel::Sse:
+    return cullSse(in, visible);
+#endif
+  default:
+    return cullScalar(in, visible);
+  }
+}
+
+void benchmarkCulling(uint32_t n_objects) {
+  constexpr int kRepeats = 20;
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> position(-10.f, 10.f);
+  std::uniform_real_distribution<float> size(0.05f, 0.5f);
+  CullBounds bounds;
+  bounds.resize(n_objects);
+  for (uint32_t i = 0; i < n_objects; i++) {
+    glm::vec3 center(position(rng), position(rng), position(rng));
+    glm::vec3 extent(size(rng), size(rng), size(rng));
+    bounds.set(i, glm::vec4(center, glm::length(extent)), center - extent,
+               center + extent);
+  }
+  Frustum frustum = Frustum::fromMatrix(
+      glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 30.f) *
+      glm::lookAt(glm::vec3(0.f, 0.f, 12.f), glm::vec3(0.f),
+                  glm::vec3(0.f, 1.f, 0.f)));
+
+  std::vector<uint32_t> visible(n_objects);
+  uint32_t n_reference = bounds.cull(frustum, visible.data(),
+                                     CullKernel::Scalar);
+  std::vector<CullKernel> kernels = {CullKernel::Scalar};
+#ifdef VRTR_CULL_X86
+  kernels.push_back(CullKernel::Sse);
+  if (getBestCullKernel() == CullKernel::Avx2)
+    kernels.push_back(CullKernel::Avx2);
+#endif
+  for (CullKernel kernel : kernels) {
+    // Best of several runs, the first one also warms the caches.
+    double best_ns = 1e30;
+    uint32_t n_visible = 0;
+    for (int r = 0; r < kRepeats; r++) {
+      auto begin = std::chrono::steady_clock::now();
+      n_visible = bounds.cull(frustum, visible.data(), kernel);
+      std::chrono::duration<double, std::nano> elapsed =
+          std::chrono::steady_clock::now() - begin;
+      best_ns = std::min(best_ns, elapsed.count());
+    }
+    if (n_visible != n_reference)
+      LOGE("{} culling kept {} objects, scalar kept {}.",
+           getCullKernelName(kernel), n_visible, n_reference);
+    LOGI("{} culling: {:.2f} objects/ns, {} of {} visible in {:.3f} ms.",
+         getCullKernelName(kernel), double(n_objects) / best_ns, n_visible,
+         n_objects, best_ns * 1e-6);
+  }
+}
+} // namespace vrtr
@@ -0,0 +1,662 @@
+#include "Scene/MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_set>
+
+namespace vrtr {
+namespace {
+/// FIFO cache keyed by a global timestamp, no per-vertex list to shift.
+class FifoCache {
+public:
+  FifoCache(size_t n_vertices, uint32_t cache_size)
+      : m_size(cache_size), m_time(cache_size + 1),
+        m_timestamps(n_vertices, 0) {}
+  /// @return True if the vertex has to be transformed.
+  bool touch(uint32_t v) {
+    if (m_time - m_timestamps[v] <= m_size)
+      return false;
+    m_timestamps[v] = m_time++;
+    return true;
+  }
+  void reset() { m_time += m_size + 1; }
+
+private:
+  uint32_t m_size;
+  uint32_t m_time;
+  std::vector<uint32_t> m_timestamps;
+};
+
+/// Triangles around each vertex, in compressed rows.
+struct TriangleAdjacency {
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> triangles;
+
+  TriangleAdjacency(const uint32_t *indices, size_t n_indices,
+                    size_t n_vertices)
+      : offsets(n_vertices + 1, 0), triangles(n_indices) {
+    for (size_t i = 0; i < n_indices; i++)
+      offsets[indices[i] + 1]++;
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < n_indices; i++)
+      triangles[fill[indices[i]]++] = uint32_t(i / 3);
+  }
+  uint32_t count(uint32_t v) const { return offsets[v + 1] - offsets[v]; }
+};
+
+/// Sum of squared distances to weighted planes, Garland and Heckbert 1997.
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+  double b0 = 0, b1 = 0, b2 = 0, c = 0;
+  double weight = 0;
+
+  void addPlane(const double n[3], double d, double w) {
+    a00 += w * n[0] * n[0];
+    a01 += w * n[0] * n[1];
+    a02 += w * n[0] * n[2];
+    a11 += w * n[1] * n[1];
+    a12 += w * n[1] * n[2];
+    a22 += w * n[2] * n[2];
+    b0 += w * n[0] * d;
+    b1 += w * n[1] * d;
+    b2 += w * n[2] * d;
+    c += w * d * d;
+    weight += w;
+  }
+  void add(const Quadric &q) {
+    a00 += q.a00;
+    a01 += q.a01;
+    a02 += q.a02;
+    a11 += q.a11;
+    a12 += q.a12;
+    a22 += q.a22;
+    b0 += q.b0;
+    b1 += q.b1;
+    b2 += q.b2;
+    c += q.c;
+    weight += q.weight;
+  }
+  /// @return Mean squared distance of p to the planes.
+  double eval(const float *p) const {
+    double x = p[0], y = p[1], z = p[2];
+    double r = a00 * x * x + a11 * y * y + a22 * z * z +
+               2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+               2 * (b0 * x + b1 * y + b2 * z) + c;
+    return weight > 0 ? std::abs(r) / weight : 0;
+  }
+};
+
+void triangleNormal(const float *a, const float *b, const float *c,
+                    double n[3]) {
+  double e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  double e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+/// Vertices grouped by position. Seams split one position into vertices
+/// that differ in UVs or normals, a collapse moves them together.
+struct PositionGroups {
+  std::vector<uint32_t> group;   ///< Group of each vertex.
+  std::vector<uint32_t> offsets; ///< Rows of vertices, one per group.
+  std::vector<uint32_t> vertices;
+
+  PositionGroups(const float *positions, size_t stride, size_t n_vertices)
+      : group(n_vertices), vertices(n_vertices) {
+    std::iota(vertices.begin(), vertices.end(), 0);
+    auto less = [&](uint32_t a, uint32_t b) {
+      return std::lexicographical_compare(positions + a * stride,
+                                          positions + a * stride + 3,
+                                          positions + b * stride,
+                                          positions + b * stride + 3);
+    };
+    std::sort(vertices.begin(), vertices.end(), less);
+    for (size_t i = 0; i < n_vertices; i++) {
+      if (i == 0 || less(vertices[i - 1], vertices[i]))
+        offsets.push_back(uint32_t(i));
+      group[vertices[i]] = uint32_t(offsets.size() - 1);
+    }
+    offsets.push_back(uint32_t(n_vertices));
+  }
+  size_t size() const { return offsets.size() - 1; }
+};
+
+/// Positions on an open border of the mesh welded by position, a collapse
+/// must not move them. Seams are closed once welded.
+std::vector<bool> findBorderGroups(const uint32_t *indices, size_t n_indices,
+                                   const PositionGroups &groups) {
+  std::vector<bool> border(groups.size(), false);
+  std::unordered_set<uint64_t> edges;
+  edges.reserve(n_indices);
+  auto key = [](uint32_t a, uint32_t b) { return uint64_t(a) << 32 | b; };
+  for (size_t i = 0; i < n_indices; i += 3) {
+    for (int e = 0; e < 3; e++) {
+      edges.insert(key(groups.group[indices[i + e]],
+                       groups.group[indices[i + (e + 1) % 3]]));
+    }
+  }
+  for (size_t i = 0; i < n_indices; i += 3) {
+    for (int e = 0; e < 3; e++) {
+      uint32_t a = groups.group[indices[i + e]];
+      uint32_t b = groups.group[indices[i + (e + 1) % 3]];
+      if (a != b && !edges.count(key(b, a)))
+        border[a] = border[b] = true;
+    }
+  }
+  return border;
+}
+} // namespace
+
+VertexCacheStats analyzeVertexCache(const uint32_t *indices, size_t n_indices,
+                                    size_t n_vertices, uint32_t cache_size) {
+  VertexCacheStats stats;
+  if (n_indices < 3)
+    return stats;
+  FifoCache cache(n_vertices, cache_size);
+  std::vector<bool> used(n_vertices, false);
+  size_t misses = 0;
+  size_t n_used = 0;
+  for (size_t i = 0; i < n_indices; i++) {
+    misses += cache.touch(indices[i]);
+    if (!used[indices[i]]) {
+      used[indices[i]] = true;
+      n_used++;
+    }
+  }
+  stats.acmr = float(misses) / float(n_indices / 3);
+  stats.atvr = float(misses) / float(n_used);
+  return stats;
+}
+
+void optimizeVertexCache(uint32_t *indices, size_t n_indices,
+                         size_t n_vertices, uint32_t cache_size) {
+  size_t n_triangles = n_indices / 3;
+  if (n_triangles == 0)
+    return;
+  TriangleAdjacency adjacency(indices, n_indices, n_vertices);
+  std::vector<uint32_t> live(n_vertices);
+  for (uint32_t v = 0; v < n_vertices; v++)
+    live[v] = adjacency.count(v);
+  std::vector<uint32_t> cache_time(n_vertices, 0);
+  std::vector<bool> emitted(n_triangles, false);
+  std::vector<uint32_t> dead_end;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> result;
+  result.reserve(n_indices);
+  uint32_t time = cache_size + 1;
+  uint32_t cursor = 0;
+
+  int64_t fanning = indices[0];
+  while (fanning >= 0) {
+    uint32_t f = uint32_t(fanning);
+    candidates.clear();
+    // Emit every remaining triangle around the fanning vertex.
+    for (uint32_t k = adjacency.offsets[f]; k < adjacency.offsets[f + 1];
+         k++) {
+      uint32_t t = adjacency.triangles[k];
+      if (emitted[t])
+        continue;
+      for (uint32_t c = 0; c < 3; c++) {
+        uint32_t v = indices[3 * t + c];
+        result.push_back(v);
+        dead_end.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - cache_time[v] > cache_size)
+          cache_time[v] = time++;
+      }
+      emitted[t] = true;
+    }
+
+    // Next fanning vertex: the oldest one still in cache after its own
+    // triangles are emitted.
+    fanning = -1;
+    int64_t best_priority = -1;
+    for (uint32_t v : candidates) {
+      if (live[v] == 0)
+        continue;
+      int64_t priority = 0;
+      if (time - cache_time[v] + 2 * live[v] <= cache_size)
+        priority = time - cache_time[v];
+      if (priority > best_priority) {
+        best_priority = priority;
+        fanning = v;
+      }
+    }
+    if (fanning >= 0)
+      continue;
+    // Dead end, back off to recent vertices, then scan in index order.
+    while (!dead_end.empty()) {
+      uint32_t v = dead_end.back();
+      dead_end.pop_back();
+      if (live[v] > 0) {
+        fanning = v;
+        break;
+      }
+    }
+    while (fanning < 0 && cursor < n_vertices) {
+      if (live[cursor] > 0)
+        fanning = cursor;
+      cursor++;
+    }
+  }
+  std::copy(result.begin(), result.end(), indices);
+}
+
+void optimizeOverdraw(uint32_t *indices, size_t n_indices,
+                      const float *positions, size_t stride,
+                      size_t n_vertices, float threshold) {
+  size_t n_triangles = n_indices / 3;
+  if (n_triangles == 0)
+    return;
+
+  // Hard boundaries: the cache starts cold, every vertex is a miss.
+  FifoCache cache(n_vertices, kVertexCacheSize);
+  std::vector<uint32_t> misses(n_triangles);
+  std::vector<uint32_t> hard;
+  for (size_t t = 0; t < n_triangles; t++) {
+    misses[t] = cache.touch(indices[3 * t]) + cache.touch(indices[3 * t + 1]) +
+                cache.touch(indices[3 * t + 2]);
+    if (t == 0 || misses[t] == 3)
+      hard.push_back(uint32_t(t));
+  }
+  hard.push_back(uint32_t(n_triangles));
+
+  // Soft boundaries: split a hard cluster as soon as the part so far is as
+  // cache friendly as the whole, within threshold.
+  std::vector<uint32_t> clusters;
+  for (size_t h = 0; h + 1 < hard.size(); h++) {
+    uint32_t begin = hard[h];
+    uint32_t end = hard[h + 1];
+    uint32_t hard_misses = 0;
+    for (uint32_t t = begin; t < end; t++)
+      hard_misses += misses[t];
+    float hard_acmr = float(hard_misses) / float(end - begin);
+    cache.reset();
+    uint32_t soft_begin = begin;
+    uint32_t soft_misses = 0;
+    for (uint32_t t = begin; t < end; t++) {
+      soft_misses += cache.touch(indices[3 * t]) +
+                     cache.touch(indices[3 * t + 1]) +
+                     cache.touch(indices[3 * t + 2]);
+      if (float(soft_misses) / float(t + 1 - soft_begin) <=
+          hard_acmr * threshold) {
+        clusters.push_back(soft_begin);
+        soft_begin = t + 1;
+        soft_misses = 0;
+        cache.reset();
+      }
+    }
+    if (soft_begin < end)
+      clusters.push_back(soft_begin);
+  }
+  clusters.push_back(uint32_t(n_triangles));
+
+  auto position = [&](uint32_t v) { return positions + v * stride; };
+  // Mesh centroid, area weighted.
+  double mesh_center[3] = {0, 0, 0};
+  double mesh_area = 0;
+  std::vector<float> triangle_normals(3 * n_triangles);
+  std::vector<float> triangle_centers(3 * n_triangles);
+  std::vector<float> triangle_areas(n_triangles);
+  for (size_t t = 0; t < n_triangles; t++) {
+    const float *a = position(indices[3 * t]);
+    const float *b = position(indices[3 * t + 1]);
+    const float *c = position(indices[3 * t + 2]);
+    float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float *n = &triangle_normals[3 * t];
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    triangle_areas[t] = area;
+    for (int k = 0; k < 3; k++) {
+      triangle_centers[3 * t + k] = (a[k] + b[k] + c[k]) / 3.f;
+      mesh_center[k] += triangle_centers[3 * t + k] * area;
+    }
+    mesh_area += area;
+  }
+  for (int k = 0; k < 3; k++)
+    mesh_center[k] = mesh_area > 0 ? mesh_center[k] / mesh_area : 0;
+
+  // Clusters far out along their own normal occlude the rest, draw first.
+  size_t n_clusters = clusters.size() - 1;
+  std::vector<float> sort_keys(n_clusters);
+  for (size_t i = 0; i < n_clusters; i++) {
+    float center[3] = {0, 0, 0};
+    float normal[3] = {0, 0, 0};
+    float area = 0;
+    for (uint32_t t = clusters[i]; t < clusters[i + 1]; t++) {
+      for (int k = 0; k < 3; k++) {
+        center[k] += triangle_centers[3 * t + k] * triangle_areas[t];
+        normal[k] += triangle_normals[3 * t + k];
+      }
+      area += triangle_areas[t];
+    }
+    float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
+                             normal[2] * normal[2]);
+    float key = 0;
+    for (int k = 0; k < 3; k++) {
+      float c = area > 0 ? center[k] / area : 0;
+      float n = length > 0 ? normal[k] / length : 0;
+      key += (c - float(mesh_center[k])) * n;
+    }
+    sort_keys[i] = key;
+  }
+  std::vector<uint32_t> order(n_clusters);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return sort_keys[a] > sort_keys[b];
+  });
+
+  std::vector<uint32_t> result;
+  result.reserve(n_indices);
+  for (uint32_t i : order) {
+    result.insert(result.end(), indices + 3 * clusters[i],
+                  indices + 3 * clusters[i + 1]);
+  }
+  std::copy(result.begin(), result.end(), indices);
+}
+
+std::vector<uint32_t> optimizeVertexFetchRemap(uint32_t *indices,
+                                               size_t n_indices,
+                                               size_t n_vertices) {
+  std::vector<uint32_t> remap(n_vertices, UINT32_MAX);
+  uint32_t next = 0;
+  for (size_t i = 0; i < n_indices; i++) {
+    uint32_t &target = remap[indices[i]];
+    if (target == UINT32_MAX)
+      target = next++;
+    indices[i] = target;
+  }
+  for (auto &target : remap) {
+    if (target == UINT32_MAX)
+      target = next++;
+  }
+  return remap;
+}
+
+namespace {
+/// Sphere around the vertices and cone around the triangle normals, so
+/// a cluster facing away from the camera is rejected as a whole.
+void computeMeshletBounds(Meshlet &meshlet, const uint32_t *indices,
+                          const float *positions, size_t stride) {
+  auto position = [&](uint32_t v) { return positions + v * stride; };
+  const uint32_t *tris = indices + meshlet.first_index;
+  float min[3], max[3];
+  for (int k = 0; k < 3; k++)
+    min[k] = max[k] = position(tris[0])[k];
+  for (uint32_t i = 1; i < meshlet.index_count; i++) {
+    for (int k = 0; k < 3; k++) {
+      min[k] = std::min(min[k], position(tris[i])[k]);
+      max[k] = std::max(max[k], position(tris[i])[k]);
+    }
+  }
+  float radius2 = 0;
+  for (int k = 0; k < 3; k++)
+    meshlet.center[k] = (min[k] + max[k]) * 0.5f;
+  for (uint32_t i = 0; i < meshlet.index_count; i++) {
+    const float *p = position(tris[i]);
+    float d[3] = {p[0] - meshlet.center[0], p[1] - meshlet.center[1],
+                  p[2] - meshlet.center[2]};
+    radius2 = std::max(radius2, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  }
+  meshlet.radius = std::sqrt(radius2);
+
+  std::vector<double> normals;
+  double axis[3] = {0, 0, 0};
+  for (uint32_t i = 0; i < meshlet.index_count; i += 3) {
+    double n[3];
+    triangleNormal(position(tris[i]), position(tris[i + 1]),
+                   position(tris[i + 2]), n);
+    double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0)
+      continue;
+    for (int k = 0; k < 3; k++) {
+      normals.push_back(n[k] / length);
+      axis[k] += n[k] / length;
+    }
+  }
+  double length =
+      std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  double min_dot = 1;
+  for (size_t i = 0; i < normals.size() && length > 0; i += 3) {
+    double dot = (normals[i] * axis[0] + normals[i + 1] * axis[1] +
+                  normals[i + 2] * axis[2]) /
+                 length;
+    min_dot = std::min(min_dot, dot);
+  }
+  for (int k = 0; k < 3; k++)
+    meshlet.cone_axis[k] = length > 0 ? float(axis[k] / length) : 0.f;
+  // Past 90 degrees some triangle faces any view, keep the cluster.
+  meshlet.cone_cutoff =
+      length > 0 && min_dot > 0 ? float(std::sqrt(1 - min_dot * min_dot))
+                                : 1.f;
+}
+} // namespace
+
+std::vector<Meshlet> buildMeshlets(const uint32_t *indices, size_t n_indices,
+                                   const float *positions, size_t stride,
+                                   size_t n_vertices) {
+  std::vector<Meshlet> meshlets;
+  // Meshlet a vertex was last counted in, so it is counted once.
+  std::vector<uint32_t> owner(n_vertices, UINT32_MAX);
+  Meshlet current = {};
+  auto finish = [&]() {
+    if (current.index_count == 0)
+      return;
+    computeMeshletBounds(current, indices, positions, stride);
+    meshlets.push_back(current);
+    current = {};
+  };
+  for (size_t i = 0; i + 3 <= n_indices; i += 3) {
+    uint32_t id = uint32_t(meshlets.size());
+    uint32_t new_vertices = 0;
+    for (int c = 0; c < 3; c++)
+      new_vertices += owner[indices[i + c]] != id;
+    if (current.vertex_count + new_vertices > kMeshletMaxVertices ||
+        current.index_count / 3 == kMeshletMaxTriangles) {
+      finish();
+      id = uint32_t(meshlets.size());
+    }
+    if (current.index_count == 0)
+      current.first_index = uint32_t(i);
+    for (int c = 0; c < 3; c++) {
+      if (owner[indices[i + c]] != id) {
+        owner[indices[i + c]] = id;
+        current.vertex_count++;
+      }
+    }
+    current.index_count += 3;
+  }
+  finish();
+  return meshlets;
+}
+
+std::vector<uint32_t> simplifyMesh(const uint32_t *indices, size_t n_indices,
+                                   const float *positions, size_t stride,
+                                   size_t n_vertices, size_t target_index_count,
+                                   float target_error, float *result_error) {
+  std::vector<uint32_t> result(indices, indices + n_indices / 3 * 3);
+  auto position = [&](uint32_t v) { return positions + v * stride; };
+  PositionGroups groups(positions, stride, n_vertices);
+  const std::vector<uint32_t> &group = groups.group;
+  std::vector<bool> locked =
+      findBorderGroups(result.data(), result.size(), groups);
+
+  // Area weighted planes of the triangles around each position.
+  std::vector<Quadric> quadrics(groups.size());
+  for (size_t i = 0; i < result.size(); i += 3) {
+    const float *a = position(result[i]);
+    double n[3];
+    triangleNormal(a, position(result[i + 1]), position(result[i + 2]), n);
+    double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0)
+      continue;
+    for (int k = 0; k < 3; k++)
+      n[k] /= length;
+    double d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+    for (int k = 0; k < 3; k++)
+      quadrics[group[result[i + k]]].addPlane(n, d, length * 0.5);
+  }
+
+  struct Collapse {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+  };
+  double max_cost = double(target_error) * target_error;
+  double reached_cost = 0;
+  std::vector<Collapse> best(groups.size());
+  std::vector<Collapse> candidates;
+  std::vector<uint32_t> collapse_to(n_vertices);
+  std::vector<bool> touched(groups.size());
+  std::vector<uint32_t> n_used(groups.size());
+
+  while (result.size() > target_index_count) {
+    TriangleAdjacency adjacency(result.data(), result.size(), n_vertices);
+    auto hasEdge = [&](uint32_t a, uint32_t b) {
+      for (uint32_t k = adjacency.offsets[a]; k < adjacency.offsets[a + 1];
+           k++) {
+        const uint32_t *tri = &result[3 * adjacency.triangles[k]];
+        for (int c = 0; c < 3; c++) {
+          if (tri[c] == a && tri[(c + 1) % 3] == b)
+            return true;
+        }
+      }
+      return false;
+    };
+    // A position is on a seam while more than one of its vertices is used.
+    std::fill(n_used.begin(), n_used.end(), 0);
+    for (uint32_t v = 0; v < n_vertices; v++)
+      n_used[group[v]] += adjacency.count(v) > 0;
+
+    // Cheapest collapse of every free position along one of its edges.
+    // Seam positions only slide along the seam onto another seam position,
+    // so the vertices on each side keep their own attributes.
+    for (auto &collapse : best)
+      collapse.cost = -1;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int e = 0; e < 3; e++) {
+        uint32_t a = result[i + e];
+        uint32_t b = result[i + (e + 1) % 3];
+        bool seam = n_used[group[a]] > 1 && n_used[group[b]] > 1 &&
+                    !hasEdge(b, a);
+        for (auto [from, to] : {std::pair{a, b}, std::pair{b, a}}) {
+          uint32_t g = group[from];
+          if (locked[g] || g == group[to] || (n_used[g] > 1 && !seam))
+            continue;
+          double cost = quadrics[g].eval(position(to));
+          if (best[g].cost < 0 || cost < best[g].cost)
+            best[g] = {cost, from, to};
+        }
+      }
+    }
+    candidates.clear();
+    for (auto &collapse : best) {
+      if (collapse.cost >= 0 && collapse.cost <= max_cost)
+        candidates.push_back(collapse);
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Collapse &a, const Collapse &b) {
+                return a.cost < b.cost;
+              });
+
+    // Independent collapses: triangles around a collapsed position are left
+    // alone for the rest of the pass, so flip tests stay valid.
+    std::iota(collapse_to.begin(), collapse_to.end(), 0);
+    std::fill(touched.begin(), touched.end(), false);
+    size_t n_triangles = result.size() / 3;
+    size_t target_triangles = target_index_count / 3;
+    size_t n_collapses = 0;
+    for (const Collapse &collapse : candidates) {
+      if (n_triangles <= target_triangles)
+        break;
+      uint32_t from_group = group[collapse.from];
+      uint32_t to_group = group[collapse.to];
+      if (touched[from_group] || touched[to_group])
+        continue;
+      // Every used vertex at the position moves onto a vertex at the target
+      // that it shares an edge with, one that has the same attributes.
+      uint32_t copies_begin = groups.offsets[from_group];
+      uint32_t copies_end = groups.offsets[from_group + 1];
+      bool valid = true;
+      uint32_t n_removed = 0;
+      for (uint32_t i = copies_begin; i < copies_end && valid; i++) {
+        uint32_t from = groups.vertices[i];
+        if (adjacency.count(from) == 0)
+          continue;
+        uint32_t to = from;
+        for (uint32_t k = adjacency.offsets[from];
+             k < adjacency.offsets[from + 1] && valid; k++) {
+          const uint32_t *tri = &result[3 * adjacency.triangles[k]];
+          bool removed = false;
+          for (int c = 0; c < 3; c++) {
+            if (group[tri[c]] == to_group) {
+              to = tri[c];
+              removed = true;
+            }
+          }
+          if (removed) {
+            n_removed++;
+            continue;
+          }
+          const float *before[3], *after[3];
+          for (int c = 0; c < 3; c++) {
+            before[c] = position(tri[c]);
+            after[c] = tri[c] == from ? position(collapse.to)
+                                      : position(tri[c]);
+          }
+          double n0[3], n1[3];
+          triangleNormal(before[0], before[1], before[2], n0);
+          triangleNormal(after[0], after[1], after[2], n1);
+          valid = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] > 0;
+        }
+        valid = valid && to != from;
+        collapse_to[from] = to;
+      }
+      if (!valid) {
+        for (uint32_t i = copies_begin; i < copies_end; i++)
+          collapse_to[groups.vertices[i]] = groups.vertices[i];
+        continue;
+      }
+      for (uint32_t i = copies_begin; i < copies_end; i++) {
+        uint32_t from = groups.vertices[i];
+        for (uint32_t k = adjacency.offsets[from];
+             k < adjacency.offsets[from + 1]; k++) {
+          const uint32_t *tri = &result[3 * adjacency.triangles[k]];
+          for (int c = 0; c < 3; c++)
+            touched[group[tri[c]]] = true;
+        }
+      }
+      quadrics[to_group].add(quadrics[from_group]);
+      reached_cost = std::max(reached_cost, collapse.cost);
+      n_triangles -= n_removed;
+      n_collapses++;
+    }
+    if (n_collapses == 0)
+      break;
+
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      uint32_t a = collapse_to[result[i]];
+      uint32_t b = collapse_to[result[i + 1]];
+      uint32_t c = collapse_to[result[i + 2]];
+      if (group[a] == group[b] || group[b] == group[c] ||
+          group[c] == group[a])
+        continue;
+      result[write++] = a;
+      result[write++] = b;
+      result[write++] = c;
+    }
+    result.resize(write);
+  }
+  if (result_error)
+    *result_error = float(std::sqrt(reached_cost));
+  return result;
+}
+} // namespace vrtr
@@ -0,0 +1,606 @@
+#include "Scene/Scene.hpp"
+#include "Scene/MeshOptimizer.hpp"
+#include "Scene/VertexLayout.hpp"
+#include "utils/MappedFile.hpp"
+#include "utils/ThreadPool.hpp"
+#include "utils/log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fastgltf/core.hpp>
+#include <fastgltf/glm_element_traits.hpp>
+#include <fastgltf/tools.hpp>
+
+namespace vrtr {
+namespace {
+/// Each LOD level aims at this fraction of the previous indices.
+constexpr float kLodReduction = 0.5f;
+/// The chain ends when a level keeps more than this fraction.
+constexpr float kLodMinReduction = 0.85f;
+/// Largest deviation of the coarsest level, relative to the bounds radius.
+constexpr float kLodMaxError = 0.25f;
+
+/// A triangle primitive and where its data goes in the scene arrays.
+struct PrimitiveJob {
+  const fastgltf::Primitive *primitive;
+  uint32_t first_vertex;
+  uint32_t vertex_count;
+  uint32_t first_index;
+  uint32_t index_count;
+};
+
+/// glTF nodes as children of a root node, node n at index n + 1.
+void collectNodes(const fastgltf::Asset &asset, std::vector<uint32_t> &parents,
+                  std::vector<glm::mat4> &locals,
+                  std::vector<uint32_t> &node_meshes) {
+  size_t n_nodes = asset.nodes.size() + 1;
+  parents.assign(n_nodes, Scene::kRootNode);
+  parents[Scene::kRootNode] = TransformHierarchy::kNoParent;
+  locals.assign(n_nodes, glm::mat4(1.f));
+  node_meshes.assign(n_nodes, Scene::kNoMesh);
+  for (size_t node = 0; node < asset.nodes.size(); node++) {
+    const fastgltf::Node &gltf_node = asset.nodes[node];
+    for (size_t child : gltf_node.children) {
+      if (child < asset.nodes.size())
+        parents[child + 1] = uint32_t(node + 1);
+    }
+    fastgltf::math::fmat4x4 matrix = fastgltf::getTransformMatrix(gltf_node);
+    for (int c = 0; c < 4; c++) {
+      for (int r = 0; r < 4; r++)
+        locals[node + 1][c][r] = matrix[c][r];
+    }
+    if (gltf_node.meshIndex.has_value())
+      node_meshes[node + 1] = uint32_t(*gltf_node.meshIndex);
+  }
+}
+
+/// Whether every element the accessor reads lies inside its buffer views,
+/// sparse ones included. Views are checked against their buffers before.
+bool accessorFits(const fastgltf::Asset &asset,
+                  const fastgltf::Accessor &accessor) {
+  size_t element_size =
+      fastgltf::getElementByteSize(accessor.type, accessor.componentType);
+  auto fits = [&](size_t view_index, size_t offset, size_t count,
+                  size_t size) {
+    if (view_index >= asset.bufferViews.size())
+      return false;
+    const fastgltf::BufferView &view = asset.bufferViews[view_index];
+    size_t stride = std::max<size_t>(view.byteStride.value_or(size), 1);
+    if (offset > view.byteLength)
+      return false;
+    if (count == 0)
+      return true;
+    // (count - 1) * stride + size bytes, without overflow.
+    size_t available = view.byteLength - offset;
+    return size <= available && count - 1 <= (available - size) / stride;
+  };
+  if (accessor.bufferViewIndex.has_value() &&
+      !fits(*accessor.bufferViewIndex, accessor.byteOffset, accessor.count,
+            element_size))
+    return false;
+  if (accessor.sparse.has_value()) {
+    const fastgltf::SparseAccessor &sparse = *accessor.sparse;
+    size_t index_size = fastgltf::getElementByteSize(
+        fastgltf::AccessorType::Scalar, sparse.indexComponentType);
+    return fits(sparse.indicesBufferView, sparse.indicesByteOffset,
+                sparse.count, index_size) &&
+           fits(sparse.valuesBufferView, sparse.valuesByteOffset,
+                sparse.count, element_size);
+  }
+  return true;
+}
+
+/// Accessors decodePrimitive() reads are in bounds, of the type it expects
+/// and as long as the positions.
+bool checkPrimitive(const fastgltf::Asset &asset,
+                    const fastgltf::Primitive &primitive) {
+  auto position = primitive.findAttribute("POSITION");
+  if (position->accessorIndex >= asset.accessors.size())
+    return false;
+  size_t n_vertices = asset.accessors[position->accessorIndex].count;
+  if (n_vertices == 0)
+    return false;
+  auto check = [&](const fastgltf::Accessor &accessor,
+                   std::initializer_list<fastgltf::AccessorType> types) {
+    return std::find(types.begin(), types.end(), accessor.type) !=
+               types.end() &&
+           accessorFits(asset, accessor);
+  };
+  auto checkAttribute =
+      [&](const char *name,
+          std::initializer_list<fastgltf::AccessorType> types) {
+        auto it = primitive.findAttribute(name);
+        if (it == primitive.attributes.end())
+          return true;
+        if (it->accessorIndex >= asset.accessors.size())
+          return false;
+        const fastgltf::Accessor &accessor = asset.accessors[it->accessorIndex];
+        return accessor.count == n_vertices && check(accessor, types);
+      };
+  using Type = fastgltf::AccessorType;
+  if (!checkAttribute("POSITION", {Type::Vec3}) ||
+      !checkAttribute("NORMAL", {Type::Vec3}) ||
+      !checkAttribute("TEXCOORD_0", {Type::Vec2}) ||
+      !checkAttribute("COLOR_0", {Type::Vec3, Type::Vec4}))
+    return false;
+  if (!primitive.indicesAccessor.has_value())
+    return true;
+  return *primitive.indicesAccessor < asset.accessors.size() &&
+         check(asset.accessors[*primitive.indicesAccessor], {Type::Scalar});
+}
+
+/// Reads accessors straight from mapped buffers.
+struct MappedBufferAdapter {
+  const std::vector<const std::byte *> &buffer_data;
+  fastgltf::span<const std::byte> operator()(const fastgltf::Asset &asset,
+                                             size_t buffer_view) const {
+    auto &view = asset.bufferViews[buffer_view];
+    return {buffer_data[view.bufferIndex] + view.byteOffset, view.byteLength};
+  }
+};
+
+/// @return False if an index is out of the vertices of the primitive.
+bool decodePrimitive(const fastgltf::Asset &asset, const PrimitiveJob &job,
+                     const MappedBufferAdapter &adapter, Vertex *vertices,
+                     uint32_t *indices) {
+  const fastgltf::Primitive &primitive = *job.primitive;
+  for (uint32_t i = 0; i < job.vertex_count; i++) {
+    vertices[i].color = glm::vec3(1.f);
+    vertices[i].tex_coord = glm::vec2(0.f);
+    vertices[i].normal = glm::vec3(0.f, 0.f, 1.f);
+  }
+  auto accessorOf = [&](const char *name) -> const fastgltf::Accessor * {
+    auto it = primitive.findAttribute(name);
+    if (it == primitive.attributes.end())
+      return nullptr;
+    return &asset.accessors[it->accessorIndex];
+  };
+
+  fastgltf::iterateAccessorWithIndex<glm::vec3>(
+      asset, *accessorOf("POSITION"),
+      [&](glm::vec3 v, size_t i) { vertices[i].position = v; }, adapter);
+  if (auto *normals = accessorOf("NORMAL"))
+    fastgltf::iterateAccessorWithIndex<glm::vec3>(
+        asset, *normals, [&](glm::vec3 v, size_t i) { vertices[i].normal = v; },
+        adapter);
+  // Normalized integer UVs and colors are converted to float here.
+  if (auto *uvs = accessorOf("TEXCOORD_0"))
+    fastgltf::iterateAccessorWithIndex<glm::vec2>(
+        asset, *uvs, [&](glm::vec2 v, size_t i) { vertices[i].tex_coord = v; },
+        adapter);
+  if (auto *colors = accessorOf("COLOR_0")) {
+    if (colors->type == fastgltf::AccessorType::Vec4)
+      fastgltf::iterateAccessorWithIndex<glm::vec4>(
+          asset, *colors,
+          [&](glm::vec4 v, size_t i) { vertices[i].color = glm::vec3(v); },
+          adapter);
+    else
+      fastgltf::iterateAccessorWithIndex<glm::vec3>(
+          asset, *colors,
+          [&](glm::vec3 v, size_t i) { vertices[i].color = v; }, adapter);
+  }
+
+  // Indices are made absolute, all submeshes share vertex offset 0.
+  bool in_range = true;
+  if (primitive.indicesAccessor.has_value()) {
+    fastgltf::iterateAccessorWithIndex<uint32_t>(
+        asset, asset.accessors[*primitive.indicesAccessor],
+        [&](uint32_t index, size_t i) {
+          in_range &= index < job.vertex_count;
+          indices[i] = job.first_vertex + index;
+        },
+        adapter);
+  } else {
+    for (uint32_t i = 0; i < job.index_count; i++)
+      indices[i] = job.first_vertex + i;
+  }
+  return in_range;
+}
+
+/// Cache statistics of one primitive, before and after optimization.
+struct OptimizeResult {
+  uint32_t n_triangles = 0;
+  VertexCacheStats before;
+  VertexCacheStats after;
+};
+
+/// Run the import passes on one decoded primitive: vertex cache order, then
+/// overdraw cluster order, then vertex renumbering for fetch locality.
+OptimizeResult optimizePrimitive(const PrimitiveJob &job, Vertex *vertices,
+                                 uint32_t *indices) {
+  OptimizeResult result;
+  if (job.index_count < 3 || job.index_count % 3 != 0)
+    return result;
+  result.n_triangles = job.index_count / 3;
+  for (uint32_t i = 0; i < job.index_count; i++)
+    indices[i] -= job.first_vertex;
+  result.before =
+      analyzeVertexCache(indices, job.index_count, job.vertex_count);
+
+  optimizeVertexCache(indices, job.index_count, job.vertex_count);
+  optimizeOverdraw(indices, job.index_count, &vertices[0].position.x,
+                   sizeof(Vertex) / sizeof(float), job.vertex_count);
+  std::vector<uint32_t> remap =
+      optimizeVertexFetchRemap(indices, job.index_count, job.vertex_count);
+  std::vector<Vertex> reordered(job.vertex_count);
+  for (uint32_t v = 0; v < job.vertex_count; v++)
+    reordered[remap[v]] = vertices[v];
+  std::copy(reordered.begin(), reordered.end(), vertices);
+
+  result.after = analyzeVertexCache(indices, job.index_count, job.vertex_count);
+  for (uint32_t i = 0; i < job.index_count; i++)
+    indices[i] += job.first_vertex;
+  return result;
+}
+
+/// Encode the vertices of a submesh into its range of the scene vertex
+/// data, in its own quantization box.
+void encodeSubmesh(const Vertex *vertices, const Submesh &submesh,
+                   std::byte *vertex_data) {
+  SceneVertexLayout::pack(vertices, submesh.vertex_count,
+                          getSubmeshQuantization(submesh),
+                          vertex_data + size_t(submesh.first_vertex) *
+                                            SceneVertexLayout::kStride);
+}
+
+void computeBounds(const Vertex *vertices, uint32_t count, Submesh &submesh) {
+  if (count == 0)
+    return;
+  glm::vec3 min = vertices[0].position;
+  glm::vec3 max = vertices[0].position;
+  for (uint32_t i = 1; i < count; i++) {
+    min = glm::min(min, vertices[i].position);
+    max = glm::max(max, vertices[i].position);
+  }
+  glm::vec3 center = (min + max) * 0.5f;
+  float radius = 0.f;
+  for (uint32_t i = 0; i < count; i++)
+    radius = std::max(radius, glm::distance(center, vertices[i].position));
+  submesh.bounds = glm::vec4(center, radius);
+  submesh.aabb_min = min;
+  submesh.aabb_max = max;
+}
+
+/// Simplify level after level into lod_indices. Offsets in submesh.lods
+/// are relative to lod_indices until the levels are appended to the scene.
+void generateLods(const Vertex *vertices, const uint32_t *indices,
+                  Submesh &submesh, std::vector<uint32_t> &lod_indices) {
+  if (submesh.index_count < 3 || submesh.index_count % 3 != 0)
+    return;
+  std::vector<uint32_t> level(indices, indices + submesh.index_count);
+  for (auto &index : level)
+    index -= submesh.first_vertex;
+  float max_error = kLodMaxError * submesh.bounds.w;
+  float error = 0.f;
+  while (submesh.lod_count < kMaxLods) {
+    size_t target = size_t(float(level.size()) * kLodReduction) / 3 * 3;
+    float level_error = 0.f;
+    std::vector<uint32_t> next = simplifyMesh(
+        level.data(), level.size(), &vertices[0].position.x,
+        sizeof(Vertex) / sizeof(float), submesh.vertex_count, target,
+        max_error, &level_error);
+    if (next.empty() ||
+        float(next.size()) > float(level.size()) * kLodMinReduction)
+      break;
+    // Levels are simplified from the previous one, errors add up.
+    error += level_error;
+    level = std::move(next);
+    optimizeVertexCache(level.data(), level.size(), submesh.vertex_count);
+    submesh.lods[submesh.lod_count++] = {uint32_t(lod_indices.size()),
+                                         uint32_t(level.size()), error};
+    for (uint32_t index : level)
+      lod_indices.push_back(index + submesh.first_vertex);
+  }
+}
+
+/// Cluster one level into meshlets, their first_index follows
+/// lod.first_index whether it is final or not.
+void buildLodMeshlets(const Vertex *vertices, const uint32_t *level_indices,
+                      const Submesh &submesh, MeshLod &lod,
+                      std::vector<Meshlet> &meshlets) {
+  std::vector<uint32_t> local(level_indices, level_indices + lod.index_count);
+  for (auto &index : local)
+    index -= submesh.first_vertex;
+  std::vector<Meshlet> level_meshlets =
+      buildMeshlets(local.data(), local.size(), &vertices[0].position.x,
+                    sizeof(Vertex) / sizeof(float), submesh.vertex_count);
+  lod.first_meshlet = uint32_t(meshlets.size());
+  lod.meshlet_count = uint32_t(level_meshlets.size());
+  for (Meshlet &meshlet : level_meshlets) {
+    meshlet.first_index += lod.first_index;
+    meshlets.push_back(meshlet);
+  }
+}
+
+/// Triangle weighted ACMR and vertex weighted ATVR over all primitives.
+void logCacheStats(const std::vector<OptimizeResult> &results) {
+  double tris = 0, misses_before = 0, misses_after = 0;
+  double used = 0;
+  for (auto &r : results) {
+    if (r.n_triangles == 0)
+      continue;
+    tris += r.n_triangles;
+    misses_before += r.before.acmr * r.n_triangles;
+    misses_after += r.after.acmr * r.n_triangles;
+    used += r.before.acmr * r.n_triangles / r.before.atvr;
+  }
+  if (tris == 0)
+    return;
+  LOGI("Mesh optimization: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}.",
+       misses_before / tris, misses_after / tris, misses_before / used,
+       misses_after / used);
+}
+} // namespace
+
+Scene::Scene() {
+  std::vector<Vertex> vertices = {
+      {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f},
+       {0.0f, 0.0f, 1.0f}},
+      {{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f},
+       {0.0f, 0.0f, 1.0f}},
+      {{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f},
+       {0.0f, 0.0f, 1.0f}},
+      {{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f},
+       {0.0f, 0.0f, 1.0f}},
+
+      {{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f},
+       {0.0f, 0.0f, 1.0f}},
+      {{0.5f, -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f},
+       {0.0f, 0.0f, 1.0f}},
+      {{0.5f, 0.5f, -0.5f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f},
+       {0.0f, 0.0f, 1.0f}},
+      {{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f},
+       {0.0f, 0.0f, 1.0f}}};
+
+  m_indices = {0, 1, 2, 2, 3, 0, 4, 5, 6, 6, 7, 4};
+  m_vertex_count = uint32_t(vertices.size());
+  m_submeshes = {{0, uint32_t(m_indices.size()), 0, m_vertex_count, 0}};
+  m_submeshes[0].bounds = glm::vec4(0.f, 0.f, -0.25f, 0.75f);
+  m_submeshes[0].aabb_min = glm::vec3(-0.5f, -0.5f, -0.5f);
+  m_submeshes[0].aabb_max = glm::vec3(0.5f, 0.5f, 0.f);
+  m_meshlets = buildMeshlets(m_indices.data(), m_indices.size(),
+                             &vertices[0].position.x,
+                             sizeof(Vertex) / sizeof(float), vertices.size());
+  m_submeshes[0].lods[0] = {0, uint32_t(m_indices.size()), 0.f, 0,
+                            uint32_t(m_meshlets.size())};
+  m_vertex_data.resize(vertices.size() * SceneVertexLayout::kStride);
+  encodeSubmesh(vertices.data(), m_submeshes[0], m_vertex_data.data());
+  m_transforms.build({TransformHierarchy::kNoParent}, {glm::mat4(1.f)});
+  m_node_meshes = {0};
+  buildInstances();
+}
+
+bool Scene::loadGltf(const std::filesystem::path &path,
+                     const SceneImportOptions &options) {
+  LOGI("Loading glTF {}.", path.string());
+  auto begin = std::chrono::steady_clock::now();
+
+  // The JSON is parsed from the mapping, buffers are left in place.
+  auto gltf_file = fastgltf::MappedGltfFile::FromPath(path);
+  if (gltf_file.error() != fastgltf::Error::None) {
+    LOGE("Failed to open {}: {}.", path.string(),
+         fastgltf::getErrorMessage(gltf_file.error()));
+    return false;
+  }
+  fastgltf::Parser parser;
+  auto asset = parser.loadGltf(gltf_file.get(), path.parent_path(),
+                               fastgltf::Options::None);
+  if (asset.error() != fastgltf::Error::None) {
+    LOGE("Failed to parse {}: {}.", path.string(),
+         fastgltf::getErrorMessage(asset.error()));
+    return false;
+  }
+  // Indices into other arrays are checked here, sizes below.
+  if (auto error = fastgltf::validate(asset.get());
+      error != fastgltf::Error::None) {
+    LOGE("{} is not valid glTF: {}.", path.string(),
+         fastgltf::getErrorMessage(error));
+    return false;
+  }
+
+  // Without LoadGLBBuffers nor LoadExternalBuffers, GLB and external
+  // buffers are given as a file URI and offset, mapped here.
+  std::vector<MappedFile> mapped_files;
+  std::vector<const std::byte *> buffer_data(asset->buffers.size(), nullptr);
+  std::vector<size_t> buffer_sizes(asset->buffers.size(), 0);
+  for (size_t i = 0; i < asset->buffers.size(); i++) {
+    std::visit(
+        fastgltf::visitor{
+            [&](const fastgltf::sources::ByteView &view) {
+              buffer_data[i] = view.bytes.data();
+              buffer_sizes[i] = view.bytes.size();
+            },
+            [&](const fastgltf::sources::Array &array) {
+              buffer_data[i] = array.bytes.data();
+              buffer_sizes[i] = array.bytes.size();
+            },
+            [&](const fastgltf::sources::Vector &vector) {
+              buffer_data[i] = vector.bytes.data();
+              buffer_sizes[i] = vector.bytes.size();
+            },
+            [&](const fastgltf::sources::URI &uri) {
+              MappedFile file;
+              if (!uri.uri.isLocalPath() ||
+                  !file.open(path.parent_path() / uri.uri.fspath()) ||
+                  uri.fileByteOffset > file.size())
+                return;
+              buffer_data[i] = file.data() + uri.fileByteOffset;
+              buffer_sizes[i] = file.size() - uri.fileByteOffset;
+              mapped_files.push_back(std::move(file));
+            },
+            [](const auto &) {},
+        },
+        asset->buffers[i].data);
+    if (!buffer_data[i]) {
+      LOGE("Buffer {} of {} is not supported.", i, path.string());
+      return false;
+    }
+    if (asset->buffers[i].byteLength > buffer_sizes[i]) {
+      LOGE("Buffer {} of {} is shorter than declared.", i, path.string());
+      return false;
+    }
+  }
+  // Accessors are checked against views, views against what is mapped.
+  for (size_t i = 0; i < asset->bufferViews.size(); i++) {
+    const fastgltf::BufferView &view = asset->bufferViews[i];
+    if (view.bufferIndex >= buffer_sizes.size() ||
+        view.byteOffset > buffer_sizes[view.bufferIndex] ||
+        view.byteLength > buffer_sizes[view.bufferIndex] - view.byteOffset) {
+      LOGE("Buffer view {} of {} is out of its buffer.", i, path.string());
+      return false;
+    }
+  }
+
+  // Sizes are known from accessors, so every primitive gets its final
+  // place before decoding and no thread ever appends.
+  std::vector<PrimitiveJob> jobs;
+  std::vector<Submesh> submeshes;
+  size_t n_vertices = 0;
+  size_t n_indices = 0;
+  for (size_t mesh = 0; mesh < asset->meshes.size(); mesh++) {
+    for (auto &primitive : asset->meshes[mesh].primitives) {
+      auto position = primitive.findAttribute("POSITION");
+      if (primitive.type != fastgltf::PrimitiveType::Triangles ||
+          position == primitive.attributes.end())
+        continue;
+      if (!checkPrimitive(asset.get(), primitive)) {
+        LOGE("Primitive of mesh {} in {} has malformed accessors, skipped.",
+             mesh, path.string());
+        continue;
+      }
+      PrimitiveJob job;
+      job.primitive = &primitive;
+      job.first_vertex = uint32_t(n_vertices);
+      job.vertex_count =
+          uint32_t(asset->accessors[position->accessorIndex].count);
+      job.first_index = uint32_t(n_indices);
+      job.index_count =
+          primitive.indicesAccessor.has_value()
+              ? uint32_t(asset->accessors[*primitive.indicesAccessor].count)
+              : job.vertex_count;
+      n_vertices += job.vertex_count;
+      n_indices += job.index_count;
+      jobs.push_back(job);
+      submeshes.push_back({job.first_index, job.index_count,
+                           job.first_vertex, job.vertex_count,
+                           uint32_t(mesh)});
+      submeshes.back().lods[0] = {job.first_index, job.index_count, 0.f};
+    }
+  }
+  if (n_vertices > UINT32_MAX || n_indices > UINT32_MAX) {
+    LOGE("{} is too large for 32-bit indices.", path.string());
+    return false;
+  }
+
+  // Sized from accessor counts, encoded once per primitive.
+  std::vector<std::byte> vertex_data(n_vertices * SceneVertexLayout::kStride);
+  std::vector<uint32_t> indices(n_indices);
+  std::vector<uint8_t> bad_indices(jobs.size(), 0);
+  std::vector<OptimizeResult> results(jobs.size());
+  std::vector<std::vector<uint32_t>> lod_indices(jobs.size());
+  std::vector<std::vector<Meshlet>> meshlets(jobs.size());
+  MappedBufferAdapter adapter{buffer_data};
+  ThreadPool pool;
+  pool.init();
+  // Primitives own their vertex range, so they are optimized on the same
+  // thread right after decoding. Only one primitive at a time is decoded
+  // per thread, the scene keeps the encoded vertices alone.
+  pool.parallelFor(uint32_t(jobs.size()), [&](uint32_t j) {
+    std::vector<Vertex> decoded(jobs[j].vertex_count);
+    Vertex *job_vertices = decoded.data();
+    uint32_t *job_indices = indices.data() + jobs[j].first_index;
+    if (!decodePrimitive(asset.get(), jobs[j], adapter, job_vertices,
+                         job_indices)) {
+      bad_indices[j] = 1;
+      return;
+    }
+    if (options.optimize)
+      results[j] = optimizePrimitive(jobs[j], job_vertices, job_indices);
+    computeBounds(job_vertices, jobs[j].vertex_count, submeshes[j]);
+    if (options.generate_lods)
+      generateLods(job_vertices, job_indices, submeshes[j], lod_indices[j]);
+    Submesh &submesh = submeshes[j];
+    for (uint32_t l = 0; l < submesh.lod_count; l++) {
+      const uint32_t *level_indices =
+          l == 0 ? job_indices
+                 : lod_indices[j].data() + submesh.lods[l].first_index;
+      buildLodMeshlets(job_vertices, level_indices, submesh, submesh.lods[l],
+                       meshlets[j]);
+    }
+    encodeSubmesh(job_vertices, submesh, vertex_data.data());
+  });
+  pool.deinit();
+  auto bad = std::find(bad_indices.begin(), bad_indices.end(), 1);
+  if (bad != bad_indices.end()) {
+    LOGE("Primitive {} of {} indexes past its vertices.",
+         bad - bad_indices.begin(), path.string());
+    return false;
+  }
+  if (options.optimize)
+    logCacheStats(results);
+
+  // Coarse levels go after all full detail ranges, in primitive order.
+  size_t n_lod_indices = 0;
+  std::vector<Meshlet> scene_meshlets;
+  for (size_t j = 0; j < jobs.size(); j++) {
+    for (uint32_t l = 0; l < submeshes[j].lod_count; l++) {
+      MeshLod &lod = submeshes[j].lods[l];
+      uint32_t index_offset = l == 0 ? 0 : uint32_t(n_indices);
+      lod.first_index += index_offset;
+      for (uint32_t m = 0; m < lod.meshlet_count; m++)
+        meshlets[j][lod.first_meshlet + m].first_index += index_offset;
+      lod.first_meshlet += uint32_t(scene_meshlets.size());
+    }
+    scene_meshlets.insert(scene_meshlets.end(), meshlets[j].begin(),
+                          meshlets[j].end());
+    n_indices += lod_indices[j].size();
+    n_lod_indices += lod_indices[j].size();
+  }
+  if (n_indices > UINT32_MAX) {
+    LOGE("{} is too large for 32-bit indices.", path.string());
+    return false;
+  }
+  indices.reserve(n_indices);
+  for (auto &level_indices : lod_indices)
+    indices.insert(indices.end(), level_indices.begin(), level_indices.end());
+
+  std::vector<uint32_t> parents;
+  std::vector<glm::mat4> locals;
+  std::vector<uint32_t> node_meshes;
+  collectNodes(asset.get(), parents, locals, node_meshes);
+  TransformHierarchy transforms;
+  if (!transforms.build(parents, locals)) {
+    LOGE("Node hierarchy of {} is not a tree.", path.string());
+    return false;
+  }
+
+  m_vertex_data = std::move(vertex_data);
+  m_vertex_count = uint32_t(n_vertices);
+  m_indices = std::move(indices);
+  m_submeshes = std::move(submeshes);
+  m_meshlets = std::move(scene_meshlets);
+  m_transforms = std::move(transforms);
+  m_node_meshes = std::move(node_meshes);
+  buildInstances();
+  m_transform_version++;
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - begin;
+  LOGI("Loaded {} primitives, {} vertices, {} indices ({} in LODs), {} "
+       "meshlets, {} nodes in {:.1f} ms.",
+       m_submeshes.size(), m_vertex_count, m_indices.size(), n_lod_indices,
+       m_meshlets.size(), m_transforms.size() - 1, elapsed.count());
+  return true;
+}
+
+void Scene::buildInstances() {
+  m_instances.clear();
+  for (uint32_t node = 0; node < m_node_meshes.size(); node++) {
+    if (m_node_meshes[node] == kNoMesh)
+      continue;
+    for (uint32_t s = 0; s < m_submeshes.size(); s++) {
+      if (m_submeshes[s].mesh == m_node_meshes[node])
+        m_instances.push_back({node, s});
+    }
+  }
+}
+} // namespace vrtr
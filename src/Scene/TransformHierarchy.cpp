@@ -0,0 +1,183 @@
+#include "Scene/TransformHierarchy.hpp"
+#include "utils/ThreadPool.hpp"
+#include "utils/log.hpp"
+
+#include <algorithm>
+
+namespace vrtr {
+namespace {
+/// Fewer recomputed nodes than this are not worth waking the pool.
+constexpr uint32_t kMinParallelNodes = 4096;
+/// Spans are split to this many per thread at least, to balance tasks.
+constexpr uint32_t kSpansPerThread = 4;
+} // namespace
+
+bool TransformHierarchy::build(const std::vector<uint32_t> &parents,
+                               const std::vector<glm::mat4> &locals) {
+  m_parents.clear();
+  m_subtree_ends.clear();
+  m_locals.clear();
+  m_worlds.clear();
+  m_dirty.clear();
+  m_dirty_slots.clear();
+  m_slots.clear();
+  uint32_t n_nodes = uint32_t(parents.size());
+  if (locals.size() != n_nodes) {
+    LOGE("{} local transforms for {} nodes.", locals.size(), n_nodes);
+    return false;
+  }
+
+  // Children as linked lists, in id order.
+  std::vector<uint32_t> first_child(n_nodes, kNoParent);
+  std::vector<uint32_t> next_sibling(n_nodes, kNoParent);
+  for (uint32_t node = n_nodes; node-- > 0;) {
+    uint32_t parent = parents[node];
+    if (parent == kNoParent)
+      continue;
+    if (parent >= n_nodes) {
+      LOGE("Node {} has parent {} out of {} nodes.", node, parent, n_nodes);
+      return false;
+    }
+    next_sibling[node] = first_child[parent];
+    first_child[parent] = node;
+  }
+
+  // Depth-first from each root, nodes on a cycle are never reached.
+  std::vector<uint32_t> order;
+  order.reserve(n_nodes);
+  m_slots.assign(n_nodes, kNoParent);
+  std::vector<uint32_t> stack;
+  std::vector<uint32_t> children;
+  for (uint32_t root = 0; root < n_nodes; root++) {
+    if (parents[root] != kNoParent)
+      continue;
+    stack.push_back(root);
+    while (!stack.empty()) {
+      uint32_t node = stack.back();
+      stack.pop_back();
+      m_slots[node] = uint32_t(order.size());
+      order.push_back(node);
+      children.clear();
+      for (uint32_t c = first_child[node]; c != kNoParent; c = next_sibling[c])
+        children.push_back(c);
+      stack.insert(stack.end(), children.rbegin(), children.rend());
+    }
+  }
+  if (order.size() != n_nodes) {
+    LOGE("{} of {} nodes are on a parent cycle.", n_nodes - order.size(),
+         n_nodes);
+    m_slots.clear();
+    return false;
+  }
+
+  m_parents.resize(n_nodes);
+  m_locals.resize(n_nodes);
+  for (uint32_t slot = 0; slot < n_nodes; slot++) {
+    uint32_t parent = parents[order[slot]];
+    m_parents[slot] = parent == kNoParent ? kNoParent : m_slots[parent];
+    m_locals[slot] = locals[order[slot]];
+  }
+  // Subtree sizes summed up from the leaves.
+  std::vector<uint32_t> sizes(n_nodes, 1);
+  for (uint32_t slot = n_nodes; slot-- > 0;) {
+    if (m_parents[slot] != kNoParent)
+      sizes[m_parents[slot]] += sizes[slot];
+  }
+  m_subtree_ends.resize(n_nodes);
+  for (uint32_t slot = 0; slot < n_nodes; slot++)
+    m_subtree_ends[slot] = slot + sizes[slot];
+
+  // Roots dirty, the first update() computes every world transform.
+  m_worlds.resize(n_nodes, glm::mat4(1.f));
+  m_dirty.assign(n_nodes, 0);
+  for (uint32_t slot = 0; slot < n_nodes; slot = m_subtree_ends[slot]) {
+    m_dirty[slot] = 1;
+    m_dirty_slots.push_back(slot);
+  }
+  return true;
+}
+
+void TransformHierarchy::setLocal(uint32_t node, const glm::mat4 &local) {
+  uint32_t slot = m_slots[node];
+  m_locals[slot] = local;
+  if (!m_dirty[slot]) {
+    m_dirty[slot] = 1;
+    m_dirty_slots.push_back(slot);
+  }
+}
+
+uint32_t TransformHierarchy::update(ThreadPool *pool) {
+  if (m_dirty_slots.empty())
+    return 0;
+  // Dirty slots inside an earlier dirty subtree are recomputed with it.
+  std::sort(m_dirty_slots.begin(), m_dirty_slots.end());
+  m_dirty_spans.clear();
+  uint32_t n_nodes = 0;
+  uint32_t covered_end = 0;
+  for (uint32_t slot : m_dirty_slots) {
+    m_dirty[slot] = 0;
+    if (slot < covered_end)
+      continue;
+    covered_end = m_subtree_ends[slot];
+    m_dirty_spans.push_back({slot, covered_end});
+    n_nodes += covered_end - slot;
+  }
+  m_dirty_slots.clear();
+
+  uint32_t n_threads = pool ? pool->getThreadCount() + 1 : 1;
+  if (n_threads == 1 || n_nodes < kMinParallelNodes) {
+    for (const Span &span : m_dirty_spans)
+      updateSpan(span);
+    return n_nodes;
+  }
+
+  // A single dirty root, such as the scene root, would leave the pool idle.
+  uint32_t max_nodes = n_nodes / (n_threads * kSpansPerThread) + 1;
+  m_spans.clear();
+  for (const Span &span : m_dirty_spans)
+    splitSpan(span, max_nodes);
+
+  // Contiguous runs of spans with about the same node count per task.
+  uint32_t n_split_nodes = 0;
+  for (const Span &span : m_spans)
+    n_split_nodes += span.end - span.first;
+  uint32_t task_nodes = (n_split_nodes + n_threads - 1) / n_threads;
+  m_task_firsts.clear();
+  m_task_firsts.push_back(0);
+  uint32_t nodes = 0;
+  for (uint32_t s = 0; s < m_spans.size(); s++) {
+    if (nodes >= task_nodes) {
+      m_task_firsts.push_back(s);
+      nodes = 0;
+    }
+    nodes += m_spans[s].end - m_spans[s].first;
+  }
+  m_task_firsts.push_back(uint32_t(m_spans.size()));
+  pool->parallelFor(uint32_t(m_task_firsts.size() - 1), [&](uint32_t t) {
+    for (uint32_t s = m_task_firsts[t]; s < m_task_firsts[t + 1]; s++)
+      updateSpan(m_spans[s]);
+  });
+  return n_nodes;
+}
+
+void TransformHierarchy::splitSpan(Span span, uint32_t max_nodes) {
+  if (span.end - span.first <= max_nodes) {
+    m_spans.push_back(span);
+    return;
+  }
+  // Root done here, then the subtrees of its children are independent.
+  updateSpan({span.first, span.first + 1});
+  for (uint32_t child = span.first + 1; child < span.end;
+       child = m_subtree_ends[child])
+    splitSpan({child, m_subtree_ends[child]}, max_nodes);
+}
+
+void TransformHierarchy::updateSpan(Span span) {
+  // Parents precede children, so their world is already up to date.
+  for (uint32_t slot = span.first; slot < span.end; slot++) {
+    uint32_t parent = m_parents[slot];
+    m_worlds[slot] = parent == kNoParent ? m_locals[slot]
+                                         : m_worlds[parent] * m_locals[slot];
+  }
+}
+} // namespace vrtr
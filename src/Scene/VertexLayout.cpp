@@ -0,0 +1,108 @@
+#include "Scene/VertexLayout.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
+
+namespace vrtr {
+VertexQuantization VertexQuantization::fromBox(glm::vec3 min,
+                                               glm::vec3 max) {
+  VertexQuantization q;
+  q.center = (min + max) * 0.5f;
+  // Flat boxes still need a non-zero scale.
+  q.half_extent = glm::max((max - min) * 0.5f, glm::vec3(1e-6f));
+  return q;
+}
+
+VertexQuantization getSubmeshQuantization(const Submesh &submesh) {
+  if (!SceneVertexLayout::kQuantized)
+    return {};
+  return VertexQuantization::fromBox(submesh.aabb_min, submesh.aabb_max);
+}
+
+namespace vertex_attr {
+namespace {
+glm::vec3 normalizePosition(const Vertex &v, const VertexQuantization &q) {
+  return glm::clamp((v.position - q.center) / q.half_extent, -1.f, 1.f);
+}
+
+void store(std::byte *out, const void *data, size_t size) {
+  memcpy(out, data, size);
+}
+
+/// Unit vector to the [-1, 1] square, folding the lower hemisphere over.
+glm::vec2 octEncode(glm::vec3 n) {
+  float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (l1 <= 0.f)
+    return glm::vec2(0.f);
+  n /= l1;
+  glm::vec2 p(n.x, n.y);
+  if (n.z < 0.f) {
+    glm::vec2 sign(p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f);
+    p = (1.f - glm::abs(glm::vec2(p.y, p.x))) * sign;
+  }
+  return p;
+}
+} // namespace
+
+void PositionF32::encode(const Vertex &v, const VertexQuantization &,
+                         std::byte *out) {
+  store(out, &v.position, kSize);
+}
+
+void PositionF16::encode(const Vertex &v, const VertexQuantization &q,
+                         std::byte *out) {
+  glm::vec3 p = normalizePosition(v, q);
+  uint16_t packed[4] = {glm::packHalf1x16(p.x), glm::packHalf1x16(p.y),
+                        glm::packHalf1x16(p.z), glm::packHalf1x16(1.f)};
+  store(out, packed, kSize);
+}
+
+void PositionSnorm16::encode(const Vertex &v, const VertexQuantization &q,
+                             std::byte *out) {
+  glm::vec3 p = normalizePosition(v, q);
+  uint16_t packed[4] = {glm::packSnorm1x16(p.x), glm::packSnorm1x16(p.y),
+                        glm::packSnorm1x16(p.z), glm::packSnorm1x16(1.f)};
+  store(out, packed, kSize);
+}
+
+void ColorF32::encode(const Vertex &v, const VertexQuantization &,
+                      std::byte *out) {
+  store(out, &v.color, kSize);
+}
+
+void ColorRgba8::encode(const Vertex &v, const VertexQuantization &,
+                        std::byte *out) {
+  uint32_t packed = glm::packUnorm4x8(glm::vec4(v.color, 1.f));
+  store(out, &packed, kSize);
+}
+
+void UvF32::encode(const Vertex &v, const VertexQuantization &,
+                   std::byte *out) {
+  store(out, &v.tex_coord, kSize);
+}
+
+void UvF16::encode(const Vertex &v, const VertexQuantization &,
+                   std::byte *out) {
+  uint32_t packed = glm::packHalf2x16(v.tex_coord);
+  store(out, &packed, kSize);
+}
+
+void UvUnorm16::encode(const Vertex &v, const VertexQuantization &,
+                       std::byte *out) {
+  uint32_t packed = glm::packUnorm2x16(v.tex_coord);
+  store(out, &packed, kSize);
+}
+
+void NormalF32::encode(const Vertex &v, const VertexQuantization &,
+                       std::byte *out) {
+  store(out, &v.normal, kSize);
+}
+
+void NormalOct16::encode(const Vertex &v, const VertexQuantization &,
+                         std::byte *out) {
+  uint32_t packed = glm::packSnorm2x16(octEncode(v.normal));
+  store(out, &packed, kSize);
+}
+} // namespace vertex_attr
+} // namespace vrtr
@@ -0,0 +1,113 @@
+#include "utils/MappedFile.hpp"
+#include "utils/log.hpp"
+
+#include <utility>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vrtr {
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+  *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+  if (this == &other)
+    return *this;
+  close();
+  m_data = std::exchange(other.m_data, nullptr);
+  m_size = std::exchange(other.m_size, 0);
+#ifdef _WIN32
+  m_file = std::exchange(other.m_file, nullptr);
+  m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+  return *this;
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::filesystem::path &path) {
+  close();
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    LOGE("Failed to open {}.", path.string());
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    LOGE("Failed to map {}, empty or unreadable.", path.string());
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping =
+      CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  void *view =
+      mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (!view) {
+    LOGE("Failed to map {}.", path.string());
+    if (mapping)
+      CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  m_file = file;
+  m_mapping = mapping;
+  m_data = (const std::byte *)view;
+  m_size = size_t(size.QuadPart);
+  return true;
+}
+
+void MappedFile::close() {
+  if (m_data)
+    UnmapViewOfFile(m_data);
+  if (m_mapping)
+    CloseHandle(m_mapping);
+  if (m_file)
+    CloseHandle(m_file);
+  m_data = nullptr;
+  m_size = 0;
+  m_mapping = nullptr;
+  m_file = nullptr;
+}
+#else
+bool MappedFile::open(const std::filesystem::path &path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOGE("Failed to open {}.", path.string());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    LOGE("Failed to map {}, empty or unreadable.", path.string());
+    ::close(fd);
+    return false;
+  }
+  void *view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file alive on its own.
+  ::close(fd);
+  if (view == MAP_FAILED) {
+    LOGE("Failed to map {}.", path.string());
+    return false;
+  }
+  m_data = (const std::byte *)view;
+  m_size = size_t(st.st_size);
+  return true;
+}
+
+void MappedFile::close() {
+  if (m_data)
+    munmap((void *)m_data, m_size);
+  m_data = nullptr;
+  m_size = 0;
+}
+#endif
+} // namespace vrtr
@@ -0,0 +1,98 @@
+#include "utils/Profiler.hpp"
+#include "utils/json.hpp"
+#include "utils/log.hpp"
+#include <algorithm>
+#include <fstream>
+
+namespace vrtr {
+namespace {
+constexpr int kCpuTrack = 0;
+constexpr int kGpuTrack = 1;
+
+Json traceEvent(const ProfileEvent &e, int track, uint64_t frame) {
+  // Trace Event Format wants microseconds.
+  return Json{{"name", e.name},
+              {"ph", "X"},
+              {"pid", 0},
+              {"tid", track},
+              {"ts", e.begin_ns / 1000.0},
+              {"dur", (e.end_ns - e.begin_ns) / 1000.0},
+              {"args", {{"frame", frame}}}};
+}
+Json trackName(int track, const char *name) {
+  return Json{{"name", "thread_name"},
+              {"ph", "M"},
+              {"pid", 0},
+              {"tid", track},
+              {"args", {{"name", name}}}};
+}
+} // namespace
+
+Profiler::Profiler()
+    : m_epoch(std::chrono::steady_clock::now()), m_frames(kMaxFrames) {}
+
+int64_t Profiler::now() const {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - m_epoch)
+      .count();
+}
+
+void Profiler::beginFrame() {
+  if (!m_enabled)
+    return;
+  m_frame++;
+  // Keep capacity, no allocation once the ring is warm.
+  FrameProfile &record = getCurrentRecord();
+  record.frame = m_frame;
+  record.cpu_events.clear();
+  record.gpu_events.clear();
+}
+
+void Profiler::addCpuEvent(const char *name, int64_t begin_ns,
+                           int64_t end_ns) {
+  getCurrentRecord().cpu_events.push_back({name, begin_ns, end_ns});
+}
+
+void Profiler::addGpuEvents(uint64_t frame,
+                            const std::vector<ProfileEvent> &events) {
+  if (m_frame - frame >= kMaxFrames)
+    return; // Too late, the record is overwritten.
+  FrameProfile &record = m_frames[frame % kMaxFrames];
+  if (record.frame != frame)
+    return;
+  for (const auto &e : events)
+    record.gpu_events.push_back(
+        {e.name, e.begin_ns + m_gpu_offset_ns, e.end_ns + m_gpu_offset_ns});
+}
+
+std::vector<const FrameProfile *> Profiler::getFrames() const {
+  std::vector<const FrameProfile *> frames;
+  uint64_t n_frames = std::min<uint64_t>(m_frame + 1, kMaxFrames);
+  for (uint64_t f = m_frame + 1 - n_frames; f <= m_frame; f++) {
+    const FrameProfile &record = m_frames[f % kMaxFrames];
+    if (record.frame == f)
+      frames.push_back(&record);
+  }
+  return frames;
+}
+
+bool Profiler::dumpChromeTrace(const std::string &path) const {
+  Json events = Json::array();
+  events.push_back(trackName(kCpuTrack, "CPU"));
+  events.push_back(trackName(kGpuTrack, "GPU"));
+  for (const FrameProfile *record : getFrames()) {
+    for (const auto &e : record->cpu_events)
+      events.push_back(traceEvent(e, kCpuTrack, record->frame));
+    for (const auto &e : record->gpu_events)
+      events.push_back(traceEvent(e, kGpuTrack, record->frame));
+  }
+  std::ofstream file(path);
+  if (!file.is_open()) {
+    LOGE("Error opening trace file {}.", path);
+    return false;
+  }
+  file << Json{{"traceEvents", events}, {"displayTimeUnit", "ms"}}.dump();
+  LOGI("Profile trace written to {}.", path);
+  return true;
+}
+} // namespace vrtr
@@ -0,0 +1,99 @@
+#include "utils/RangeAllocator.hpp"
+
+#include <cassert>
+
+namespace vrtr {
+void RangeAllocator::init(uint64_t capacity) {
+  m_capacity = capacity;
+  m_used = 0;
+  m_free_by_offset.clear();
+  m_free_by_size.clear();
+  m_allocations.clear();
+  if (capacity > 0)
+    insertFree(0, capacity);
+}
+
+uint64_t RangeAllocator::allocate(uint64_t size, uint64_t alignment) {
+  if (size == 0 || alignment == 0)
+    return kInvalidOffset;
+  // Smallest free range first, a larger one only if padding does not fit.
+  for (auto it = m_free_by_size.lower_bound(size); it != m_free_by_size.end();
+       ++it) {
+    uint64_t free_offset = it->second;
+    uint64_t free_size = it->first;
+    uint64_t padding = (alignment - free_offset % alignment) % alignment;
+    if (padding + size > free_size)
+      continue;
+    eraseFree(m_free_by_offset.find(free_offset));
+    if (padding > 0)
+      insertFree(free_offset, padding);
+    uint64_t offset = free_offset + padding;
+    if (padding + size < free_size)
+      insertFree(offset + size, free_size - padding - size);
+    m_allocations[offset] = size;
+    m_used += size;
+    return offset;
+  }
+  return kInvalidOffset;
+}
+
+void RangeAllocator::free(uint64_t offset) {
+  auto allocation = m_allocations.find(offset);
+  assert(allocation != m_allocations.end());
+  uint64_t size = allocation->second;
+  m_allocations.erase(allocation);
+  m_used -= size;
+  insertFree(offset, size);
+}
+
+float RangeAllocator::getFragmentation() const {
+  uint64_t free = m_capacity - m_used;
+  if (free == 0)
+    return 0.f;
+  uint64_t largest =
+      m_free_by_size.empty() ? 0 : m_free_by_size.rbegin()->first;
+  return 1.f - float(largest) / float(free);
+}
+
+RangeAllocator::Stats RangeAllocator::getStats() const {
+  Stats stats;
+  stats.capacity = m_capacity;
+  stats.used = m_used;
+  stats.largest_free =
+      m_free_by_size.empty() ? 0 : m_free_by_size.rbegin()->first;
+  stats.n_allocations = uint32_t(m_allocations.size());
+  stats.n_free_ranges = uint32_t(m_free_by_offset.size());
+  return stats;
+}
+
+void RangeAllocator::insertFree(uint64_t offset, uint64_t size) {
+  // Merge with the free neighbours on both sides.
+  auto next = m_free_by_offset.lower_bound(offset);
+  if (next != m_free_by_offset.end() && next->first == offset + size) {
+    size += next->second;
+    eraseFree(next);
+  }
+  auto prev = m_free_by_offset.lower_bound(offset);
+  if (prev != m_free_by_offset.begin()) {
+    --prev;
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      size += prev->second;
+      eraseFree(prev);
+    }
+  }
+  m_free_by_offset[offset] = size;
+  m_free_by_size.emplace(size, offset);
+}
+
+void RangeAllocator::eraseFree(std::map<uint64_t, uint64_t>::iterator it) {
+  auto [begin, end] = m_free_by_size.equal_range(it->second);
+  for (auto size_it = begin; size_it != end; ++size_it) {
+    if (size_it->second == it->first) {
+      m_free_by_size.erase(size_it);
+      break;
+    }
+  }
+  m_free_by_offset.erase(it);
+}
+} // namespace vrtr
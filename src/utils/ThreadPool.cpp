@@ -0,0 +1,89 @@
+#include "utils/ThreadPool.hpp"
+
+namespace vrtr {
+void ThreadPool::init(uint32_t n_threads) {
+  if (n_threads == kHardwareThreads) {
+    uint32_t n_hw = std::thread::hardware_concurrency();
+    n_threads = n_hw > 1 ? n_hw - 1 : 0;
+  }
+  m_stop = false;
+  m_threads.reserve(n_threads);
+  for (uint32_t i = 0; i < n_threads; i++)
+    m_threads.emplace_back([this]() { workerLoop(); });
+}
+
+void ThreadPool::deinit() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for (auto &thread : m_threads)
+    thread.join();
+  m_threads.clear();
+}
+
+void ThreadPool::parallelFor(uint32_t count,
+                             const std::function<void(uint32_t)> &func) {
+  if (count == 0)
+    return;
+  if (m_threads.empty()) {
+    for (uint32_t i = 0; i < count; i++)
+      func(i);
+    return;
+  }
+  // Lives on the stack for the whole call, so a task only carries a pointer
+  // to it and its index, which std::function stores without allocating.
+  struct Batch {
+    const std::function<void(uint32_t)> &func;
+    std::mutex mutex;
+    std::condition_variable done;
+    uint32_t remaining;
+    std::exception_ptr error;
+
+    void run(uint32_t i) {
+      try {
+        func(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  } batch{func, {}, {}, count - 1, nullptr};
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint32_t i = 1; i < count; i++) {
+      m_tasks.emplace_back([batch = &batch, i]() {
+        batch->run(i);
+        // Notify under the lock, the waiter owns the batch once it wakes.
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if (--batch->remaining == 0)
+          batch->done.notify_one();
+      });
+    }
+  }
+  m_cv.notify_all();
+  batch.run(0);
+  std::unique_lock<std::mutex> lock(batch.mutex);
+  batch.done.wait(lock, [&batch]() { return batch.remaining == 0; });
+  if (batch.error)
+    std::rethrow_exception(batch.error);
+}
+
+void ThreadPool::workerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+      // Drain the queue before stopping.
+      if (m_tasks.empty())
+        return;
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
+} // namespace vrtr
@@ -1,5 +1,65 @@
 #include "utils/vk/descriptors.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <mutex>
+
+namespace {
+void hashCombine(size_t &seed, uint64_t value) {
+  seed ^= std::hash<uint64_t>{}(value) + 0x9e3779b97f4a7c15 + (seed << 6) +
+          (seed >> 2);
+}
+
+/// Non-dispatchable handles are pointers or integers depending on the
+/// platform.
+template <typename Handle> uint64_t handleKey(Handle handle) {
+  return (uint64_t)handle;
+}
+
+/// Descriptor counts of every layout the builder made, for the allocators.
+/// Layouts are few and built at init, a lock is cheap enough.
+std::mutex g_layout_sizes_mutex;
+std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorPoolSize>>
+    g_layout_sizes;
+
+void recordLayoutSizes(
+    VkDescriptorSetLayout layout,
+    std::span<const VkDescriptorSetLayoutBinding> bindings) {
+  std::vector<VkDescriptorPoolSize> sizes;
+  for (const VkDescriptorSetLayoutBinding &binding : bindings) {
+    auto it = std::find_if(sizes.begin(), sizes.end(),
+                           [&](const VkDescriptorPoolSize &size) {
+                             return size.type == binding.descriptorType;
+                           });
+    if (it == sizes.end())
+      sizes.push_back({binding.descriptorType, binding.descriptorCount});
+    else
+      it->descriptorCount += binding.descriptorCount;
+  }
+  std::lock_guard lock(g_layout_sizes_mutex);
+  g_layout_sizes[layout] = std::move(sizes);
+}
+
+void forgetLayoutSizes(VkDescriptorSetLayout layout) {
+  std::lock_guard lock(g_layout_sizes_mutex);
+  // The handle may be reused by a layout of other counts.
+  g_layout_sizes.erase(layout);
+}
+
+/// Call visit on each descriptor count of layout, false if it is unknown.
+template <typename F> bool visitLayoutSizes(VkDescriptorSetLayout layout,
+                                            F &&visit) {
+  std::lock_guard lock(g_layout_sizes_mutex);
+  auto it = g_layout_sizes.find(layout);
+  if (it == g_layout_sizes.end())
+    return false;
+  for (const VkDescriptorPoolSize &size : it->second)
+    visit(size);
+  return true;
+}
+} // namespace
+
 void DescriptorLayoutBuilder::addBinding(uint32_t binding,
                                          VkDescriptorType type) {
   VkDescriptorSetLayoutBinding new_bind{};
@@ -30,29 +90,86 @@ DescriptorLayoutBuilder::build(VkDevice device,
 
   VkDescriptorSetLayout set_layout;
   VK_CHECK(vkCreateDescriptorSetLayout(device, &info, nullptr, &set_layout));
+  recordLayoutSizes(set_layout, bindings);
 
   return set_layout;
 }
-VkDescriptorPool DescriptorAllocator::getPool(VkDevice device) {
-  VkDescriptorPool pool;
+void DescriptorLayoutBuilder::destroy(VkDevice device,
+                                      VkDescriptorSetLayout layout) {
+  forgetLayoutSizes(layout);
+  vkDestroyDescriptorSetLayout(device, layout, nullptr);
+}
+DescriptorAllocator::Stats &
+DescriptorAllocator::Stats::operator+=(const Stats &other) {
+  n_pools += other.n_pools;
+  n_full_pools += other.n_full_pools;
+  peak_pools = std::max(peak_pools, other.peak_pools);
+  n_pools_created += other.n_pools_created;
+  n_sets += other.n_sets;
+  set_capacity += other.set_capacity;
+  n_sets_total += other.n_sets_total;
+  n_retries += other.n_retries;
+  n_failed += other.n_failed;
+  return *this;
+}
+bool DescriptorAllocator::addDemand(VkDescriptorSetLayout layout) {
+  // Looked up on every allocation, a cached copy would outlive the layout.
+  return visitLayoutSizes(layout, [&](const VkDescriptorPoolSize &size) {
+    auto demand =
+        std::find_if(m_demand.begin(), m_demand.end(),
+                     [&](const Demand &d) { return d.type == size.type; });
+    if (demand == m_demand.end())
+      demand = m_demand.insert(m_demand.end(), {size.type, 0, 0});
+    demand->n_descriptors += size.descriptorCount;
+    demand->max_per_set = std::max(demand->max_per_set, size.descriptorCount);
+  });
+}
+std::vector<DescriptorAllocator::PoolSizeRatio>
+DescriptorAllocator::getRatios() const {
+  if (m_n_known_sets == 0)
+    return m_ratios;
+  std::vector<PoolSizeRatio> ratios;
+  for (const Demand &demand : m_demand) {
+    ratios.push_back(
+        {demand.type, float(double(demand.n_descriptors) / m_n_known_sets)});
+  }
+  // Sets of unknown layouts may need any of the given ratios.
+  if (m_n_unknown_sets > 0) {
+    for (const PoolSizeRatio &given : m_ratios) {
+      auto it = std::find_if(
+          ratios.begin(), ratios.end(),
+          [&](const PoolSizeRatio &r) { return r.type == given.type; });
+      if (it == ratios.end())
+        ratios.push_back(given);
+      else
+        it->ratio = std::max(it->ratio, given.ratio);
+    }
+  }
+  return ratios;
+}
+uint32_t DescriptorAllocator::getPool(VkDevice device) {
+  uint32_t pool;
   if (!m_ready_pools.empty()) {
     pool = m_ready_pools.back();
     m_ready_pools.pop_back(); // May add back to this array or used array.
   } else {
-    pool = createPool(device, m_n_sets_per_pool, m_ratios);
+    pool = createPool(device, m_n_sets_per_pool);
     m_n_sets_per_pool = nextSetsPerPool(m_n_sets_per_pool);
   }
   return pool;
 }
 
-VkDescriptorPool
-DescriptorAllocator::createPool(VkDevice device, uint32_t n_max_set,
-                                std::span<PoolSizeRatio> pool_ratios) {
+uint32_t DescriptorAllocator::createPool(VkDevice device, uint32_t n_max_set) {
   std::vector<VkDescriptorPoolSize> pool_sizes;
-  for (auto &ratio : pool_ratios) {
-    pool_sizes.push_back(VkDescriptorPoolSize{
-        .type = ratio.type,
-        .descriptorCount = uint32_t(ratio.ratio * n_max_set)});
+  for (auto &ratio : getRatios()) {
+    uint32_t count = uint32_t(ratio.ratio * n_max_set);
+    // Any set seen so far fits, however rare its layout.
+    for (const Demand &demand : m_demand) {
+      if (demand.type == ratio.type)
+        count = std::max(count, demand.max_per_set);
+    }
+    if (count > 0)
+      pool_sizes.push_back({.type = ratio.type, .descriptorCount = count});
   }
   VkDescriptorPoolCreateInfo ci_pool = {};
   ci_pool.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -61,8 +178,17 @@ DescriptorAllocator::createPool(VkDevice device, uint32_t n_max_set,
   ci_pool.poolSizeCount = (uint32_t)pool_sizes.size();
   ci_pool.pPoolSizes = pool_sizes.data();
   VkDescriptorPool pool;
-  vkCreateDescriptorPool(device, &ci_pool, nullptr, &pool);
-  return pool;
+  VkResult result = vkCreateDescriptorPool(device, &ci_pool, nullptr, &pool);
+  if (result != VK_SUCCESS) {
+    LOGE("Failed to create a descriptor pool of {} sets: {}.", n_max_set,
+         (int)result);
+    return kInvalidPool;
+  }
+  m_pools.push_back({pool, n_max_set, 0});
+  m_stats.n_pools_created++;
+  m_stats.peak_pools =
+      std::max(m_stats.peak_pools, (uint32_t)m_pools.size());
+  return uint32_t(m_pools.size() - 1);
 }
 void DescriptorAllocator::initPool(VkDevice device, uint32_t n_max_set,
                                    std::span<PoolSizeRatio> pool_ratios) {
@@ -72,55 +198,89 @@ void DescriptorAllocator::initPool(VkDevice device, uint32_t n_max_set,
   }
   m_n_sets_per_pool =
       n_max_set > kMaxNSetsPerPool ? kMaxNSetsPerPool : n_max_set;
-  VkDescriptorPool pool = createPool(device, m_n_sets_per_pool, pool_ratios);
+  uint32_t pool = createPool(device, m_n_sets_per_pool);
   m_n_sets_per_pool = nextSetsPerPool(m_n_sets_per_pool);
-  m_ready_pools.push_back(pool);
+  if (pool != kInvalidPool)
+    m_ready_pools.push_back(pool);
 }
 void DescriptorAllocator::clearPools(VkDevice device) {
-  for (auto &p : m_ready_pools)
-    vkResetDescriptorPool(device, p, 0);
-  for (auto &p : m_full_pools) {
-    vkResetDescriptorPool(device, p, 0);
-    m_ready_pools.push_back(p);
+  for (auto &p : m_pools) {
+    vkResetDescriptorPool(device, p.pool, 0);
+    p.n_sets = 0;
   }
+  for (auto &p : m_full_pools)
+    m_ready_pools.push_back(p);
   m_full_pools.clear();
 }
 void DescriptorAllocator::destroyPools(VkDevice device) {
-  for (auto &p : m_ready_pools)
-    vkDestroyDescriptorPool(device, p, nullptr);
+  for (auto &p : m_pools)
+    vkDestroyDescriptorPool(device, p.pool, nullptr);
+  m_pools.clear();
   m_ready_pools.clear();
-  for (auto &p : m_full_pools)
-    vkDestroyDescriptorPool(device, p, nullptr);
   m_full_pools.clear();
 }
 VkDescriptorSet DescriptorAllocator::allocate(VkDevice device,
                                               VkDescriptorSetLayout layout,
                                               void *p_next) {
-  auto pool = getPool(device);
+  if (addDemand(layout))
+    m_n_known_sets++;
+  else
+    m_n_unknown_sets++;
+
   VkDescriptorSetAllocateInfo alloc_info = {};
   alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
   alloc_info.pNext = p_next;
-  alloc_info.descriptorPool = pool;
   alloc_info.descriptorSetCount = 1;
   alloc_info.pSetLayouts = &layout;
 
-  VkDescriptorSet ds;
-  VkResult result = vkAllocateDescriptorSets(device, &alloc_info, &ds);
+  VkDescriptorSet ds = VK_NULL_HANDLE;
+  uint32_t pool = getPool(device);
+  VkResult result = VK_ERROR_OUT_OF_POOL_MEMORY;
+  if (pool != kInvalidPool) {
+    alloc_info.descriptorPool = m_pools[pool].pool;
+    result = vkAllocateDescriptorSets(device, &alloc_info, &ds);
+  }
   if (result == VK_ERROR_OUT_OF_POOL_MEMORY ||
       result == VK_ERROR_FRAGMENTED_POOL) {
-    m_full_pools.push_back(pool);
-    pool = getPool(device);
-    alloc_info.descriptorPool = pool;
-    // Retry just once.
-    VK_CHECK(vkAllocateDescriptorSets(device, &alloc_info, &ds));
+    if (pool != kInvalidPool)
+      m_full_pools.push_back(pool);
+    // A new pool, sized with this layout counted, fits the set.
+    m_stats.n_retries++;
+    pool = createPool(device, m_n_sets_per_pool);
+    m_n_sets_per_pool = nextSetsPerPool(m_n_sets_per_pool);
+    if (pool != kInvalidPool) {
+      alloc_info.descriptorPool = m_pools[pool].pool;
+      result = vkAllocateDescriptorSets(device, &alloc_info, &ds);
+    }
+  }
+  if (pool != kInvalidPool)
+    m_ready_pools.push_back(pool);
+  if (result != VK_SUCCESS) {
+    m_stats.n_failed++;
+    LOGE("Failed to allocate a descriptor set: {}.", (int)result);
+    return VK_NULL_HANDLE;
   }
-  m_ready_pools.push_back(pool);
+  m_pools[pool].n_sets++;
+  m_stats.n_sets_total++;
   return ds;
 }
+DescriptorAllocator::Stats DescriptorAllocator::getStats() const {
+  Stats stats = m_stats;
+  stats.n_pools = (uint32_t)m_pools.size();
+  stats.n_full_pools = (uint32_t)m_full_pools.size();
+  for (const PoolUsage &pool : m_pools) {
+    stats.n_sets += pool.n_sets;
+    stats.set_capacity += pool.max_sets;
+  }
+  return stats;
+}
 void DescriptorWriter::writeBuffer(int binding, VkBuffer buffer, size_t size,
                                    size_t offset, VkDescriptorType d_type) {
+  size_t capacity = m_buffer_infos.capacity();
   auto &info = m_buffer_infos.emplace_back(VkDescriptorBufferInfo{
       .buffer = buffer, .offset = offset, .range = size});
+  if (m_buffer_infos.capacity() != capacity)
+    rebaseInfos();
   VkWriteDescriptorSet write = {.sType =
                                     VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
   write.dstBinding = binding;
@@ -134,8 +294,11 @@ void DescriptorWriter::writeBuffer(int binding, VkBuffer buffer, size_t size,
 void DescriptorWriter::writeImage(int binding, VkImageView image,
                                   VkSampler sampler, VkImageLayout image_layout,
                                   VkDescriptorType d_type) {
+  size_t capacity = m_image_infos.capacity();
   auto &info = m_image_infos.emplace_back(VkDescriptorImageInfo{
       .sampler = sampler, .imageView = image, .imageLayout = image_layout});
+  if (m_image_infos.capacity() != capacity)
+    rebaseInfos();
   VkWriteDescriptorSet write = {.sType =
                                     VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
   write.dstBinding = binding;
@@ -146,15 +309,226 @@ void DescriptorWriter::writeImage(int binding, VkImageView image,
 
   m_writes.push_back(write);
 }
+void DescriptorWriter::rebaseInfos() {
+  // Each write holds one info, in the order of the writes.
+  size_t n_images = 0;
+  size_t n_buffers = 0;
+  for (VkWriteDescriptorSet &write : m_writes) {
+    if (write.pImageInfo)
+      write.pImageInfo = &m_image_infos[n_images++];
+    else if (write.pBufferInfo)
+      write.pBufferInfo = &m_buffer_infos[n_buffers++];
+  }
+}
 void DescriptorWriter::clear() {
   m_image_infos.clear();
   m_buffer_infos.clear();
   m_writes.clear();
+  m_n_queued = 0;
+}
+void DescriptorWriter::queueUpdate(VkDescriptorSet d_set) {
+  for (size_t i = m_n_queued; i < m_writes.size(); i++)
+    m_writes[i].dstSet = d_set;
+  m_n_queued = m_writes.size();
+}
+void DescriptorWriter::discardPending() {
+  while (m_writes.size() > m_n_queued) {
+    if (m_writes.back().pImageInfo)
+      m_image_infos.pop_back();
+    else if (m_writes.back().pBufferInfo)
+      m_buffer_infos.pop_back();
+    m_writes.pop_back();
+  }
+}
+void DescriptorWriter::flush(VkDevice device) {
+  if (m_n_queued > 0)
+    vkUpdateDescriptorSets(device, (uint32_t)m_n_queued, m_writes.data(), 0,
+                           nullptr);
+  // Pending writes stay, moved to the front.
+  size_t n_images = 0;
+  size_t n_buffers = 0;
+  for (size_t i = 0; i < m_n_queued; i++) {
+    n_images += m_writes[i].pImageInfo != nullptr;
+    n_buffers += m_writes[i].pBufferInfo != nullptr;
+  }
+  m_writes.erase(m_writes.begin(), m_writes.begin() + m_n_queued);
+  m_image_infos.erase(m_image_infos.begin(), m_image_infos.begin() + n_images);
+  m_buffer_infos.erase(m_buffer_infos.begin(),
+                       m_buffer_infos.begin() + n_buffers);
+  m_n_queued = 0;
+  rebaseInfos();
 }
 void DescriptorWriter::updateDescriptorSet(VkDevice device,
                                            VkDescriptorSet d_set) {
-  for (VkWriteDescriptorSet &write : m_writes)
-    write.dstSet = d_set;
-  vkUpdateDescriptorSets(device, (uint32_t)m_writes.size(), m_writes.data(), 0,
-                         nullptr);
+  queueUpdate(d_set);
+  flush(device);
+}
+void DescriptorWriter::updateDescriptorSet(
+    VkDevice device, VkDescriptorSet d_set,
+    const DescriptorUpdateTemplate &update_template) {
+  m_template_infos.assign(update_template.size(), {});
+  m_template_written.assign(update_template.size(), 0);
+  uint32_t n_written = 0;
+  for (const VkWriteDescriptorSet &write : getPendingWrites()) {
+    uint32_t entry = update_template.getEntry(write.dstBinding);
+    if (entry == UINT32_MAX || write.descriptorCount != 1) {
+      LOGE("Binding {} is not in the update template, written without it.",
+           write.dstBinding);
+      queueUpdate(d_set);
+      return;
+    }
+    if (write.pImageInfo)
+      m_template_infos[entry].image = *write.pImageInfo;
+    else if (write.pBufferInfo)
+      m_template_infos[entry].buffer = *write.pBufferInfo;
+    n_written += m_template_written[entry] == 0;
+    m_template_written[entry] = 1;
+  }
+  // The template would write null descriptors to the entries left out.
+  assert(n_written == update_template.size() &&
+         "Update template entries without a write.");
+  if (n_written != update_template.size()) {
+    LOGE("{} of {} update template entries written, written without it.",
+         n_written, update_template.size());
+    queueUpdate(d_set);
+    return;
+  }
+  vkUpdateDescriptorSetWithTemplate(device, d_set, update_template.get(),
+                                    m_template_infos.data());
+  discardPending();
+}
+void DescriptorUpdateTemplate::init(
+    VkDevice device, VkDescriptorSetLayout layout,
+    std::span<const VkDescriptorSetLayoutBinding> bindings) {
+  std::vector<VkDescriptorUpdateTemplateEntry> entries;
+  m_bindings.clear();
+  for (const VkDescriptorSetLayoutBinding &binding : bindings) {
+    VkDescriptorUpdateTemplateEntry entry = {};
+    entry.dstBinding = binding.binding;
+    entry.dstArrayElement = 0;
+    entry.descriptorCount = 1;
+    entry.descriptorType = binding.descriptorType;
+    entry.offset = m_bindings.size() * sizeof(Info);
+    entry.stride = sizeof(Info);
+    entries.push_back(entry);
+    m_bindings.push_back(binding.binding);
+  }
+  VkDescriptorUpdateTemplateCreateInfo ci_template = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO};
+  ci_template.descriptorUpdateEntryCount = (uint32_t)entries.size();
+  ci_template.pDescriptorUpdateEntries = entries.data();
+  ci_template.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+  ci_template.descriptorSetLayout = layout;
+  VK_CHECK(vkCreateDescriptorUpdateTemplate(device, &ci_template, nullptr,
+                                            &m_template));
+}
+void DescriptorUpdateTemplate::destroy(VkDevice device) {
+  vkDestroyDescriptorUpdateTemplate(device, m_template, nullptr);
+}
+uint32_t DescriptorUpdateTemplate::getEntry(uint32_t binding) const {
+  for (uint32_t i = 0; i < m_bindings.size(); i++) {
+    if (m_bindings[i] == binding)
+      return i;
+  }
+  return UINT32_MAX;
+}
+void DescriptorSetCache::init(
+    VkDevice device, uint32_t n_max_set,
+    std::span<DescriptorAllocator::PoolSizeRatio> pool_ratios) {
+  m_device = device;
+  m_allocator.initPool(device, n_max_set, pool_ratios);
+}
+void DescriptorSetCache::destroy() {
+  LOGI("Descriptor set cache: {} sets, {} hits, {} misses, {} evictions.",
+       m_stats.n_sets, m_stats.hits, m_stats.misses, m_stats.evictions);
+  // Sets go with their pools.
+  m_allocator.destroyPools(m_device);
+  m_entries.clear();
+  m_free_sets.clear();
+}
+VkDescriptorSet
+DescriptorSetCache::get(VkDescriptorSetLayout layout, DescriptorWriter &writer,
+                        const DescriptorUpdateTemplate *update_template) {
+  m_key.clear();
+  for (const VkWriteDescriptorSet &write : writer.getPendingWrites()) {
+    for (uint32_t i = 0; i < write.descriptorCount; i++) {
+      Resource resource = {};
+      resource.binding = write.dstBinding;
+      resource.array_element = write.dstArrayElement + i;
+      resource.type = write.descriptorType;
+      if (write.pBufferInfo) {
+        const VkDescriptorBufferInfo &info = write.pBufferInfo[i];
+        resource.handle = handleKey(info.buffer);
+        resource.offset = info.offset;
+        resource.range = info.range;
+      } else if (write.pImageInfo) {
+        const VkDescriptorImageInfo &info = write.pImageInfo[i];
+        resource.handle = handleKey(info.imageView);
+        resource.sampler = handleKey(info.sampler);
+        resource.image_layout = info.imageLayout;
+      }
+      m_key.push_back(resource);
+    }
+  }
+  size_t hash = 0;
+  hashCombine(hash, handleKey(layout));
+  for (const Resource &resource : m_key) {
+    hashCombine(hash, resource.binding);
+    hashCombine(hash, resource.array_element);
+    hashCombine(hash, resource.type);
+    hashCombine(hash, resource.handle);
+    hashCombine(hash, resource.sampler);
+    hashCombine(hash, resource.offset);
+    hashCombine(hash, resource.range);
+    hashCombine(hash, resource.image_layout);
+  }
+  auto [first, last] = m_entries.equal_range(hash);
+  for (auto it = first; it != last; ++it) {
+    if (it->second.layout == layout && it->second.resources == m_key) {
+      m_stats.hits++;
+      writer.discardPending();
+      return it->second.set;
+    }
+  }
+
+  m_stats.misses++;
+  VkDescriptorSet set;
+  std::vector<VkDescriptorSet> &free_sets = m_free_sets[layout];
+  if (!free_sets.empty()) {
+    set = free_sets.back();
+    free_sets.pop_back();
+  } else {
+    set = m_allocator.allocate(m_device, layout);
+    if (set == VK_NULL_HANDLE) {
+      writer.discardPending();
+      return set;
+    }
+    m_stats.n_sets++;
+  }
+  if (update_template)
+    writer.updateDescriptorSet(m_device, set, *update_template);
+  else
+    writer.queueUpdate(set);
+  m_entries.emplace(hash, Entry{layout, m_key, set});
+  return set;
+}
+void DescriptorSetCache::evict(VkBuffer buffer) {
+  evictHandle(handleKey(buffer));
+}
+void DescriptorSetCache::evict(VkImageView view) {
+  evictHandle(handleKey(view));
+}
+void DescriptorSetCache::evictHandle(uint64_t handle) {
+  for (auto it = m_entries.begin(); it != m_entries.end();) {
+    bool bound = false;
+    for (const Resource &resource : it->second.resources)
+      bound |= resource.handle == handle;
+    if (!bound) {
+      ++it;
+      continue;
+    }
+    m_free_sets[it->second.layout].push_back(it->second.set);
+    m_stats.evictions++;
+    it = m_entries.erase(it);
+  }
 }
\ No newline at end of file
@@ -1,9 +1,14 @@
 #include "utils/vk/pipelines.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include "utils/vk/descriptors.hpp"
 #include "utils/vk/initializers.hpp"
 
 bool vkutil::loadShaderModule(const char *file_path, VkDevice device,
-                              VkShaderModule *out_shader_module) {
+                              VkShaderModule *out_shader_module,
+                              ShaderReflection *reflection) {
 
   // Open the file with cursor at the end.
   std::ifstream file(file_path, std::ios::ate | std::ios::binary);
@@ -22,6 +27,10 @@ bool vkutil::loadShaderModule(const char *file_path, VkDevice device,
   // Load the entire file into the buffer.
   file.read((char *)buffer.data(), fileSize);
   file.close();
+  if (reflection && !reflectShader(buffer, *reflection)) {
+    fmt::print("Error reflecting shader {}\n", file_path);
+    return false;
+  }
 
   // Create a new shader module, using the buffer we loaded.
   VkShaderModuleCreateInfo create_info = {};
@@ -40,6 +49,264 @@ bool vkutil::loadShaderModule(const char *file_path, VkDevice device,
   return true;
 }
 
+void PipelineCache::init(VkDevice device, VkPhysicalDevice physical_device,
+                         const std::string &path) {
+  m_device = device;
+  m_path = path;
+  vkGetPhysicalDeviceProperties(physical_device, &m_properties);
+
+  std::vector<uint8_t> data = load();
+  VkPipelineCacheCreateInfo ci_cache = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+  ci_cache.initialDataSize = data.size();
+  ci_cache.pInitialData = data.empty() ? nullptr : data.data();
+  VK_CHECK(vkCreatePipelineCache(m_device, &ci_cache, nullptr, &m_cache));
+  LOGI("Pipeline cache {}, {} bytes loaded.", m_path, data.size());
+}
+
+void PipelineCache::destroy() {
+  if (!save())
+    LOGE("Failed to write pipeline cache {}.", m_path);
+  vkDestroyPipelineCache(m_device, m_cache, nullptr);
+  m_cache = VK_NULL_HANDLE;
+}
+
+std::vector<uint8_t> PipelineCache::load() const {
+  std::ifstream file(m_path, std::ios::binary);
+  if (!file.is_open())
+    return {};
+  FileHeader header;
+  if (!file.read((char *)&header, sizeof(header)))
+    return {};
+  // Data of another device or driver is at best ignored by the driver,
+  // at worst a crash, never hand it over.
+  FileHeader expected = makeHeader();
+  if (header.magic != expected.magic || header.version != expected.version ||
+      header.vendor_id != expected.vendor_id ||
+      header.device_id != expected.device_id ||
+      header.driver_version != expected.driver_version ||
+      memcmp(header.cache_uuid, expected.cache_uuid, VK_UUID_SIZE) != 0) {
+    LOGI("Pipeline cache {} is from another device or driver, discarded.",
+         m_path);
+    return {};
+  }
+  // A truncated or garbage file must not size the allocation.
+  std::error_code error;
+  uint64_t file_size = std::filesystem::file_size(m_path, error);
+  // The header was read, the file holds at least that much.
+  if (error || header.data_size != file_size - sizeof(header)) {
+    LOGE("Pipeline cache {} has the wrong size, discarded.", m_path);
+    return {};
+  }
+  std::vector<uint8_t> data(header.data_size);
+  if (!file.read((char *)data.data(), data.size()) ||
+      hash(data.data(), data.size()) != header.data_hash) {
+    LOGE("Pipeline cache {} is corrupted, discarded.", m_path);
+    return {};
+  }
+  // Also check the header the driver wrote itself.
+  VkPipelineCacheHeaderVersionOne vk_header;
+  if (data.size() < sizeof(vk_header))
+    return {};
+  memcpy(&vk_header, data.data(), sizeof(vk_header));
+  if (vk_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+      memcmp(vk_header.pipelineCacheUUID, expected.cache_uuid,
+             VK_UUID_SIZE) != 0)
+    return {};
+  return data;
+}
+
+bool PipelineCache::save() const {
+  size_t size = 0;
+  if (vkGetPipelineCacheData(m_device, m_cache, &size, nullptr) != VK_SUCCESS)
+    return false;
+  std::vector<uint8_t> data(size);
+  if (vkGetPipelineCacheData(m_device, m_cache, &size, data.data()) !=
+      VK_SUCCESS)
+    return false;
+  data.resize(size);
+  FileHeader header = makeHeader();
+  header.data_size = data.size();
+  header.data_hash = hash(data.data(), data.size());
+
+  // Write aside then rename, a crash never leaves a torn cache behind.
+  std::string tmp_path = m_path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file.write((const char *)&header, sizeof(header)) ||
+        !file.write((const char *)data.data(), data.size()))
+      return false;
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp_path, m_path, error);
+  if (error) {
+    std::filesystem::remove(tmp_path, error);
+    return false;
+  }
+  LOGI("Pipeline cache {}, {} bytes saved.", m_path, data.size());
+  return true;
+}
+
+PipelineCache::FileHeader PipelineCache::makeHeader() const {
+  FileHeader header = {};
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.vendor_id = m_properties.vendorID;
+  header.device_id = m_properties.deviceID;
+  header.driver_version = m_properties.driverVersion;
+  memcpy(header.cache_uuid, m_properties.pipelineCacheUUID, VK_UUID_SIZE);
+  return header;
+}
+
+uint64_t PipelineCache::hash(const uint8_t *data, size_t size) {
+  // FNV-1a, enough to catch a truncated or garbled file.
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; i++) {
+    h ^= data[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+void LayoutCache::init(VkDevice device) { m_device = device; }
+
+void LayoutCache::destroy() {
+  LOGI("Layout cache: {} set layouts, {} pipeline layouts, {} hits, {} "
+       "misses.",
+       m_stats.n_set_layouts, m_stats.n_pipeline_layouts, m_stats.hits,
+       m_stats.misses);
+  for (auto &[key, layout] : m_pipeline_layouts)
+    vkDestroyPipelineLayout(m_device, layout, nullptr);
+  for (auto &[key, layout] : m_set_layouts)
+    DescriptorLayoutBuilder::destroy(m_device, layout);
+  m_pipeline_layouts.clear();
+  m_set_layouts.clear();
+  m_set_bindings.clear();
+  m_stats = {};
+}
+
+VkDescriptorSetLayout LayoutCache::getSetLayout(
+    std::span<const VkDescriptorSetLayoutBinding> bindings,
+    VkDescriptorSetLayoutCreateFlags flags,
+    std::span<const VkDescriptorBindingFlags> binding_flags) {
+  // Binding order does not change the layout, flags follow their binding.
+  std::vector<uint32_t> order(bindings.size());
+  for (uint32_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return bindings[a].binding < bindings[b].binding;
+  });
+  std::vector<VkDescriptorSetLayoutBinding> sorted;
+  std::vector<VkDescriptorBindingFlags> sorted_flags;
+  for (uint32_t i : order) {
+    sorted.push_back(bindings[i]);
+    if (!binding_flags.empty())
+      sorted_flags.push_back(binding_flags[i]);
+  }
+  std::vector<uint64_t> key = {flags, sorted_flags.size()};
+  for (uint32_t i = 0; i < sorted.size(); i++) {
+    const VkDescriptorSetLayoutBinding &b = sorted[i];
+    uint32_t n_samplers = b.pImmutableSamplers ? b.descriptorCount : 0;
+    key.insert(key.end(), {b.binding, (uint64_t)b.descriptorType,
+                           b.descriptorCount, b.stageFlags, n_samplers});
+    for (uint32_t s = 0; s < n_samplers; s++)
+      key.push_back((uint64_t)b.pImmutableSamplers[s]);
+    if (!sorted_flags.empty())
+      key.push_back(sorted_flags[i]);
+  }
+  auto it = m_set_layouts.find(key);
+  if (it != m_set_layouts.end()) {
+    m_stats.hits++;
+    return it->second;
+  }
+  m_stats.misses++;
+  VkDescriptorSetLayoutBindingFlagsCreateInfo ci_flags = {
+      .sType =
+          VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO};
+  ci_flags.bindingCount = (uint32_t)sorted_flags.size();
+  ci_flags.pBindingFlags = sorted_flags.data();
+  // Built through the builder so allocators learn its descriptor counts.
+  DescriptorLayoutBuilder builder;
+  builder.bindings = sorted;
+  VkDescriptorSetLayout layout = builder.build(
+      m_device, 0, sorted_flags.empty() ? nullptr : &ci_flags, flags);
+  // Immutable samplers may not outlive the call.
+  for (VkDescriptorSetLayoutBinding &b : sorted)
+    b.pImmutableSamplers = nullptr;
+  m_set_bindings.emplace(layout, std::move(sorted));
+  m_set_layouts.emplace(std::move(key), layout);
+  m_stats.n_set_layouts++;
+  return layout;
+}
+
+VkPipelineLayout LayoutCache::getPipelineLayout(
+    std::span<const VkDescriptorSetLayout> set_layouts,
+    std::span<const VkPushConstantRange> push_ranges) {
+  std::vector<uint64_t> key = {set_layouts.size()};
+  for (VkDescriptorSetLayout set_layout : set_layouts)
+    key.push_back((uint64_t)set_layout);
+  for (const VkPushConstantRange &range : push_ranges)
+    key.insert(key.end(), {range.stageFlags, range.offset, range.size});
+  auto it = m_pipeline_layouts.find(key);
+  if (it != m_pipeline_layouts.end()) {
+    m_stats.hits++;
+    return it->second;
+  }
+  m_stats.misses++;
+  VkPipelineLayoutCreateInfo ci_layout = vkinit::pipelineLayoutCreateInfo();
+  ci_layout.setLayoutCount = (uint32_t)set_layouts.size();
+  ci_layout.pSetLayouts = set_layouts.data();
+  ci_layout.pushConstantRangeCount = (uint32_t)push_ranges.size();
+  ci_layout.pPushConstantRanges = push_ranges.data();
+  VkPipelineLayout layout;
+  VK_CHECK(vkCreatePipelineLayout(m_device, &ci_layout, nullptr, &layout));
+  m_pipeline_layouts.emplace(std::move(key), layout);
+  m_stats.n_pipeline_layouts++;
+  return layout;
+}
+
+VkPipelineLayout
+LayoutCache::getPipelineLayout(
+    const vkutil::ShaderReflection &reflection,
+    std::span<const VkDescriptorSetLayout> given_layouts,
+    uint32_t runtime_array_count) {
+  std::vector<VkDescriptorSetLayout> set_layouts(
+      std::max<size_t>(reflection.getSetCount(), given_layouts.size()));
+  for (uint32_t set = 0; set < set_layouts.size(); set++) {
+    if (set >= given_layouts.size()) {
+      set_layouts[set] =
+          getSetLayout(reflection.getSetBindings(set, runtime_array_count));
+      continue;
+    }
+    set_layouts[set] = given_layouts[set];
+    auto given = m_set_bindings.find(given_layouts[set]);
+    if (given == m_set_bindings.end()) {
+      LOGE("Set {} layout was not made by the layout cache.", set);
+      return VK_NULL_HANDLE;
+    }
+    for (const vkutil::ShaderReflection::Binding &binding :
+         reflection.bindings) {
+      if (binding.set != set)
+        continue;
+      auto it = std::find_if(
+          given->second.begin(), given->second.end(),
+          [&](const auto &b) { return b.binding == binding.binding; });
+      if (it == given->second.end() ||
+          it->descriptorType != binding.type ||
+          it->descriptorCount < binding.count ||
+          (binding.stages & ~it->stageFlags) != 0) {
+        LOGE("Set {} binding {} of the shaders does not fit its layout.",
+             set, binding.binding);
+        return VK_NULL_HANDLE;
+      }
+    }
+  }
+  std::span<const VkPushConstantRange> push_ranges;
+  if (reflection.push_constants.size > 0)
+    push_ranges = {&reflection.push_constants, 1};
+  return getPipelineLayout(set_layouts, push_ranges);
+}
+
 void PipelineBuilder::clear() {
   ci_shader_stages.clear();
   ci_input_asm = {
@@ -52,9 +319,14 @@ void PipelineBuilder::clear() {
   ci_depth_stencil = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
   ci_render = {.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO};
+  vertex_bindings.clear();
+  vertex_attributes.clear();
+  render_pass = VK_NULL_HANDLE;
+  subpass = 0;
 }
 
-VkPipeline PipelineBuilder::buildPipeline(VkDevice device) {
+VkPipeline PipelineBuilder::buildPipeline(VkDevice device,
+                                          VkPipelineCache cache) {
   VkPipelineViewportStateCreateInfo ci_viewport = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
       .pNext = nullptr,
@@ -72,17 +344,20 @@ VkPipeline PipelineBuilder::buildPipeline(VkDevice device) {
   ci_color_blend.attachmentCount = 1;
   ci_color_blend.pAttachments = &color_blend_attach;
 
-  // No need, vertex data is sent by array.
   VkPipelineVertexInputStateCreateInfo ci_vert_input = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
       .pNext = nullptr,
   };
+  ci_vert_input.vertexBindingDescriptionCount =
+      (uint32_t)vertex_bindings.size();
+  ci_vert_input.pVertexBindingDescriptions = vertex_bindings.data();
+  ci_vert_input.vertexAttributeDescriptionCount =
+      (uint32_t)vertex_attributes.size();
+  ci_vert_input.pVertexAttributeDescriptions = vertex_attributes.data();
 
   VkGraphicsPipelineCreateInfo ci_pipeline = {
       .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
   };
-  // connect the renderInfo to the pNext extension mechanism
-  ci_pipeline.pNext = &ci_render;
   ci_pipeline.stageCount = (uint32_t)ci_shader_stages.size();
   ci_pipeline.pStages = ci_shader_stages.data();
   ci_pipeline.pVertexInputState = &ci_vert_input;
@@ -103,13 +378,59 @@ VkPipeline PipelineBuilder::buildPipeline(VkDevice device) {
   ci_dynamic_state.pDynamicStates = dy_state;
   ci_dynamic_state.dynamicStateCount = 2;
   ci_pipeline.pDynamicState = &ci_dynamic_state;
+  // connect the renderInfo to the pNext extension mechanism
+  // Point at our own format, the builder may be a copy.
+  VkPipelineRenderingCreateInfo ci_render_copy = ci_render;
+  if (ci_render_copy.colorAttachmentCount > 0)
+    ci_render_copy.pColorAttachmentFormats = &fmt_color_attach;
+  if (render_pass != VK_NULL_HANDLE) {
+    ci_pipeline.renderPass = render_pass;
+    ci_pipeline.subpass = subpass;
+  } else {
+    ci_pipeline.pNext = &ci_render_copy;
+  }
   VkPipeline pipeline = VK_NULL_HANDLE;
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &ci_pipeline,
-                                nullptr, &pipeline) != VK_SUCCESS) {
+  if (vkCreateGraphicsPipelines(device, cache, 1, &ci_pipeline, nullptr,
+                                &pipeline) != VK_SUCCESS) {
     fmt::println("Error creating pipeline.");
   }
   return pipeline;
 }
+
+std::vector<PipelineHandle>
+PipelineBuilder::buildPipelines(VkDevice device,
+                                const std::vector<PipelineBuilder> &builders,
+                                VkPipelineCache cache, vrtr::ThreadPool &pool) {
+  std::vector<PipelineHandle> handles;
+  handles.reserve(builders.size());
+  // One task per pipeline, the driver serializes cache access itself.
+  for (const auto &builder : builders) {
+    auto compile = [device, cache, builder]() mutable {
+      return builder.buildPipeline(device, cache);
+    };
+    handles.emplace_back(pool.submit(std::move(compile)).share());
+  }
+  return handles;
+}
+PipelineHandle PipelineBuilder::buildComputePipeline(VkDevice device,
+                                                     VkShaderModule module,
+                                                     VkPipelineLayout layout,
+                                                     VkPipelineCache cache,
+                                                     vrtr::ThreadPool &pool) {
+  auto compile = [device, module, layout, cache]() {
+    VkComputePipelineCreateInfo ci_pipeline = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    ci_pipeline.stage = vkinit::pipelineShaderStageCreateInfo(
+        VK_SHADER_STAGE_COMPUTE_BIT, module);
+    ci_pipeline.layout = layout;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (vkCreateComputePipelines(device, cache, 1, &ci_pipeline, nullptr,
+                                 &pipeline) != VK_SUCCESS)
+      LOGE("Error creating compute pipeline.");
+    return pipeline;
+  };
+  return PipelineHandle(pool.submit(std::move(compile)).share());
+}
 void PipelineBuilder::setShaders(VkShaderModule vert, VkShaderModule frag) {
   ci_shader_stages.clear();
   ci_shader_stages.push_back(
@@ -117,6 +438,17 @@ void PipelineBuilder::setShaders(VkShaderModule vert, VkShaderModule frag) {
   ci_shader_stages.push_back(vkinit::pipelineShaderStageCreateInfo(
       VK_SHADER_STAGE_FRAGMENT_BIT, frag));
 }
+void PipelineBuilder::setVertexInput(
+    std::span<const VkVertexInputBindingDescription> bindings,
+    std::span<const VkVertexInputAttributeDescription> attributes) {
+  vertex_bindings.assign(bindings.begin(), bindings.end());
+  vertex_attributes.assign(attributes.begin(), attributes.end());
+}
+void PipelineBuilder::setRenderPass(VkRenderPass pass,
+                                    uint32_t subpass_index) {
+  render_pass = pass;
+  subpass = subpass_index;
+}
 void PipelineBuilder::setInputTopology(VkPrimitiveTopology topology) {
   ci_input_asm.topology = topology;
   // Enable for triangle strip or line strip.
@@ -0,0 +1,451 @@
+#include "utils/vk/reflection.hpp"
+
+#include <algorithm>
+
+namespace vkutil {
+namespace {
+constexpr uint32_t kSpirvMagic = 0x07230203;
+constexpr uint32_t kHeaderWords = 5;
+
+// Opcodes, decorations and enums of the SPIR-V spec that reflection reads.
+enum Op : uint32_t {
+  kOpEntryPoint = 15,
+  kOpTypeBool = 20,
+  kOpTypeInt = 21,
+  kOpTypeFloat = 22,
+  kOpTypeVector = 23,
+  kOpTypeMatrix = 24,
+  kOpTypeImage = 25,
+  kOpTypeSampler = 26,
+  kOpTypeSampledImage = 27,
+  kOpTypeArray = 28,
+  kOpTypeRuntimeArray = 29,
+  kOpTypeStruct = 30,
+  kOpTypePointer = 32,
+  kOpConstant = 43,
+  kOpVariable = 59,
+  kOpDecorate = 71,
+  kOpMemberDecorate = 72,
+};
+enum Decoration : uint32_t {
+  kBufferBlock = 3,
+  kArrayStride = 6,
+  kMatrixStride = 7,
+  kBuiltIn = 11,
+  kLocation = 30,
+  kBinding = 33,
+  kDescriptorSet = 34,
+  kOffset = 35,
+};
+enum StorageClass : uint32_t {
+  kUniformConstant = 0,
+  kInput = 1,
+  kUniform = 2,
+  kPushConstant = 9,
+  kStorageBuffer = 12,
+};
+enum Dim : uint32_t { kDimBuffer = 5, kDimSubpassData = 6 };
+
+/// An id of the module: the instruction defining it and its decorations.
+struct Id {
+  std::span<const uint32_t> words;
+  uint32_t set = UINT32_MAX;
+  uint32_t binding = UINT32_MAX;
+  uint32_t location = UINT32_MAX;
+  uint32_t array_stride = 0;
+  bool buffer_block = false;
+  bool builtin = false;
+  std::vector<uint32_t> member_offsets;
+  std::vector<uint32_t> member_matrix_strides;
+  uint32_t opcode() const { return words.empty() ? 0 : words[0] & 0xffff; }
+};
+
+class Module {
+public:
+  bool parse(std::span<const uint32_t> code);
+  bool reflect(ShaderReflection &out) const;
+
+private:
+  const Id &get(uint32_t id) const {
+    static const Id kNone;
+    return id < m_ids.size() ? m_ids[id] : kNone;
+  }
+  uint32_t getConstant(uint32_t id) const {
+    const Id &constant = get(id);
+    return constant.opcode() == kOpConstant ? constant.words[3] : 0;
+  }
+  uint32_t getSize(uint32_t type, uint32_t matrix_stride = 0) const;
+  bool getDescriptorType(uint32_t type, uint32_t storage_class,
+                         VkDescriptorType &out) const;
+  VkFormat getInputFormat(uint32_t type) const;
+
+  std::vector<Id> m_ids;
+  std::vector<uint32_t> m_variables;
+  VkShaderStageFlags m_stages = 0;
+};
+
+VkShaderStageFlags getStage(uint32_t execution_model) {
+  switch (execution_model) {
+  case 0:
+    return VK_SHADER_STAGE_VERTEX_BIT;
+  case 1:
+    return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+  case 2:
+    return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+  case 3:
+    return VK_SHADER_STAGE_GEOMETRY_BIT;
+  case 4:
+    return VK_SHADER_STAGE_FRAGMENT_BIT;
+  case 5:
+    return VK_SHADER_STAGE_COMPUTE_BIT;
+  default:
+    return 0;
+  }
+}
+
+bool Module::parse(std::span<const uint32_t> code) {
+  if (code.size() < kHeaderWords || code[0] != kSpirvMagic) {
+    LOGE("Not a SPIR-V module.");
+    return false;
+  }
+  m_ids.resize(code[3]); // Bound of every id.
+  for (size_t i = kHeaderWords; i < code.size();) {
+    uint32_t n_words = code[i] >> 16;
+    if (n_words == 0 || i + n_words > code.size()) {
+      LOGE("Truncated SPIR-V instruction at word {}.", i);
+      return false;
+    }
+    std::span<const uint32_t> words = code.subspan(i, n_words);
+    i += n_words;
+    uint32_t opcode = words[0] & 0xffff;
+    auto at = [&](uint32_t id) -> Id * {
+      return id < m_ids.size() ? &m_ids[id] : nullptr;
+    };
+    switch (opcode) {
+    case kOpEntryPoint:
+      if (n_words > 1)
+        m_stages |= getStage(words[1]);
+      break;
+    case kOpTypeBool:
+    case kOpTypeInt:
+    case kOpTypeFloat:
+    case kOpTypeVector:
+    case kOpTypeMatrix:
+    case kOpTypeImage:
+    case kOpTypeSampler:
+    case kOpTypeSampledImage:
+    case kOpTypeArray:
+    case kOpTypeRuntimeArray:
+    case kOpTypeStruct:
+    case kOpTypePointer:
+      if (Id *id = n_words > 1 ? at(words[1]) : nullptr)
+        id->words = words;
+      break;
+    case kOpConstant:
+    case kOpVariable:
+      if (Id *id = n_words > 3 ? at(words[2]) : nullptr) {
+        id->words = words;
+        if (opcode == kOpVariable)
+          m_variables.push_back(words[2]);
+      }
+      break;
+    case kOpDecorate: {
+      Id *id = n_words > 2 ? at(words[1]) : nullptr;
+      if (!id)
+        break;
+      uint32_t literal = n_words > 3 ? words[3] : 0;
+      switch (words[2]) {
+      case kDescriptorSet:
+        id->set = literal;
+        break;
+      case kBinding:
+        id->binding = literal;
+        break;
+      case kLocation:
+        id->location = literal;
+        break;
+      case kArrayStride:
+        id->array_stride = literal;
+        break;
+      case kBufferBlock:
+        id->buffer_block = true;
+        break;
+      case kBuiltIn:
+        id->builtin = true;
+        break;
+      }
+      break;
+    }
+    case kOpMemberDecorate: {
+      Id *id = n_words > 4 ? at(words[1]) : nullptr;
+      if (!id)
+        break;
+      uint32_t member = words[2];
+      if (words[3] == kOffset) {
+        id->member_offsets.resize(
+            std::max<size_t>(id->member_offsets.size(), member + 1));
+        id->member_offsets[member] = words[4];
+      } else if (words[3] == kMatrixStride) {
+        id->member_matrix_strides.resize(
+            std::max<size_t>(id->member_matrix_strides.size(), member + 1));
+        id->member_matrix_strides[member] = words[4];
+      }
+      break;
+    }
+    }
+  }
+  return true;
+}
+
+uint32_t Module::getSize(uint32_t type, uint32_t matrix_stride) const {
+  const Id &id = get(type);
+  std::span<const uint32_t> words = id.words;
+  switch (id.opcode()) {
+  case kOpTypeBool:
+    return 4;
+  case kOpTypeInt:
+  case kOpTypeFloat:
+    return words[2] / 8;
+  case kOpTypeVector:
+    return words[3] * getSize(words[2]);
+  case kOpTypeMatrix:
+    return words[3] * (matrix_stride ? matrix_stride : getSize(words[2]));
+  case kOpTypeArray: {
+    uint32_t stride =
+        id.array_stride ? id.array_stride : getSize(words[2], matrix_stride);
+    return getConstant(words[3]) * stride;
+  }
+  case kOpTypeStruct: {
+    // Members are laid out by their offsets, the last one ends the struct.
+    uint32_t size = 0;
+    for (size_t m = 2; m < words.size(); m++) {
+      size_t member = m - 2;
+      uint32_t offset =
+          member < id.member_offsets.size() ? id.member_offsets[member] : 0;
+      uint32_t stride = member < id.member_matrix_strides.size()
+                            ? id.member_matrix_strides[member]
+                            : 0;
+      size = std::max(size, offset + getSize(words[m], stride));
+    }
+    return size;
+  }
+  default:
+    // Runtime arrays have no static size.
+    return 0;
+  }
+}
+
+bool Module::getDescriptorType(uint32_t type, uint32_t storage_class,
+                               VkDescriptorType &out) const {
+  const Id &id = get(type);
+  switch (storage_class) {
+  case kUniformConstant:
+    switch (id.opcode()) {
+    case kOpTypeSampler:
+      out = VK_DESCRIPTOR_TYPE_SAMPLER;
+      return true;
+    case kOpTypeSampledImage:
+      out = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      return true;
+    case kOpTypeImage: {
+      uint32_t dim = id.words[3];
+      bool storage = id.words[7] == 2;
+      if (dim == kDimBuffer)
+        out = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                      : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+      else if (dim == kDimSubpassData)
+        out = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+      else
+        out = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                      : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+      return true;
+    }
+    default:
+      return false;
+    }
+  case kUniform:
+    // Storage buffers of SPIR-V before 1.3 are uniforms of a BufferBlock.
+    out = id.buffer_block ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                          : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    return true;
+  case kStorageBuffer:
+    out = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    return true;
+  default:
+    return false;
+  }
+}
+
+VkFormat Module::getInputFormat(uint32_t type) const {
+  const Id &id = get(type);
+  uint32_t n_components = 1;
+  const Id *component = &id;
+  if (id.opcode() == kOpTypeVector) {
+    n_components = id.words[3];
+    component = &get(id.words[2]);
+  }
+  if (n_components < 1 || n_components > 4 ||
+      (component->opcode() != kOpTypeFloat &&
+       component->opcode() != kOpTypeInt) ||
+      component->words[2] != 32)
+    return VK_FORMAT_UNDEFINED;
+  static constexpr VkFormat kFloat[] = {
+      VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+      VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+  static constexpr VkFormat kSint[] = {
+      VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT,
+      VK_FORMAT_R32G32B32A32_SINT};
+  static constexpr VkFormat kUint[] = {
+      VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT,
+      VK_FORMAT_R32G32B32A32_UINT};
+  if (component->opcode() == kOpTypeFloat)
+    return kFloat[n_components - 1];
+  return component->words[3] ? kSint[n_components - 1]
+                             : kUint[n_components - 1];
+}
+
+bool Module::reflect(ShaderReflection &out) const {
+  out = {};
+  out.stages = m_stages;
+  for (uint32_t variable : m_variables) {
+    const Id &var = get(variable);
+    const Id &pointer = get(var.words[1]);
+    if (pointer.opcode() != kOpTypePointer)
+      continue;
+    uint32_t storage_class = var.words[3];
+    uint32_t type = pointer.words[3];
+
+    if (storage_class == kPushConstant) {
+      out.push_constants.stageFlags = m_stages;
+      out.push_constants.offset = 0;
+      out.push_constants.size = getSize(type);
+      continue;
+    }
+    if (storage_class == kInput) {
+      if ((m_stages & VK_SHADER_STAGE_VERTEX_BIT) && !var.builtin &&
+          var.location != UINT32_MAX)
+        out.inputs.push_back({var.location, getInputFormat(type)});
+      continue;
+    }
+    if (storage_class != kUniformConstant && storage_class != kUniform &&
+        storage_class != kStorageBuffer)
+      continue;
+
+    // Arrays of descriptors, the innermost type gives the descriptor type.
+    uint32_t count = 1;
+    while (get(type).opcode() == kOpTypeArray ||
+           get(type).opcode() == kOpTypeRuntimeArray) {
+      const Id &array = get(type);
+      count = array.opcode() == kOpTypeArray
+                  ? count * getConstant(array.words[3])
+                  : 0;
+      type = array.words[2];
+    }
+    ShaderReflection::Binding binding = {};
+    if (!getDescriptorType(type, storage_class, binding.type)) {
+      LOGE("Resource at set {} binding {} has no descriptor type.", var.set,
+           var.binding);
+      return false;
+    }
+    binding.set = var.set == UINT32_MAX ? 0 : var.set;
+    binding.binding = var.binding == UINT32_MAX ? 0 : var.binding;
+    binding.count = count;
+    binding.stages = m_stages;
+    // Aliases of a binding, e.g. a bindless buffer array read as several
+    // block types, are one descriptor.
+    auto alias = std::find_if(out.bindings.begin(), out.bindings.end(),
+                              [&](const ShaderReflection::Binding &other) {
+                                return other.set == binding.set &&
+                                       other.binding == binding.binding;
+                              });
+    if (alias == out.bindings.end()) {
+      out.bindings.push_back(binding);
+    } else if (alias->type != binding.type) {
+      LOGE("Set {} binding {} is declared with two descriptor types.",
+           binding.set, binding.binding);
+      return false;
+    } else {
+      alias->count =
+          alias->count == 0 || count == 0 ? 0 : std::max(alias->count, count);
+    }
+  }
+  std::sort(out.bindings.begin(), out.bindings.end(),
+            [](const auto &a, const auto &b) {
+              return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+            });
+  std::sort(out.inputs.begin(), out.inputs.end(),
+            [](const auto &a, const auto &b) {
+              return a.location < b.location;
+            });
+  return true;
+}
+} // namespace
+
+bool reflectShader(std::span<const uint32_t> code, ShaderReflection &out) {
+  Module module;
+  return module.parse(code) && module.reflect(out);
+}
+
+bool ShaderReflection::merge(const ShaderReflection &other) {
+  stages |= other.stages;
+  for (const Binding &theirs : other.bindings) {
+    auto it = std::find_if(bindings.begin(), bindings.end(),
+                           [&](const Binding &ours) {
+                             return ours.set == theirs.set &&
+                                    ours.binding == theirs.binding;
+                           });
+    if (it == bindings.end()) {
+      bindings.push_back(theirs);
+      continue;
+    }
+    if (it->type != theirs.type) {
+      LOGE("Set {} binding {} is declared with two descriptor types.",
+           theirs.set, theirs.binding);
+      return false;
+    }
+    it->stages |= theirs.stages;
+    it->count = it->count == 0 || theirs.count == 0
+                    ? 0
+                    : std::max(it->count, theirs.count);
+  }
+  std::sort(bindings.begin(), bindings.end(),
+            [](const auto &a, const auto &b) {
+              return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+            });
+
+  // Vulkan takes one range for all stages reading it.
+  const VkPushConstantRange &range = other.push_constants;
+  if (range.size > 0 && push_constants.size == 0) {
+    push_constants = range;
+  } else if (range.size > 0) {
+    uint32_t end = std::max(push_constants.offset + push_constants.size,
+                            range.offset + range.size);
+    push_constants.offset = std::min(push_constants.offset, range.offset);
+    push_constants.size = end - push_constants.offset;
+    push_constants.stageFlags |= range.stageFlags;
+  }
+
+  if (inputs.empty())
+    inputs = other.inputs;
+  return true;
+}
+
+uint32_t ShaderReflection::getSetCount() const {
+  return bindings.empty() ? 0 : bindings.back().set + 1;
+}
+
+std::vector<VkDescriptorSetLayoutBinding>
+ShaderReflection::getSetBindings(uint32_t set,
+                                 uint32_t runtime_array_count) const {
+  std::vector<VkDescriptorSetLayoutBinding> set_bindings;
+  for (const Binding &binding : bindings) {
+    if (binding.set != set)
+      continue;
+    set_bindings.push_back(
+        {binding.binding, binding.type,
+         binding.count ? binding.count : runtime_array_count, binding.stages,
+         nullptr});
+  }
+  return set_bindings;
+}
+} // namespace vkutil
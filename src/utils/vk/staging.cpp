@@ -0,0 +1,74 @@
+#include "utils/vk/staging.hpp"
+#include "utils/vk/buffers.hpp"
+#include <algorithm>
+
+void StagingRing::init(VmaAllocator allocator, VkDeviceSize capacity) {
+  vkbuffer::BufferBuilder builder;
+  // CPU_ONLY memory is host coherent, no flush needed after writes.
+  m_buffer = builder.setSize(capacity)
+                 .addBufferUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+                 .setMemoryUsage(VMA_MEMORY_USAGE_CPU_ONLY)
+                 .build(allocator);
+  m_capacity = capacity;
+  m_head = m_tail = 0;
+  m_allocated.clear();
+  m_stats = {};
+  m_stats.capacity = capacity;
+}
+
+void StagingRing::destroy() {
+  m_buffer.destroy();
+  m_allocated.clear();
+}
+
+bool StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment,
+                           uint64_t retire_value, Region &out) {
+  if (size > m_capacity)
+    return false;
+  if (m_allocated.empty())
+    m_head = m_tail = 0;
+
+  VkDeviceSize start = (m_head + alignment - 1) / alignment * alignment;
+  bool wrapped = !m_allocated.empty() && m_head <= m_tail;
+  if (wrapped) {
+    if (start + size > m_tail)
+      return false;
+  } else if (start + size > m_capacity) {
+    // No room at the end, start over. The rest of the end is skipped.
+    if (!m_allocated.empty() && size > m_tail)
+      return false;
+    start = 0;
+    m_stats.n_wraps++;
+  }
+
+  m_head = start + size;
+  m_allocated.push_back({m_head, retire_value});
+  out.buffer = m_buffer.buffer;
+  out.offset = start;
+  out.mapped = (char *)m_buffer.alloc_info.pMappedData + start;
+
+  m_stats.n_allocations++;
+  m_stats.peak_in_use = std::max(m_stats.peak_in_use, inUse());
+  return true;
+}
+
+void StagingRing::retire(uint64_t done_value) {
+  while (!m_allocated.empty() &&
+         m_allocated.front().retire_value <= done_value) {
+    m_tail = m_allocated.front().end;
+    m_allocated.pop_front();
+    m_stats.n_retired++;
+  }
+}
+
+VkDeviceSize StagingRing::inUse() const {
+  if (m_allocated.empty())
+    return 0;
+  return m_head > m_tail ? m_head - m_tail : m_capacity - m_tail + m_head;
+}
+
+StagingRing::Stats StagingRing::getStats() const {
+  Stats stats = m_stats;
+  stats.in_use = inUse();
+  return stats;
+}